@@ -0,0 +1,422 @@
+#ifndef SIM_ALLOC_HH
+#define SIM_ALLOC_HH
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace sim {
+
+    //
+    // slab, size-classed free lists for small, short-lived records (queued
+    // packets, packet bodies, opinions).
+    //
+    // blocks are carved from large chunks.  each thread keeps a bounded
+    // cache per size class; a thread that frees more than it allocates (a
+    // link or receiver releasing what a sender made) spills whole batches
+    // to a shared depot, and a thread that runs dry takes a batch from the
+    // depot before carving a new chunk.  so blocks flow back to whoever
+    // allocates, and steady-state traffic reaches neither the general
+    // purpose allocator nor new chunks, whichever threads make and release
+    // it.  the shared lock is taken once per batch, not per block.
+    //
+    // chunk memory is kept for the life of the process, so the footprint
+    // is the peak live size plus the caches.  requests larger than
+    // max_block fall through to operator new.
+    //
+    // a thread's cache is a thread_local and goes away before the
+    // thread's other thread_locals and statics constructed ahead of it;
+    // whatever those free or allocate afterwards goes straight to the
+    // depot, one block at a time.
+    //
+    struct slab {
+        static constexpr size_t min_block = 16;
+        static constexpr size_t max_block = 1024;
+        static constexpr size_t chunk_size = 64 * 1024;
+        static constexpr size_t classes = 7; // 16, 32, ..., 1024
+        static constexpr size_t batch = 64;  // blocks moved to or from the depot at once
+        static constexpr size_t cache_limit = 2 * batch; // per thread and class
+
+        static void* allocate(size_t bytes) {
+            if(bytes > max_block) {
+                return ::operator new(bytes);
+            }
+            if(auto s = local()) {
+                return s->pop(size_class(bytes));
+            }
+            return orphan_pop(size_class(bytes));
+        }
+
+        static void deallocate(void* p, size_t bytes) {
+            if(!p) {
+                return;
+            }
+            if(bytes > max_block) {
+                ::operator delete(p);
+                return;
+            }
+            if(auto s = local()) {
+                s->push(size_class(bytes), p);
+            } else {
+                orphan_push(size_class(bytes), p);
+            }
+        }
+
+        //
+        // chunks carved so far, process-wide.
+        static size_t chunks() {
+            return shared().chunks.load(std::memory_order_relaxed);
+        }
+
+        slab() {
+            state() = alive;
+        };
+        slab(const slab&) = delete;
+        slab& operator=(const slab&) = delete;
+
+        //
+        // a thread going away hands its cached blocks to the depot.
+        ~slab() {
+            for(size_t cls = 0; cls < classes; cls++) {
+                while(cache_[cls].count > 0) {
+                    spill(cls, std::min(batch, cache_[cls].count));
+                }
+            }
+            state() = dead;
+        }
+
+    private:
+        struct free_block {
+            free_block* next;
+        };
+
+        struct cache {
+            free_block* head {nullptr};
+            size_t count {0};
+        };
+
+        struct depot {
+            std::mutex mut;
+            std::vector<std::pair<free_block*, size_t>> batches[classes];
+            std::atomic<size_t> chunks {0};
+        };
+
+        static size_t size_class(size_t bytes) {
+            size_t cls = 0;
+            size_t size = min_block;
+            while(size < bytes) {
+                size <<= 1;
+                cls++;
+            }
+            return cls;
+        }
+
+        enum : uint8_t { unborn, alive, dead };
+
+        //
+        // trivially destructible, so still readable once the thread's
+        // slab is gone.
+        static uint8_t& state() {
+            thread_local uint8_t s = unborn;
+            return s;
+        }
+
+        //
+        // the calling thread's slab, or null once it has been destroyed.
+        static slab* local() {
+            if(state() == dead) {
+                return nullptr;
+            }
+            thread_local slab s;
+            return &s;
+        }
+
+        //
+        // never destroyed, like the chunks, so blocks freed during static
+        // destruction still have somewhere to go.
+        static depot& shared() {
+            static depot* d = new depot;
+            return *d;
+        }
+
+        void* pop(size_t cls) {
+            auto& c = cache_[cls];
+            if(!c.head && !fetch(cls)) {
+                refill(cls);
+            }
+            auto b = c.head;
+            c.head = b->next;
+            c.count--;
+            return b;
+        }
+
+        void push(size_t cls, void* p) {
+            auto& c = cache_[cls];
+            auto b = static_cast<free_block*>(p);
+            b->next = c.head;
+            c.head = b;
+            if(++c.count > cache_limit) {
+                spill(cls, batch);
+            }
+        }
+
+        //
+        // move the first n cached blocks to the depot as one batch.
+        void spill(size_t cls, size_t n) {
+            auto& c = cache_[cls];
+            auto first = c.head;
+            auto last = first;
+            for(size_t i = 1; i < n; i++) {
+                last = last->next;
+            }
+            c.head = last->next;
+            c.count -= n;
+            last->next = nullptr;
+            auto& d = shared();
+            std::lock_guard<std::mutex> lk(d.mut);
+            d.batches[cls].emplace_back(first, n);
+        }
+
+        bool fetch(size_t cls) {
+            auto& d = shared();
+            std::lock_guard<std::mutex> lk(d.mut);
+            auto& b = d.batches[cls];
+            if(b.empty()) {
+                return false;
+            }
+            cache_[cls].head = b.back().first;
+            cache_[cls].count = b.back().second;
+            b.pop_back();
+            return true;
+        }
+
+        //
+        // carve a chunk: one batch for this thread, the rest to the depot.
+        void refill(size_t cls) {
+            auto& d = shared();
+            std::lock_guard<std::mutex> lk(d.mut);
+            carve(cls);
+            auto& b = d.batches[cls];
+            cache_[cls].head = b.back().first;
+            cache_[cls].count = b.back().second;
+            b.pop_back();
+        }
+
+        //
+        // cut a new chunk into batches in the depot.  call with its lock held.
+        static void carve(size_t cls) {
+            const size_t block = min_block << cls;
+            auto chunk = static_cast<uint8_t*>(::operator new(chunk_size));
+            auto& d = shared();
+            d.chunks.fetch_add(1, std::memory_order_relaxed);
+            size_t off = 0;
+            while(off + block <= chunk_size) {
+                free_block* head = nullptr;
+                size_t n = 0;
+                for(; n < batch && off + block <= chunk_size; n++, off += block) {
+                    auto b = reinterpret_cast<free_block*>(chunk + off);
+                    b->next = head;
+                    head = b;
+                }
+                d.batches[cls].emplace_back(head, n);
+            }
+        }
+
+        //
+        // without a thread cache: one block to or from the depot.
+        static void orphan_push(size_t cls, void* p) {
+            auto b = static_cast<free_block*>(p);
+            b->next = nullptr;
+            auto& d = shared();
+            std::lock_guard<std::mutex> lk(d.mut);
+            d.batches[cls].emplace_back(b, 1);
+        }
+
+        static void* orphan_pop(size_t cls) {
+            auto& d = shared();
+            std::lock_guard<std::mutex> lk(d.mut);
+            auto& batches = d.batches[cls];
+            if(batches.empty()) {
+                carve(cls);
+            }
+            auto& top = batches.back();
+            auto b = top.first;
+            top.first = b->next;
+            if(--top.second == 0) {
+                batches.pop_back();
+            }
+            return b;
+        }
+
+        cache cache_[classes];
+    };
+
+    //
+    // std-compatible allocator drawing from the calling thread's slab.
+    // stateless, so containers using it can be freely moved and swapped.
+    //
+    template <typename T>
+    struct slab_allocator {
+        using value_type = T;
+
+        slab_allocator() noexcept {};
+        template <typename U>
+        slab_allocator(const slab_allocator<U>&) noexcept {}
+
+        T* allocate(size_t n) {
+            if(alignof(T) > slab::min_block) {
+                return static_cast<T*>(::operator new(n * sizeof(T)));
+            }
+            return static_cast<T*>(slab::allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* p, size_t n) {
+            if(alignof(T) > slab::min_block) {
+                ::operator delete(p);
+            } else {
+                slab::deallocate(p, n * sizeof(T));
+            }
+        }
+
+        template <typename U>
+        bool operator==(const slab_allocator<U>&) const { return true; }
+        template <typename U>
+        bool operator!=(const slab_allocator<U>&) const { return false; }
+    };
+
+    //
+    // make_shared counterpart that places the object and its control block
+    // in a slab block.
+    //
+    template <typename T, typename... Args>
+    std::shared_ptr<T> make_pooled(Args&&... args) {
+        return std::allocate_shared<T>(slab_allocator<T>(), std::forward<Args>(args)...);
+    }
+
+
+    //
+    // arena, bump allocator for records that all die together.  allocations
+    // are never freed individually; instead the arena is rewound to a mark
+    // (see arena::scope) or reset, and its chunks are reused in bulk.
+    //
+    struct arena {
+        struct mark_t {
+            size_t chunk;
+            size_t offset;
+        };
+
+        //
+        // rewinds the arena to where it was on construction.  scopes nest, so
+        // a component may use the thread's arena while a caller further up
+        // the stack holds an outer scope on it.
+        struct scope {
+            scope(arena& a) : arena_(a), mark_(a.mark()) {};
+            ~scope() { arena_.rewind(mark_); }
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+        private:
+            arena& arena_;
+            const mark_t mark_;
+        };
+
+        arena(size_t chunk_size = 64 * 1024) : chunk_size_(chunk_size) {};
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+
+        void* allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+            while(true) {
+                if(cur_ < chunks_.size()) {
+                    auto& c = chunks_[cur_];
+                    // align the address; chunks themselves are only aligned
+                    // for max_align_t.
+                    const uintptr_t base = reinterpret_cast<uintptr_t>(c.data.get());
+                    size_t off = size_t(((base + offset_ + align - 1) & ~uintptr_t(align - 1)) - base);
+                    if(off + bytes <= c.size) {
+                        offset_ = off + bytes;
+                        return c.data.get() + off;
+                    }
+                    if(cur_ + 1 < chunks_.size() && chunks_[cur_ + 1].size >= bytes + align) {
+                        cur_++;
+                        offset_ = 0;
+                        continue;
+                    }
+                }
+                // no room in the retained chunks, add one after the current chunk.
+                size_t size = std::max(chunk_size_, bytes + align);
+                size_t at = chunks_.empty() ? 0 : cur_ + 1;
+                chunks_.insert(chunks_.begin() + at, chunk { std::unique_ptr<uint8_t[]>(new uint8_t[size]), size });
+                cur_ = at;
+                offset_ = 0;
+            }
+        }
+
+        mark_t mark() const {
+            return { cur_, offset_ };
+        }
+
+        void rewind(mark_t m) {
+            cur_ = m.chunk;
+            offset_ = m.offset;
+        }
+
+        void reset() {
+            rewind({ 0, 0 });
+        }
+
+        //
+        // per-thread scratch arena, used for step-scoped records.
+        static arena& local() {
+            thread_local arena a;
+            return a;
+        }
+
+    private:
+        struct chunk {
+            std::unique_ptr<uint8_t[]> data;
+            size_t size;
+        };
+
+        std::vector<chunk> chunks_;
+        const size_t chunk_size_;
+        size_t cur_ {0};
+        size_t offset_ {0};
+    };
+
+    //
+    // std-compatible allocator over an arena.  deallocate is a no-op; memory
+    // comes back when the arena is rewound.
+    //
+    template <typename T>
+    struct arena_allocator {
+        using value_type = T;
+
+        arena_allocator(arena& a = arena::local()) noexcept : arena_(&a) {};
+        template <typename U>
+        arena_allocator(const arena_allocator<U>& other) noexcept : arena_(other.arena_) {}
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+        }
+        void deallocate(T*, size_t) {}
+
+        template <typename U>
+        bool operator==(const arena_allocator<U>& other) const { return arena_ == other.arena_; }
+        template <typename U>
+        bool operator!=(const arena_allocator<U>& other) const { return arena_ != other.arena_; }
+
+    private:
+        template <typename U> friend struct arena_allocator;
+        arena* arena_;
+    };
+
+    template <typename T>
+    using arena_vector = std::vector<T, arena_allocator<T>>;
+}
+
+#endif /* SIM_ALLOC_HH */
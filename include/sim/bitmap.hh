@@ -0,0 +1,76 @@
+#ifndef SIM_BITMAP_HH
+#define SIM_BITMAP_HH
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sim {
+
+    //
+    // bitmap, a set of small integers (node ids, say) as 64-bit words,
+    // grown on demand.  union and difference are word-wise, so merging
+    // two sets over n ids costs n / 64 operations whatever they hold.
+    //
+    struct bitmap {
+        void set(size_t i) {
+            if(i / 64 >= words_.size()) {
+                words_.resize(i / 64 + 1, 0);
+            }
+            words_[i / 64] |= uint64_t(1) << (i % 64);
+        }
+
+        bool test(size_t i) const {
+            return i / 64 < words_.size() && (words_[i / 64] >> (i % 64)) & 1;
+        }
+
+        size_t count() const {
+            size_t n = 0;
+            for(auto w : words_) {
+                n += size_t(std::popcount(w));
+            }
+            return n;
+        }
+
+        bool empty() const {
+            return std::all_of(words_.begin(), words_.end(), [](uint64_t w) { return w == 0; });
+        }
+
+        void clear() { words_.clear(); }
+
+        //
+        // *this |= other; returns how many bits were new.
+        size_t merge(const bitmap& other) {
+            if(other.words_.size() > words_.size()) {
+                words_.resize(other.words_.size(), 0);
+            }
+            size_t added = 0;
+            for(size_t i = 0; i < other.words_.size(); i++) {
+                added += size_t(std::popcount(other.words_[i] & ~words_[i]));
+                words_[i] |= other.words_[i];
+            }
+            return added;
+        }
+
+        //
+        // the bits of *this that aren't in mask.
+        bitmap without(const bitmap& mask) const {
+            bitmap res;
+            res.words_.resize(words_.size(), 0);
+            for(size_t i = 0; i < words_.size(); i++) {
+                res.words_[i] = words_[i] & (i < mask.words_.size() ? ~mask.words_[i] : ~uint64_t(0));
+            }
+            return res;
+        }
+
+        const std::vector<uint64_t>& words() const { return words_; }
+        size_t bytes() const { return words_.size() * sizeof(uint64_t); }
+
+    private:
+        std::vector<uint64_t> words_;
+    };
+}
+
+#endif /* SIM_BITMAP_HH */
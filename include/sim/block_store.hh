@@ -0,0 +1,114 @@
+#ifndef SIM_BLOCK_STORE_HH
+#define SIM_BLOCK_STORE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sim/blockchain.hh"
+#include "sim/memory.hh"
+
+namespace sim {
+
+    //
+    // block_store, append-only chain of blocks backed by a local file.
+    //
+    // every appended block is written to the file straight away.  headers
+    // and the hash index stay in memory (about a hundred bytes per block);
+    // only the bodies of the newest `resident` blocks are kept, older ones
+    // are dropped and read back through a read-only mapping of the file
+    // when asked for.  the resident set is therefore bounded by the window,
+    // not by the length of the run.
+    //
+    // stores made with the default constructor share one unlinked temporary
+    // file per process, so a thousand nodes hold one descriptor, and
+    // nothing is left behind on exit.  a store writes into extents it
+    // reserves at the end of its file, each twice the size of its last (up
+    // to max_extent), and maps each extent once, on its first read; so a
+    // store holds O(log size) mappings and never remaps what it mapped.
+    // a store's extents are released back to the filesystem when it goes.
+    //
+    // a store is not synchronised; call from under the owner's lock.
+    // stores on one file may be used from different threads.
+    //
+    class block_store {
+    public:
+        struct header {
+            sha256_t sha;
+            sha256_t prev_block;
+            sha256_t merkle;
+            uint32_t txs;
+            uint64_t offset; // of the record in the file
+        };
+
+        static constexpr uint64_t min_extent = 64 * 1024;
+        static constexpr uint64_t max_extent = 64 * 1024 * 1024;
+
+        explicit block_store(size_t resident = 64);
+        block_store(const std::string& path, size_t resident = 64);
+        ~block_store();
+
+        block_store(const block_store&) = delete;
+        block_store& operator=(const block_store&) = delete;
+
+        void append(std::shared_ptr<block> b);
+
+        size_t size() const { return headers_.size(); }
+        bool empty() const { return headers_.empty(); }
+        const header& at(size_t height) const { return headers_[height]; }
+        const header& back() const { return headers_.back(); }
+        using header_list = std::vector<header, tagged_allocator<header, memory::chain>>;
+        const header_list& headers() const { return headers_; }
+
+        bool contains(const sha256_t& sha) const;
+        // -1 when unknown.
+        int64_t height_of(const sha256_t& sha) const;
+
+        //
+        // the block body, from memory if resident, otherwise read back from
+        // the file.  nullptr if the height or hash is unknown.
+        std::shared_ptr<block> get(size_t height);
+        std::shared_ptr<block> get(const sha256_t& sha);
+
+        //
+        // whether a tx is in one of the resident blocks.  pruned bodies are
+        // not searched.
+        bool has_tx(const sha256_t& sha) const;
+
+        size_t resident() const { return resident_.size(); }
+        // bytes of records this store wrote, and of the extents holding them.
+        uint64_t file_bytes() const { return file_size_; }
+        uint64_t reserved_bytes() const;
+        size_t extents() const { return extents_.size(); }
+        uint64_t reads() const { return reads_; }
+
+    private:
+        struct file;
+        struct extent {
+            uint64_t offset; // in the file
+            uint64_t size;
+            uint64_t used {0};
+            uint8_t* map {nullptr};
+        };
+
+        uint64_t reserve(size_t bytes);
+        std::shared_ptr<block> read(const header& h);
+        void index_txs(const block& b, int delta);
+
+        std::shared_ptr<file> file_;
+        const size_t window_;
+        std::vector<extent> extents_;
+        uint64_t file_size_ {0};
+        uint64_t reads_ {0};
+        header_list headers_;
+        std::unordered_map<sha256_t, size_t, sha256_hash, std::equal_to<sha256_t>, tagged_allocator<std::pair<const sha256_t, size_t>, memory::chain>> index_;
+        std::deque<std::shared_ptr<block>> resident_;
+        std::unordered_map<sha256_t, uint32_t, sha256_hash, std::equal_to<sha256_t>, tagged_allocator<std::pair<const sha256_t, uint32_t>, memory::tx>> resident_txs_;
+    };
+}
+
+#endif /* SIM_BLOCK_STORE_HH */
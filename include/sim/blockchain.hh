@@ -2,54 +2,135 @@
 #define SIM_BLOCKCHAIN_HH
 
 #include "sim/sha.hh"
+#include "sim/memo.hh"
 
 #include <chrono>
+#include <memory>
 
 namespace sim {
 
 
+    //
+    // tx and block hashes are computed on first use and cached; the
+    // mutators below drop the cached values they affect, so a hash can't
+    // go stale and is never computed twice for the same contents.
+    //
     struct tx {
-        sha256_t pubkey;
-        sha256_t sha;
-
         tx(int64_t num) {
-            pubkey = sha256(reinterpret_cast<uint8_t*>(&num), sizeof(num));
-            recompute_hash();
+            pubkey_ = sha256(reinterpret_cast<uint8_t*>(&num), sizeof(num));
         }
-        auto hash() const {
-            return sha;
+        //
+        // a tx whose hash is already known, e.g. read back from a block_store.
+        tx(const sha256_t& pubkey, const sha256_t& sha)
+        : pubkey_(pubkey)
+        , sha_(sha) {};
+        
+        const sha256_t& pubkey() const { return pubkey_; }
+        void set_pubkey(const sha256_t& pubkey) {
+            pubkey_ = pubkey;
+            sha_.invalidate();
         }
-        void recompute_hash() {
-            std::vector<uint8_t> data;
-            data.insert(data.end(), pubkey.data(), pubkey.data()+pubkey.size());
-            sha = sha256(data.data(), data.size());
+        
+        sha256_t hash() const {
+            return sha_.get([this] {
+                auto data = pubkey_;
+                return sha256(data.data(), data.size());
+            });
         }
         bool operator<(const tx& other) const {
             return hash() < other.hash();
         }
+        
+    private:
+        sha256_t pubkey_;
+        memo<sha256_t> sha_;
     };
 
+    //
+    // the merkle root is kept as an incremental tree over the tx hashes:
+    // add_tx rehashes one path, not every leaf.  the header hash covers
+    // prev_block and the merkle root, so set_prev_block leaves the root alone.
+    //
     struct block {
-        std::vector<std::shared_ptr<tx>> txs;
-        sha256_t sha;
-        sha256_t prev_block;
-        sha256_t merkle;
+        using tx_ptr = std::shared_ptr<tx>;
+        
+        block() {};
+        //
+        // a block whose merkle root and hash are already known, e.g. read
+        // back from a block_store.
+        block(const sha256_t& prev_block, const sha256_t& merkle, const sha256_t& sha, std::vector<tx_ptr> txs)
+        : txs_(std::move(txs))
+        , prev_block_(prev_block)
+        , merkle_(merkle)
+        , sha_(sha)
+        , tree_stale_(true) {};
         
-        auto hash() const {
-            return sha;
+        const std::vector<tx_ptr>& txs() const { return txs_; }
+        const sha256_t& prev_block() const { return prev_block_; }
+        
+        void add_tx(tx_ptr t) {
+            sync_tree();
+            tree_.push_back(t->hash());
+            txs_.push_back(std::move(t));
+            merkle_.invalidate();
+            sha_.invalidate();
         }
-
-        void recompute_hash() {
-            std::vector<sha256_t> hashes;
+        
+        void set_txs(std::vector<tx_ptr> txs) {
+            std::vector<sha256_t> leaves;
+            leaves.reserve(txs.size());
             for(auto& it : txs) {
-                hashes.emplace_back(it->hash());
+                leaves.push_back(it->hash());
+            }
+            txs_ = std::move(txs);
+            tree_.assign(std::move(leaves));
+            tree_stale_ = false;
+            merkle_.invalidate();
+            sha_.invalidate();
+        }
+        
+        //
+        // txs whose merkle root is already known (e.g. a mempool block
+        // template); the tree is only built if txs are added later.
+        void set_txs(std::vector<tx_ptr> txs, const sha256_t& merkle) {
+            txs_ = std::move(txs);
+            tree_stale_ = true;
+            merkle_.set(merkle);
+            sha_.invalidate();
+        }
+        
+        void set_prev_block(const sha256_t& prev_block) {
+            prev_block_ = prev_block;
+            sha_.invalidate();
+        }
+        
+        sha256_t merkle() const {
+            return merkle_.get([this] {
+                return tree_.root();
+            });
+        }
+        
+        sha256_t hash() const {
+            return sha_.get([this] {
+                sha256_t header[2] { prev_block_, merkle() };
+                return sha256(reinterpret_cast<uint8_t*>(header), sizeof(header));
+            });
+        }
+        
+    private:
+        void sync_tree() {
+            if(tree_stale_) {
+                auto txs = std::move(txs_);
+                set_txs(std::move(txs));
             }
-            merkle = sim::merkle256(hashes);
-            hashes.clear();
-            hashes.push_back(prev_block);
-            hashes.push_back(merkle);
-            sha = sha256(reinterpret_cast<uint8_t*>(hashes.data()), sizeof(sha256_t) * hashes.size());
         }
+        
+        std::vector<tx_ptr> txs_;
+        sha256_t prev_block_ {};
+        merkle_tree tree_;
+        memo<sha256_t> merkle_;
+        memo<sha256_t> sha_;
+        bool tree_stale_ {false};
     };
 }
 
@@ -0,0 +1,535 @@
+#ifndef SIM_CORO_HH
+#define SIM_CORO_HH
+
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "sim/sim.hh"
+
+namespace sim {
+
+    //
+    // behavior, the return type of a node's coroutines.  a behavior does
+    // nothing until handed to co_context::spawn, which starts it on the
+    // next step and owns it from then on.
+    //
+    //   sim::behavior heartbeat() {
+    //       for(;;) {
+    //           send_packet(ping);
+    //           co_await sleep(20);
+    //       }
+    //   }
+    //
+    struct behavior {
+        struct promise_type {
+            behavior get_return_object() {
+                return behavior(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+
+            // frames are node state as far as sim::memory is concerned.
+            static void* operator new(size_t size) {
+                memory::add(memory::node, size);
+                return ::operator new(size);
+            }
+            static void operator delete(void* p, size_t size) {
+                memory::sub(memory::node, size);
+                ::operator delete(p);
+            }
+        };
+
+        behavior(behavior&& other) noexcept : h_(std::exchange(other.h_, {})) {}
+        behavior(const behavior&) = delete;
+        ~behavior() {
+            if(h_) {
+                h_.destroy();
+            }
+        }
+
+        std::coroutine_handle<> release() { return std::exchange(h_, {}); }
+
+    private:
+        explicit behavior(std::coroutine_handle<promise_type> h) : h_(h) {}
+        std::coroutine_handle<promise_type> h_;
+    };
+
+    struct co_scheduler;
+
+    //
+    // co_context, what co_scheduler needs of a node: its behaviors, the
+    // ones ready to run, its timers and its when() conditions.  all of a
+    // node's behaviors run on one thread at a time, so node state touched
+    // only from behaviors needs no locking.
+    //
+    // behaviors are destroyed with the context, which is after the derived
+    // node's members; don't keep guards on members across a co_await.
+    //
+    struct co_context {
+        co_context(co_scheduler& sched);
+        virtual ~co_context();
+
+        co_context(const co_context&) = delete;
+        co_context& operator=(const co_context&) = delete;
+
+        void spawn(behavior b);
+
+        int64_t now() const;
+
+        //
+        // co_await sleep(n): resume n steps from now.  n <= 0 doesn't suspend.
+        struct sleep_awaiter {
+            co_context* ctx;
+            int64_t steps;
+
+            bool await_ready() const { return steps <= 0; }
+            void await_suspend(std::coroutine_handle<> h) {
+                ctx->timers_.push_back({ ctx->now() + steps, h });
+            }
+            void await_resume() const {}
+        };
+
+        sleep_awaiter sleep(int64_t steps) {
+            return { this, steps };
+        }
+
+        //
+        // co_await when(pred): resume once pred() holds.  pred is checked
+        // after this node's behaviors have run, which is the only place
+        // its state changes; call notify() when something else changes it.
+        template <typename F>
+        struct when_awaiter {
+            co_context* ctx;
+            F pred;
+
+            bool await_ready() { return pred(); }
+            void await_suspend(std::coroutine_handle<> h) {
+                ctx->waiters_.push_back({ [](void* p) { return (*static_cast<F*>(p))(); }, &pred, h });
+            }
+            void await_resume() const {}
+        };
+
+        template <typename F>
+        when_awaiter<F> when(F pred) {
+            return { this, std::move(pred) };
+        }
+
+        //
+        // recheck when() conditions at the end of this step, or of the
+        // next if behaviors are already running.  thread-safe.
+        void notify() {
+            post();
+        }
+
+        //
+        // affinity hint, as engine::place: run this context's behaviors
+        // on the thread that steps partition part.  set before stepping.
+        void place(uint32_t part);
+
+    protected:
+        //
+        // move input received since the last run to waiting behaviors
+        // (see co_node); called before each round of resumes.
+        virtual void pump() {}
+
+        //
+        // state to add to this node's digest slot (see sim::digest) after
+        // its behaviors have run in a step.
+        virtual void digest_state() {}
+
+        void make_ready(std::coroutine_handle<> h) {
+            ready_.push_back(h);
+        }
+
+        //
+        // run this context at the end of this step, or of the next if
+        // behaviors are already running.  thread-safe.
+        void post();
+
+    private:
+        friend struct co_scheduler;
+
+        struct waiter {
+            bool (*check)(void*);
+            void* pred;
+            std::coroutine_handle<> h;
+        };
+
+        void run();
+
+        co_scheduler& sched_;
+        const uint64_t order_;
+        const component_id id_; // reserved, for the rng stream and digest
+        rng rng_;
+        std::vector<std::coroutine_handle<>> owned_;
+        std::vector<std::coroutine_handle<>> ready_;
+        std::vector<std::coroutine_handle<>> running_;
+        std::vector<std::pair<int64_t, std::coroutine_handle<>>> timers_;
+        std::vector<waiter> waiters_;
+        int64_t active_step_ {-1};
+        uint32_t part_ {engine::unplaced};
+        size_t scheduled_ {0}; // timers in co_scheduler's heap
+        bool posted_ {false}; // under co_scheduler::mut_
+    };
+
+    //
+    // co_scheduler, resumes suspended behaviors.  runs as an on_step_end
+    // hook, after the links have delivered: due timers and nodes that
+    // received packets or were notified during the step are collected,
+    // sorted into creation order and run in parallel on the engine's
+    // threads, so a hop over a link of latency n takes n steps.  a node
+    // that is waiting on nothing due costs nothing per step.
+    //
+    // with digests on, each node's behaviors digest into a slot of their
+    // own, along with what the node adds in digest_state().
+    //
+    struct co_scheduler {
+        co_scheduler(engine& e) : engine_(e) {
+            e.on_step_end([this](int64_t step) {
+                run(step);
+            }, "behaviors");
+        }
+
+        co_scheduler(const co_scheduler&) = delete;
+        co_scheduler& operator=(const co_scheduler&) = delete;
+
+        int64_t now() const { return now_; }
+        size_t timers() const { return timers_.size(); }
+        size_t last_active() const { return last_active_; }
+
+    private:
+        friend struct co_context;
+
+        struct timer {
+            int64_t wake;
+            uint64_t seq;
+            co_context* ctx;
+            uint64_t order;
+            std::coroutine_handle<> h;
+
+            bool operator>(const timer& other) const {
+                return wake != other.wake ? wake > other.wake : seq > other.seq;
+            }
+        };
+
+        void run(int64_t step) {
+            now_ = step;
+            active_.clear();
+            {
+                std::lock_guard<std::mutex> lk(mut_);
+                for(auto ctx : fresh_) {
+                    if(!dead_.count(ctx)) {
+                        merge_timers(ctx);
+                    }
+                }
+                fresh_.clear();
+                for(auto ctx : pending_) {
+                    if(!dead_.count(ctx)) {
+                        ctx->posted_ = false;
+                        activate(ctx);
+                    }
+                }
+                pending_.clear();
+                dead_.clear();
+            }
+            while(!timers_.empty() && timers_.front().wake <= step) {
+                std::pop_heap(timers_.begin(), timers_.end(), std::greater<timer>());
+                auto t = timers_.back();
+                timers_.pop_back();
+                if(!dead_timers_.empty()) {
+                    auto it = dead_timers_.find(t.order);
+                    if(it != dead_timers_.end()) {
+                        if(--it->second == 0) {
+                            dead_timers_.erase(it);
+                        }
+                        continue;
+                    }
+                }
+                t.ctx->scheduled_--;
+                activate(t.ctx);
+                t.ctx->ready_.push_back(t.h);
+            }
+            auto body = [this](size_t i) {
+                digest::enter(active_[i]->id_);
+                rng::bind(&active_[i]->rng_);
+                active_[i]->run();
+                rng::bind(nullptr);
+            };
+            const size_t threads = engine_.threads();
+            if(!placed_ || threads == 1) {
+                std::sort(active_.begin(), active_.end(), [](co_context* a, co_context* b) {
+                    return a->order_ < b->order_;
+                });
+                engine_.parallel_for(active_.size(), body);
+            } else {
+                // by thread, then creation order; contexts without a hint
+                // are spread in creation order.
+                auto thread_of = [this, threads](const co_context* c) {
+                    return c->part_ != engine::unplaced ? c->part_ % threads : size_t(c->order_ * threads / next_order_);
+                };
+                std::sort(active_.begin(), active_.end(), [&thread_of](co_context* a, co_context* b) {
+                    const size_t ta = thread_of(a), tb = thread_of(b);
+                    return ta != tb ? ta < tb : a->order_ < b->order_;
+                });
+                splits_.assign(threads + 1, active_.size());
+                for(size_t t = 0, i = 0; t < threads; t++) {
+                    splits_[t] = i;
+                    while(i < active_.size() && thread_of(active_[i]) == t) {
+                        i++;
+                    }
+                }
+                engine_.parallel_for(active_.size(), body, &splits_);
+            }
+            for(auto ctx : active_) {
+                merge_timers(ctx);
+            }
+            last_active_ = active_.size();
+            active_.clear();
+        }
+
+        void activate(co_context* ctx) {
+            if(ctx->active_step_ != now_) {
+                ctx->active_step_ = now_;
+                active_.push_back(ctx);
+            }
+        }
+
+        void merge_timers(co_context* ctx) {
+            for(auto& it : ctx->timers_) {
+                timers_.push_back({ it.first, next_seq_++, ctx, ctx->order_, it.second });
+                std::push_heap(timers_.begin(), timers_.end(), std::greater<timer>());
+            }
+            ctx->scheduled_ += ctx->timers_.size();
+            ctx->timers_.clear();
+        }
+
+        void post(co_context* ctx) {
+            std::lock_guard<std::mutex> lk(mut_);
+            if(!ctx->posted_) {
+                ctx->posted_ = true;
+                pending_.push_back(ctx);
+            }
+        }
+
+        void fresh(co_context* ctx) {
+            std::lock_guard<std::mutex> lk(mut_);
+            fresh_.push_back(ctx);
+        }
+
+        //
+        // a context going away leaves its entries in place; they are
+        // skipped when reached.  timers are matched by order, which unlike
+        // the address is never reused.
+        void forget(co_context* ctx) {
+            std::lock_guard<std::mutex> lk(mut_);
+            dead_.insert(ctx);
+            if(ctx->scheduled_ > 0) {
+                dead_timers_[ctx->order_] = ctx->scheduled_;
+            }
+        }
+
+        void born(co_context* ctx) {
+            std::lock_guard<std::mutex> lk(mut_);
+            dead_.erase(ctx);
+        }
+
+        engine& engine_;
+        int64_t now_ {0};
+        uint64_t next_seq_ {0};
+        uint64_t next_order_ {0};
+        std::vector<timer> timers_;
+        std::vector<co_context*> active_;
+        std::vector<size_t> splits_;
+        bool placed_ {false};
+        size_t last_active_ {0};
+        std::unordered_map<uint64_t, size_t> dead_timers_;
+        std::mutex mut_;
+        std::vector<co_context*> pending_;
+        std::vector<co_context*> fresh_;
+        std::unordered_set<co_context*> dead_;
+    };
+
+    inline co_context::co_context(co_scheduler& sched)
+    : sched_(sched)
+    , order_(sched.next_order_++)
+    , id_(sched.engine_.reserve_id())
+    , rng_(sched.engine_.stream(id_)) {
+        sched_.born(this);
+    };
+
+    inline co_context::~co_context() {
+        sched_.forget(this);
+        for(auto h : owned_) {
+            h.destroy();
+        }
+    }
+
+    inline int64_t co_context::now() const {
+        return sched_.now();
+    }
+
+    inline void co_context::spawn(behavior b) {
+        auto h = b.release();
+        owned_.push_back(h);
+        timers_.push_back({ now() + 1, h });
+        sched_.fresh(this);
+    }
+
+    inline void co_context::place(uint32_t part) {
+        part_ = part;
+        sched_.placed_ = true;
+    }
+
+    inline void co_context::post() {
+        sched_.post(this);
+    }
+
+    inline void co_context::run() {
+        for(;;) {
+            pump();
+            for(auto it = waiters_.begin(); it != waiters_.end(); ) {
+                if(it->check(it->pred)) {
+                    ready_.push_back(it->h);
+                    it = waiters_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if(ready_.empty()) {
+                break;
+            }
+            running_.swap(ready_);
+            for(auto h : running_) {
+                h.resume();
+                if(h.done()) {
+                    owned_.erase(std::find(owned_.begin(), owned_.end(), h));
+                    h.destroy();
+                }
+            }
+            running_.clear();
+        }
+        if(digest::active()) {
+            digest_state();
+        }
+    }
+
+    //
+    // co_node, a sim::node whose protocol is written as behaviors.  packets
+    // are buffered as links deliver them and handed out by next_packet()
+    // at the end of the step they arrive in, grouped by link in link
+    // registration order, so the order doesn't depend on which link thread
+    // ran first.
+    //
+    //   sim::behavior receive() {
+    //       for(;;) {
+    //           auto pkt = co_await next_packet();
+    //           ...
+    //       }
+    //   }
+    //
+    // next_delivery() is next_packet() with the link the packet came over,
+    // for protocols that answer the sender only (see node::send_packet_to).
+    //
+    template <typename PacketType>
+    struct co_node : node<PacketType>, co_context {
+        co_node(engine& e, co_scheduler& sched)
+        : node<PacketType>(e)
+        , co_context(sched) {};
+
+        struct delivery {
+            const link<PacketType>* from;
+            PacketType pkt;
+        };
+
+        template <bool WithLink>
+        struct packet_awaiter {
+            co_node* n;
+            std::optional<delivery> value;
+
+            bool await_ready() {
+                if(n->buffer_.empty()) {
+                    return false;
+                }
+                value.emplace(std::move(n->buffer_.front()));
+                n->buffer_.pop_front();
+                return true;
+            }
+            void await_suspend(std::coroutine_handle<> h) {
+                n->packet_waiters_.push_back({ h, &value });
+            }
+            auto await_resume() {
+                if constexpr (WithLink) {
+                    return std::move(*value);
+                } else {
+                    return std::move(value->pkt);
+                }
+            }
+        };
+
+        packet_awaiter<false> next_packet() {
+            return { this, {} };
+        }
+
+        packet_awaiter<true> next_delivery() {
+            return { this, {} };
+        }
+
+        using node<PacketType>::packet_callback;
+
+        void packet_callback(const link<PacketType>& from, const PacketType& pkt) override {
+            on_packets(from, span<const PacketType>(&pkt, 1));
+        }
+
+        void on_packets(const link<PacketType>& from, span<const PacketType> pkts) override {
+            {
+                std::lock_guard<std::mutex> lk(inbox_mut_);
+                for(auto& it : pkts) {
+                    inbox_.push_back({ &from, it });
+                }
+            }
+            post();
+        }
+
+    protected:
+        void pump() override {
+            {
+                std::lock_guard<std::mutex> lk(inbox_mut_);
+                // a link delivers in order, so a stable sort by link is enough.
+                std::stable_sort(inbox_.begin(), inbox_.end(), [](const auto& a, const auto& b) {
+                    return a.from->id() < b.from->id();
+                });
+                for(auto& it : inbox_) {
+                    buffer_.push_back(std::move(it));
+                }
+                inbox_.clear();
+            }
+            while(!buffer_.empty() && !packet_waiters_.empty()) {
+                auto w = packet_waiters_.front();
+                packet_waiters_.pop_front();
+                w.second->emplace(std::move(buffer_.front()));
+                buffer_.pop_front();
+                make_ready(w.first);
+            }
+        }
+
+    private:
+        std::mutex inbox_mut_;
+        std::vector<delivery, tagged_allocator<delivery, memory::node>> inbox_;
+        std::deque<delivery, tagged_allocator<delivery, memory::node>> buffer_;
+        std::deque<std::pair<std::coroutine_handle<>, std::optional<delivery>*>> packet_waiters_;
+    };
+}
+
+#endif /* SIM_CORO_HH */
@@ -0,0 +1,147 @@
+#ifndef SIM_CPU_HH
+#define SIM_CPU_HH
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+namespace sim {
+
+    //
+    // cost model, in abstract work units.  a node's cpu budget is expressed
+    // in the same units, so only the ratios matter.
+    //
+    struct cost_model {
+        double hash {1.0};        // fixed cost of one sha256 invocation
+        double sig_check {50.0};  // one signature verification
+        double per_byte {1.0 / 64}; // per byte fed through a hash or parser
+
+        double hash_bytes(size_t bytes) const {
+            return hash + per_byte * bytes;
+        }
+
+        //
+        // cost of sim::merkle256 over n leaves: the tree is padded to the
+        // next power of two and every inner node hashes two digests.
+        double merkle(size_t leaves) const {
+            if(leaves < 2) {
+                return 0;
+            }
+            const double inner = std::pow(2, std::ceil(std::log2(double(leaves)))) - 1;
+            return inner * hash_bytes(64);
+        }
+    };
+
+    //
+    // cpu, per-node virtual cpu with a fixed budget of work units per step.
+    //
+    // work is submitted with its cost.  it runs immediately when nothing is
+    // queued and the step's remaining budget covers it; otherwise it joins
+    // a fifo and is paid off over as many steps as it takes, running once
+    // fully paid.  a budget of 0 means unlimited: everything runs at once
+    // and only the totals are tracked.
+    //
+    // not synchronised; call only from the owning node's behaviors, which
+    // never run concurrently (see sim::co_node).
+    //
+    struct cpu {
+        cpu(double budget_per_step = 0, cost_model model = {})
+        : model_(model)
+        , budget_(budget_per_step)
+        , remaining_(budget_per_step) {};
+
+        const cost_model& model() const { return model_; }
+
+        //
+        // start a new step: refill the budget and pay down queued work.
+        void step(int64_t current_step) {
+            if(current_step == current_step_) {
+                return;
+            }
+            steps_ += current_step - current_step_;
+            current_step_ = current_step;
+            remaining_ = budget_;
+            while(!queue_.empty() && remaining_ > 0) {
+                auto& job = queue_.front();
+                const double pay = std::min(remaining_, job.cost);
+                job.cost -= pay;
+                remaining_ -= pay;
+                used_ += pay;
+                if(job.cost > 0) {
+                    break;
+                }
+                auto fn = std::move(job.fn);
+                queue_.pop_front();
+                fn();
+            }
+        }
+
+        //
+        // run fn once cost has been paid.  returns true if it ran now.
+        template <typename F>
+        bool submit(double cost, F&& fn) {
+            if(budget_ <= 0 || (queue_.empty() && remaining_ >= cost)) {
+                remaining_ -= budget_ > 0 ? cost : 0;
+                used_ += cost;
+                fn();
+                return true;
+            }
+            // whatever is left this step goes towards the head of the queue.
+            double pay = 0;
+            if(queue_.empty()) {
+                pay = std::max(0.0, remaining_);
+                remaining_ = 0;
+                used_ += pay;
+            }
+            queue_.push_back({ cost - pay, std::function<void()>(std::forward<F>(fn)) });
+            deferred_++;
+            return false;
+        }
+
+        //
+        // spend cost if it fits in this step's budget, without queueing.
+        // on false nothing was spent, and the caller must hold the work
+        // back and try again on a later step.
+        bool try_spend(double cost) {
+            if(budget_ > 0 && (!queue_.empty() || remaining_ < cost)) {
+                return false;
+            }
+            remaining_ -= budget_ > 0 ? cost : 0;
+            used_ += cost;
+            return true;
+        }
+
+        //
+        // fraction of the budget used over all steps so far, 0 when unlimited.
+        double utilization() const {
+            if(budget_ <= 0 || steps_ == 0) {
+                return 0;
+            }
+            return used_ / (budget_ * steps_);
+        }
+
+        double work() const { return used_; }
+        size_t backlog() const { return queue_.size(); }
+        size_t deferred() const { return deferred_; }
+
+    private:
+        struct job {
+            double cost;
+            std::function<void()> fn;
+        };
+
+        cost_model model_;
+        std::deque<job> queue_;
+        double budget_;
+        double remaining_;
+        double used_ {0};
+        int64_t current_step_ {0};
+        int64_t steps_ {0};
+        size_t deferred_ {0};
+    };
+}
+
+#endif /* SIM_CPU_HH */
@@ -0,0 +1,373 @@
+#ifndef SIM_CROWD_HH
+#define SIM_CROWD_HH
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "sim/memory.hh"
+#include "sim/sim.hh"
+#include "sim/span.hh"
+#include "sim/topology.hh"
+
+namespace sim {
+
+    //
+    // delay_model, the steps a packet takes to cross a population of
+    // relays, as an empirical distribution.
+    //
+    // a flood reaches every node along its shortest path, so the
+    // shortest-path latencies of the relays' topology are what a full
+    // simulation of relays that forward straight away would measure;
+    // from_topology() samples them.  delays observed in a full run (the
+    // step a packet reached a relay minus the step it was sent) can be
+    // added with record(), on their own or on top.
+    //
+    class delay_model {
+    public:
+        //
+        // latencies from `sources` random nodes of t to every node, each
+        // hop costing its edge latency plus per_hop steps of processing.
+        static delay_model from_topology(const topology& t, size_t sources, uint64_t seed, int64_t per_hop = 0);
+
+        void record(int64_t delay, uint64_t count = 1);
+
+        uint64_t samples() const { return total_; }
+        bool empty() const { return total_ == 0; }
+
+        //
+        // a delay drawn with its recorded frequency, at least 1.
+        int64_t sample(std::mt19937_64& gen) const;
+        int64_t quantile(double q) const;
+        int64_t max() const { return std::max<int64_t>(1, int64_t(histogram_.size()) - 1); }
+        double mean() const;
+
+    private:
+        std::vector<uint64_t> histogram_; // samples per delay
+        uint64_t total_ {0};
+    };
+
+    //
+    // vote_model, how a population votes among the options it has seen:
+    // a `participation` share of members votes, and each voter backs the
+    // option seen most with probability `follow`, otherwise an option
+    // drawn in proportion to how often each was seen.
+    //
+    // observe() fits both parameters to rounds of a full simulation.
+    //
+    struct vote_model {
+        double participation {1};
+        double follow {1};
+
+        //
+        // votes per option from members, given how often each was seen.
+        std::vector<uint64_t> votes(span<const uint64_t> seen, uint64_t members, std::mt19937_64& gen) const;
+
+        //
+        // one round of a full run: how often the relays saw each option
+        // and how many of members voted for each.
+        void observe(span<const uint64_t> seen, span<const uint64_t> votes, uint64_t members);
+
+    private:
+        double members_ {0};
+        double voters_ {0};
+        double plurality_ {0}; // votes for the option seen most
+        double expected_ {0};  // the same at follow = 0
+    };
+
+    //
+    // crowd, `members` homogeneous relays modelled as one component.
+    //
+    // fully simulated nodes connect to a crowd over ordinary links (see
+    // node::join), each link standing for an edge into a different member.
+    // a packet that comes in over one link goes out over every other one,
+    // once, after the time it takes to cross the crowd between the two
+    // members.  that delay is drawn from the delay_model once per pair of
+    // links and kept, so the crowd behaves like a fixed network rather
+    // than reordering at random.  packets are told apart by
+    // digest_value(pkt), the hash the step digest uses, which PacketType
+    // must therefore provide.
+    //
+    // a packet is relayed once.  copies that come in later, however late,
+    // are dropped, as long as the packet is remembered: `horizon` steps
+    // after it first reached the crowd, or for the whole run with 0.
+    // links may come and go between steps; delays between the links that
+    // stay are kept, and a packet already crossing doesn't reach a link
+    // that joined after it.
+    //
+    // the cost is per packet in flight and per pair of links, not per
+    // member.  on_arrival() sees each packet the step it first reaches the
+    // crowd, which is where a protocol derives what the members would say
+    // (see vote_model) and sends it with emit().  packets are handled the
+    // step after they arrive, in link order, so runs are deterministic.
+    //
+    template <typename PacketType>
+    struct crowd : node<PacketType>, component {
+        using arrival_f = std::function<void(const PacketType&, int64_t step)>;
+
+        crowd(engine& e, uint64_t members, delay_model delays, uint64_t seed, int64_t horizon = 0)
+        : node<PacketType>(e)
+        , members_(members)
+        , delays_(std::move(delays))
+        , horizon_(horizon > 0 ? std::max(horizon, lifetime()) : 0)
+        , gen_(seed) {};
+
+        crowd(const crowd&) = delete;
+        crowd& operator=(const crowd&) = delete;
+
+        uint64_t members() const { return members_; }
+        const delay_model& delays() const { return delays_; }
+        uint64_t relayed() const { return relayed_; }
+        size_t in_flight() const { return flights_.size(); }
+        size_t remembered() const { return seen_.size(); }
+
+        void on_arrival(arrival_f fn) { on_arrival_ = std::move(fn); }
+
+        //
+        // send pkt from somewhere inside the crowd: it reaches each link
+        // after a delay drawn afresh.  call from on_arrival, or between
+        // steps.
+        void emit(const PacketType& pkt) {
+            refresh_links();
+            const int64_t now = this->engine_.current_step();
+            auto f = flight_of(pkt, now);
+            if(!f) {
+                return;
+            }
+            for(size_t x = 0; x < links_.size(); x++) {
+                schedule(digest_value(pkt), *f, x, now + delays_.sample(gen_));
+            }
+        }
+
+        void on_packets(const link<PacketType>& from, span<const PacketType> pkts) override {
+            const int64_t now = this->engine_.current_step();
+            std::lock_guard<std::mutex> lk(inbox_mut_);
+            for(auto& it : pkts) {
+                inbox_.push_back({ now, &from, it });
+            }
+        }
+
+        void step() override {
+            const int64_t now = this->engine_.current_step();
+            refresh_links();
+            {
+                std::lock_guard<std::mutex> lk(inbox_mut_);
+                // links may still deliver this step; those wait for the next.
+                auto mid = std::stable_partition(inbox_.begin(), inbox_.end(), [now](const arrival& a) {
+                    return a.step < now;
+                });
+                ready_.assign(std::make_move_iterator(inbox_.begin()), std::make_move_iterator(mid));
+                inbox_.erase(inbox_.begin(), mid);
+            }
+            std::stable_sort(ready_.begin(), ready_.end(), [](const arrival& a, const arrival& b) {
+                return a.step != b.step ? a.step < b.step : a.from->id() < b.from->id();
+            });
+            for(auto& it : ready_) {
+                arrive(it);
+            }
+            ready_.clear();
+
+            while(!due_.empty() && due_.top().step <= now) {
+                auto d = due_.top();
+                due_.pop();
+                auto f = flights_.find(d.key);
+                if(f == flights_.end() || f->second.due[d.link] != d.step) {
+                    continue; // superseded by an earlier arrival
+                }
+                f->second.due[d.link] = sent;
+                relayed_++;
+                this->send_packet_to(*links_[d.link], f->second.pkt);
+            }
+
+            while(!expiry_.empty() && expiry_.front().first <= now) {
+                flights_.erase(expiry_.front().second);
+                expiry_.pop_front();
+            }
+            while(!forget_.empty() && forget_.front().first <= now) {
+                seen_.erase(forget_.front().second);
+                forget_.pop_front();
+            }
+        }
+
+    private:
+        static constexpr int64_t none = std::numeric_limits<int64_t>::max();
+        static constexpr int64_t sent = -1;
+
+        struct arrival {
+            int64_t step;
+            const link<PacketType>* from;
+            PacketType pkt;
+        };
+
+        struct flight {
+            PacketType pkt;
+            std::vector<int64_t> due; // per link: step, none or sent
+        };
+
+        struct delivery {
+            int64_t step;
+            uint64_t seq;
+            uint64_t key;
+            size_t link;
+
+            bool operator>(const delivery& other) const {
+                return step != other.step ? step > other.step : seq > other.seq;
+            }
+        };
+
+        //
+        // steps a flight's per-link state is kept: long enough for every
+        // copy still crossing to have arrived.
+        int64_t lifetime() const {
+            return 4 * delays_.max() + 1;
+        }
+
+        //
+        // follow links() after a link was added or removed, carrying pair
+        // delays, flights and pending sends over to the new link indices.
+        void refresh_links() {
+            if(links_version_ == this->links_version()) {
+                return;
+            }
+            links_version_ = this->links_version();
+            auto links = this->links();
+            std::vector<component_id> ids;
+            for(auto it : links) {
+                ids.push_back(it->id());
+            }
+            constexpr size_t gone = std::numeric_limits<size_t>::max();
+            const size_t m = link_ids_.size();
+            const size_t n = ids.size();
+            std::vector<size_t> moved(m, gone);
+            for(size_t i = 0; i < m; i++) {
+                auto it = std::find(ids.begin(), ids.end(), link_ids_[i]);
+                if(it != ids.end()) {
+                    moved[i] = size_t(it - ids.begin());
+                }
+            }
+            std::vector<int64_t> pairs(n * n, 0);
+            for(size_t a = 0; a < m; a++) {
+                for(size_t b = a; b < m; b++) {
+                    if(moved[a] != gone && moved[b] != gone) {
+                        pairs[std::min(moved[a], moved[b]) * n + std::max(moved[a], moved[b])] = pair_delay_[a * m + b];
+                    }
+                }
+            }
+            for(auto& it : flights_) {
+                std::vector<int64_t> due(n, sent);
+                for(size_t i = 0; i < m; i++) {
+                    if(moved[i] != gone) {
+                        due[moved[i]] = it.second.due[i];
+                    }
+                }
+                it.second.due = std::move(due);
+            }
+            std::vector<delivery> pending;
+            while(!due_.empty()) {
+                auto d = due_.top();
+                due_.pop();
+                if(moved[d.link] != gone) {
+                    d.link = moved[d.link];
+                    pending.push_back(d);
+                }
+            }
+            for(auto& it : pending) {
+                due_.push(it);
+            }
+            links_ = std::move(links);
+            link_ids_ = std::move(ids);
+            pair_delay_ = std::move(pairs);
+            std::lock_guard<std::mutex> lk(inbox_mut_);
+            inbox_.erase(std::remove_if(inbox_.begin(), inbox_.end(), [this](const arrival& a) {
+                return std::find(links_.begin(), links_.end(), a.from) == links_.end();
+            }), inbox_.end());
+        }
+
+        int64_t pair_delay(size_t from, size_t to) {
+            auto& d = pair_delay_[std::min(from, to) * links_.size() + std::max(from, to)];
+            if(d == 0) {
+                d = delays_.sample(gen_);
+            }
+            return d;
+        }
+
+        //
+        // the packet's flight, started if it is new; nullptr if it has
+        // been relayed already and its flight is over.
+        flight* flight_of(const PacketType& pkt, int64_t now) {
+            const uint64_t key = digest_value(pkt);
+            auto it = flights_.find(key);
+            if(it == flights_.end()) {
+                if(!seen_.insert(key).second) {
+                    return nullptr;
+                }
+                if(horizon_ > 0) {
+                    forget_.push_back({ now + horizon_, key });
+                }
+                it = flights_.emplace(key, flight { pkt, std::vector<int64_t>(links_.size(), none) }).first;
+                expiry_.push_back({ now + lifetime(), key });
+            }
+            return &it->second;
+        }
+
+        void schedule(uint64_t key, flight& f, size_t link, int64_t step) {
+            if(f.due[link] != sent && step < f.due[link]) {
+                f.due[link] = step;
+                due_.push({ step, next_seq_++, key, link });
+            }
+        }
+
+        void arrive(const arrival& a) {
+            const size_t from = size_t(std::find(links_.begin(), links_.end(), a.from) - links_.begin());
+            if(from == links_.size()) {
+                return;
+            }
+            const uint64_t key = digest_value(a.pkt);
+            const bool first = !seen_.count(key);
+            auto f = flight_of(a.pkt, a.step);
+            if(!f) {
+                return; // a late copy
+            }
+            // the node on that side has it already.
+            f->due[from] = sent;
+            for(size_t x = 0; x < links_.size(); x++) {
+                if(x != from) {
+                    schedule(key, *f, x, a.step + pair_delay(from, x));
+                }
+            }
+            if(first && on_arrival_) {
+                on_arrival_(a.pkt, a.step);
+            }
+        }
+
+        const uint64_t members_;
+        const delay_model delays_;
+        const int64_t horizon_;
+        std::mt19937_64 gen_;
+        arrival_f on_arrival_;
+        std::vector<const link<PacketType>*> links_;
+        std::vector<component_id> link_ids_; // of links_, to match them up after a change
+        uint64_t links_version_ {~uint64_t(0)};
+        std::vector<int64_t> pair_delay_;
+        std::mutex inbox_mut_;
+        std::vector<arrival> inbox_;
+        std::vector<arrival> ready_;
+        std::unordered_map<uint64_t, flight, std::hash<uint64_t>, std::equal_to<uint64_t>, tagged_allocator<std::pair<const uint64_t, flight>, memory::node>> flights_;
+        std::priority_queue<delivery, std::vector<delivery>, std::greater<delivery>> due_;
+        std::deque<std::pair<int64_t, uint64_t>> expiry_;
+        std::unordered_set<uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>, tagged_allocator<uint64_t, memory::node>> seen_;
+        std::deque<std::pair<int64_t, uint64_t>> forget_;
+        uint64_t next_seq_ {0};
+        uint64_t relayed_ {0};
+    };
+}
+
+#endif /* SIM_CROWD_HH */
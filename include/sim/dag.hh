@@ -2,24 +2,62 @@
 #define SIM_DAG_HH
 
 #include "sim/sha.hh"
+#include "sim/memo.hh"
 
 namespace sim {
 
+    //
+    // the hash is computed on first use and cached.  the setters drop it;
+    // derived types that hash more fields override compute_hash() and call
+    // invalidate() from their own setters.
+    //
     struct tx {
-        sha256_t trunk;
-        sha256_t branch;
-        sha256_t sha;
-        std::vector<uint8_t> payload;
+        virtual ~tx() {};
 
-        virtual void recompute_hash() {
+        const sha256_t& trunk() const { return trunk_; }
+        const sha256_t& branch() const { return branch_; }
+        const std::vector<uint8_t>& payload() const { return payload_; }
+
+        void set_trunk(const sha256_t& trunk) {
+            trunk_ = trunk;
+            invalidate();
+        }
+        void set_branch(const sha256_t& branch) {
+            branch_ = branch;
+            invalidate();
+        }
+        //
+        // edit(payload) for appending to the payload; the hash is dropped
+        // once edit returns, so hash() inside edit sees the old payload.
+        template <typename F>
+        void edit_payload(F&& edit) {
+            edit(payload_);
+            invalidate();
+        }
+
+        sha256_t hash() const {
+            return sha_.get([this] { return compute_hash(); });
+        }
+
+    protected:
+        virtual sha256_t compute_hash() const {
             std::vector<uint8_t> data;
-            data.insert(data.end(), trunk.data(), trunk.data()+trunk.size());
-            data.insert(data.end(), branch.data(), branch.data()+branch.size());
-            data.insert(data.end(), payload.begin(), payload.end());
-            sha = sha256(data.data(), data.size());
+            data.insert(data.end(), trunk_.data(), trunk_.data()+trunk_.size());
+            data.insert(data.end(), branch_.data(), branch_.data()+branch_.size());
+            data.insert(data.end(), payload_.begin(), payload_.end());
+            return sha256(data.data(), data.size());
         }
+        void invalidate() {
+            sha_.invalidate();
+        }
+
+    private:
+        sha256_t trunk_ {};
+        sha256_t branch_ {};
+        std::vector<uint8_t> payload_;
+        memo<sha256_t> sha_;
     };
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,236 @@
+#ifndef SIM_DAG_STORE_HH
+#define SIM_DAG_STORE_HH
+
+#include "sim/dag.hh"
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace sim {
+
+    //
+    // dag_store, hash-indexed dag ledger.
+    //
+    // txs are kept in attach order with their parents resolved to indices, an
+    // approver list per tx and the current tip set.  cumulative weight (1 plus
+    // the number of txs that approve a tx directly or indirectly) is updated
+    // incrementally on attach by walking the new tx's past cone, down to
+    // weight_horizon generations below it.  txs deeper than that stop
+    // gaining weight, which tip selection backing off fewer generations
+    // never compares, and the attach cost stays bounded.  a horizon of 0 walks the whole cone for exact
+    // weights, at O(n) per attach: on a chain-like dag that's 19k tx/s at
+    // 20k txs and 3.3k tx/s at 100k, against about 400k tx/s for both with
+    // the default.
+    //
+    // T is sim::tx or a type derived from it.  a zero trunk or branch hash
+    // means "no parent", which is how genesis txs are expressed.
+    //
+    template <typename T = tx>
+    struct dag_store {
+        using tx_ptr = std::shared_ptr<T>;
+        using index_t = uint32_t;
+        static constexpr index_t none = std::numeric_limits<index_t>::max();
+
+        struct entry {
+            tx_ptr txn;
+            index_t trunk {none};
+            index_t branch {none};
+            std::vector<index_t> approvers;
+            uint64_t weight {1};
+            uint32_t height {0};
+            index_t tip_pos {none};
+        };
+
+        enum class attach_result {
+            attached,
+            duplicate,
+            missing_parent
+        };
+
+        static constexpr uint32_t default_horizon = 64;
+
+        dag_store(uint32_t weight_horizon = default_horizon) : weight_horizon_(weight_horizon) {};
+
+        attach_result attach(tx_ptr t) {
+            if(index_.find(t->hash()) != index_.end()) {
+                return attach_result::duplicate;
+            }
+            index_t trunk = none;
+            index_t branch = none;
+            if(!resolve(t->trunk(), trunk) || !resolve(t->branch(), branch)) {
+                return attach_result::missing_parent;
+            }
+
+            const index_t idx = static_cast<index_t>(entries_.size());
+            entries_.emplace_back();
+            auto& e = entries_.back();
+            e.txn = std::move(t);
+            e.trunk = trunk;
+            e.branch = branch;
+            for(auto p : { trunk, branch }) {
+                if(p != none) {
+                    auto& parent = entries_[p];
+                    if(parent.approvers.empty() || parent.approvers.back() != idx) {
+                        parent.approvers.push_back(idx);
+                    }
+                    e.height = std::max(e.height, parent.height + 1);
+                    remove_tip(p);
+                }
+            }
+            index_.emplace(e.txn->hash(), idx);
+            add_tip(idx);
+            add_weight(idx);
+            return attach_result::attached;
+        }
+
+        bool contains(const sha256_t& sha) const {
+            return index_.find(sha) != index_.end();
+        }
+
+        index_t find(const sha256_t& sha) const {
+            auto it = index_.find(sha);
+            return it == index_.end() ? none : it->second;
+        }
+
+        tx_ptr get(const sha256_t& sha) const {
+            auto idx = find(sha);
+            return idx == none ? nullptr : entries_[idx].txn;
+        }
+
+        const entry& at(index_t idx) const { return entries_[idx]; }
+        size_t size() const { return entries_.size(); }
+        const std::vector<index_t>& tips() const { return tips_; }
+
+        //
+        // weighted random walk (MCMC) towards the tips, starting at start.
+        // from tx x an approver y is chosen with probability proportional to
+        // exp(-alpha * (weight(x) - weight(y))); alpha = 0 is an unweighted
+        // walk.  rand01 is any callable returning a uniform double in [0, 1).
+        template <typename Uniform>
+        index_t walk(index_t start, double alpha, Uniform&& rand01) const {
+            index_t cur = start;
+            while(!entries_[cur].approvers.empty()) {
+                const auto& a = entries_[cur].approvers;
+                if(a.size() == 1) {
+                    cur = a[0];
+                    continue;
+                }
+                // normalising against the heaviest approver keeps exp() in range.
+                uint64_t max_w = 0;
+                for(auto y : a) {
+                    max_w = std::max(max_w, entries_[y].weight);
+                }
+                double total = 0;
+                for(auto y : a) {
+                    total += std::exp(-alpha * double(max_w - entries_[y].weight));
+                }
+                double r = rand01() * total;
+                index_t next = a.back();
+                for(auto y : a) {
+                    r -= std::exp(-alpha * double(max_w - entries_[y].weight));
+                    if(r < 0) {
+                        next = y;
+                        break;
+                    }
+                }
+                cur = next;
+            }
+            return cur;
+        }
+
+        //
+        // pick a tip: start from a random tip, back off depth generations
+        // along trunks, then walk forward.  this keeps the walk length bounded
+        // by depth instead of by the distance from genesis.
+        template <typename Uniform>
+        index_t select_tip(double alpha, uint32_t depth, Uniform&& rand01) const {
+            if(tips_.empty()) {
+                return none;
+            }
+            auto pick = static_cast<size_t>(rand01() * tips_.size());
+            index_t cur = tips_[std::min(pick, tips_.size() - 1)];
+            for(uint32_t i = 0; i < depth && entries_[cur].trunk != none; i++) {
+                cur = entries_[cur].trunk;
+            }
+            return walk(cur, alpha, rand01);
+        }
+
+        //
+        // trunk and branch for a new tx, as two independent walks.
+        template <typename Uniform>
+        std::pair<index_t, index_t> select_tips(double alpha, uint32_t depth, Uniform&& rand01) const {
+            auto trunk = select_tip(alpha, depth, rand01);
+            auto branch = select_tip(alpha, depth, rand01);
+            return { trunk, branch };
+        }
+
+    private:
+        bool resolve(const sha256_t& sha, index_t& idx) const {
+            if(sha == sha256_t{}) {
+                idx = none;
+                return true;
+            }
+            idx = find(sha);
+            return idx != none;
+        }
+
+        void add_tip(index_t idx) {
+            entries_[idx].tip_pos = static_cast<index_t>(tips_.size());
+            tips_.push_back(idx);
+        }
+
+        void remove_tip(index_t idx) {
+            auto pos = entries_[idx].tip_pos;
+            if(pos == none) {
+                return;
+            }
+            tips_[pos] = tips_.back();
+            entries_[tips_[pos]].tip_pos = pos;
+            tips_.pop_back();
+            entries_[idx].tip_pos = none;
+        }
+
+        //
+        // add 1 to the weight of every tx in the past cone of idx, visiting
+        // each once.  visited marks are epoch-stamped so they never need clearing.
+        void add_weight(index_t idx) {
+            visited_.resize(entries_.size(), 0);
+            if(++epoch_ == 0) {
+                std::fill(visited_.begin(), visited_.end(), 0);
+                epoch_ = 1;
+            }
+            const uint32_t floor = (weight_horizon_ == 0 || entries_[idx].height < weight_horizon_)
+                ? 0 : entries_[idx].height - weight_horizon_;
+            stack_.clear();
+            stack_.push_back(entries_[idx].trunk);
+            stack_.push_back(entries_[idx].branch);
+            while(!stack_.empty()) {
+                auto cur = stack_.back();
+                stack_.pop_back();
+                if(cur == none || visited_[cur] == epoch_) {
+                    continue;
+                }
+                visited_[cur] = epoch_;
+                auto& e = entries_[cur];
+                e.weight++;
+                if(e.height > floor) {
+                    stack_.push_back(e.trunk);
+                    stack_.push_back(e.branch);
+                }
+            }
+        }
+
+        std::vector<entry> entries_;
+        std::unordered_map<sha256_t, index_t, sha256_hash> index_;
+        std::vector<index_t> tips_;
+        std::vector<uint32_t> visited_;
+        std::vector<index_t> stack_;
+        uint32_t epoch_ {0};
+        const uint32_t weight_horizon_;
+    };
+}
+
+#endif /* SIM_DAG_STORE_HH */
@@ -0,0 +1,213 @@
+#ifndef SIM_DIGEST_HH
+#define SIM_DIGEST_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sim/sha.hh"
+
+namespace sim {
+
+    //
+    // digest, running 64-bit hash of what happened in each step, for
+    // checking that two runs (different thread counts, scheduling modes,
+    // builds) did the same thing.
+    //
+    // every component gets its own slot for the step, so the result does not
+    // depend on which thread stepped what or in which order.  while a
+    // component is being stepped, digest::add() mixes into its slot: the
+    // engine adds rng draws, links add the packets they deliver, and
+    // components may add whatever state they want checked.  the engine
+    // folds the slots, in component id order, into one value per step.
+    //
+    // off by default; when off, add() is a thread-local load and a branch.
+    //
+    struct digest {
+        static constexpr uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+        //
+        // one xxh64 round; cheap, and plenty to tell two runs apart.
+        static uint64_t mix(uint64_t h, uint64_t v) {
+            v *= 0xc2b2ae3d27d4eb4full;
+            v = (v << 31) | (v >> 33);
+            v *= 0x9e3779b185ebca87ull;
+            h ^= v;
+            h = (h << 27) | (h >> 37);
+            return h * 0x9e3779b185ebca87ull + 0x85ebca77c2b2ae63ull;
+        }
+
+        static bool active() { return current_ != nullptr; }
+
+        template <typename T>
+        static typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type
+        add(T v) {
+            if(current_) {
+                uint64_t x = 0;
+                std::memcpy(&x, &v, sizeof(v) < sizeof(x) ? sizeof(v) : sizeof(x));
+                *current_ = mix(*current_, x);
+            }
+        }
+
+        static void add(const sha256_t& sha) {
+            if(current_) {
+                add_bytes(sha.data(), sha.size());
+            }
+        }
+
+        static void add_bytes(const void* data, size_t size) {
+            if(!current_) {
+                return;
+            }
+            auto p = static_cast<const uint8_t*>(data);
+            uint64_t h = *current_;
+            for(; size >= 8; p += 8, size -= 8) {
+                uint64_t x;
+                std::memcpy(&x, p, 8);
+                h = mix(h, x);
+            }
+            if(size > 0) {
+                uint64_t x = 0;
+                std::memcpy(&x, p, size);
+                h = mix(h, x ^ (uint64_t(size) << 56));
+            }
+            *current_ = h;
+        }
+
+        //
+        // a delivered packet.  PacketType can take part by providing
+        //   uint64_t digest_value(const PacketType&)
+        // found by adl; otherwise only the delivery itself is counted.
+        template <typename PacketType>
+        static void add_packet(const PacketType& pkt) {
+            if(current_) {
+                add(packet_value(pkt, 0));
+            }
+        }
+
+        //
+        // per-step digests of one run.  with slots kept, every component's
+        // slot is stored as well (engine slot last), which is what lets a
+        // divergence be pinned to a component.
+        //
+        struct trace {
+            int64_t first_step {1};
+            std::vector<uint64_t> steps;
+            std::vector<std::vector<uint64_t>> slots;
+
+            //
+            // text form, one step per line: step, digest, then the slots.
+            void write(std::ostream& os) const {
+                os << std::hex;
+                for(size_t i = 0; i < steps.size(); i++) {
+                    os << std::dec << first_step + int64_t(i) << std::hex << ' ' << steps[i];
+                    if(i < slots.size()) {
+                        for(auto s : slots[i]) {
+                            os << ' ' << s;
+                        }
+                    }
+                    os << '\n';
+                }
+                os << std::dec;
+            }
+
+            static trace read(std::istream& is) {
+                trace t;
+                int64_t step;
+                bool first = true;
+                while(is >> std::dec >> step) {
+                    if(first) {
+                        t.first_step = step;
+                        first = false;
+                    }
+                    uint64_t v;
+                    is >> std::hex >> v;
+                    t.steps.push_back(v);
+                    std::vector<uint64_t> s;
+                    while(is.peek() == ' ' && is >> std::hex >> v) {
+                        s.push_back(v);
+                    }
+                    if(!s.empty()) {
+                        t.slots.push_back(std::move(s));
+                    }
+                }
+                return t;
+            }
+        };
+
+        //
+        // first step at which two traces differ, and the first slot that
+        // differs there when both kept slots.  step is -1 if the common
+        // prefix matches; slot is -1 if it could not be determined.
+        struct divergence {
+            int64_t step {-1};
+            int64_t slot {-1};
+            explicit operator bool() const { return step >= 0; }
+        };
+
+        static divergence compare(const trace& a, const trace& b) {
+            divergence d;
+            if(a.first_step != b.first_step) {
+                d.step = std::min(a.first_step, b.first_step);
+                return d;
+            }
+            const size_t n = std::min(a.steps.size(), b.steps.size());
+            for(size_t i = 0; i < n; i++) {
+                if(a.steps[i] == b.steps[i]) {
+                    continue;
+                }
+                d.step = a.first_step + int64_t(i);
+                if(i < a.slots.size() && i < b.slots.size()) {
+                    auto& sa = a.slots[i];
+                    auto& sb = b.slots[i];
+                    const size_t m = std::min(sa.size(), sb.size());
+                    for(size_t j = 0; j < m; j++) {
+                        if(sa[j] != sb[j]) {
+                            d.slot = int64_t(j);
+                            break;
+                        }
+                    }
+                    if(d.slot < 0 && sa.size() != sb.size()) {
+                        d.slot = int64_t(m);
+                    }
+                }
+                break;
+            }
+            return d;
+        }
+
+        //
+        // plumbing for the engine and registry.  bind() selects the slot
+        // array for this thread (nullptr turns digesting off), enter() the
+        // slot of the component about to be stepped.
+        static void bind(uint64_t* slots) {
+            slots_ = slots;
+            current_ = nullptr;
+        }
+        static void enter(size_t slot) {
+            current_ = slots_ ? slots_ + slot : nullptr;
+        }
+        static uint64_t* bound() { return slots_; }
+
+    private:
+        template <typename PacketType>
+        static auto packet_value(const PacketType& pkt, int) -> decltype(uint64_t(digest_value(pkt))) {
+            return digest_value(pkt);
+        }
+        template <typename PacketType>
+        static uint64_t packet_value(const PacketType&, long) {
+            return 1;
+        }
+
+        static inline thread_local uint64_t* slots_ {nullptr};
+        static inline thread_local uint64_t* current_ {nullptr};
+    };
+}
+
+#endif /* SIM_DIGEST_HH */
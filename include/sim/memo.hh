@@ -0,0 +1,79 @@
+#ifndef SIM_MEMO_HH
+#define SIM_MEMO_HH
+
+#include <atomic>
+#include <cstdint>
+
+namespace sim {
+
+    //
+    // memo, a lazily computed value cached next to the data it is derived
+    // from.  the owner calls invalidate() from every mutator and get(fn)
+    // from its accessor:
+    //
+    //   sha256_t hash() const { return sha_.get([this] { return compute(); }); }
+    //   void set_x(int x) { x_ = x; sha_.invalidate(); }
+    //
+    // get() may race with other get()s, which is the common case of one
+    // shared block or tx hashed by many nodes at once: every caller that
+    // misses computes the value, one of them publishes it and the rest just
+    // return theirs.  mutators follow the usual rule and must not race with
+    // anything.
+    //
+    template <typename T>
+    struct memo {
+        memo() {};
+        memo(const T& value) : value_(value), state_(ready) {};
+        memo(const memo& other) {
+            *this = other;
+        }
+        memo& operator=(const memo& other) {
+            if(other.state_.load(std::memory_order_acquire) == ready) {
+                value_ = other.value_;
+                state_.store(ready, std::memory_order_release);
+            } else {
+                state_.store(dirty, std::memory_order_relaxed);
+            }
+            return *this;
+        }
+
+        template <typename F>
+        T get(F&& compute) const {
+            if(state_.load(std::memory_order_acquire) == ready) {
+                return value_;
+            }
+            T value = compute();
+            uint8_t expected = dirty;
+            if(state_.compare_exchange_strong(expected, busy, std::memory_order_acquire)) {
+                value_ = value;
+                state_.store(ready, std::memory_order_release);
+            }
+            return value;
+        }
+
+        void set(const T& value) {
+            value_ = value;
+            state_.store(ready, std::memory_order_release);
+        }
+
+        void invalidate() {
+            state_.store(dirty, std::memory_order_relaxed);
+        }
+
+        bool valid() const {
+            return state_.load(std::memory_order_acquire) == ready;
+        }
+
+    private:
+        enum : uint8_t {
+            dirty,
+            busy,
+            ready
+        };
+
+        mutable T value_ {};
+        mutable std::atomic<uint8_t> state_ {dirty};
+    };
+}
+
+#endif /* SIM_MEMO_HH */
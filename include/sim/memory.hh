@@ -0,0 +1,172 @@
+#ifndef SIM_MEMORY_HH
+#define SIM_MEMORY_HH
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "sim/alloc.hh"
+
+namespace sim {
+
+    //
+    // memory, allocation accounting by subsystem.  containers and objects
+    // allocated through tagged_allocator (or make_tagged) count their bytes
+    // against a tag in the calling thread's shard; a shard is only written
+    // by its thread, so counting costs a thread-local add.  frees on
+    // another thread are fine, live bytes are the sum over all shards.
+    //
+    // memory::meter samples the totals once per step, which is what
+    // engine::enable_memory_report (or SIM_MEMORY=1) does.
+    //
+    // counting is off until enable() is called (the meter does this), and
+    // then costs nothing but a relaxed load per allocation.  it stays on
+    // for the rest of the process.  frees of what was allocated before are
+    // subtracted all the same, so live bytes are only exact when counting
+    // starts before the sim is set up, as the engine's SIM_MEMORY does.
+    //
+    struct memory {
+        enum tag {
+            link,   // queued packets
+            node,   // per-node protocol state, behavior frames
+            chain,  // blocks and block headers
+            tx,     // transactions and mempools
+            log,    // ui and log buffers
+            tag_count
+        };
+
+        static const char* name(tag t);
+
+        static void enable() { enabled_.store(true, std::memory_order_relaxed); }
+        static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+        static void add(tag t, size_t bytes) {
+            if(!enabled()) {
+                return;
+            }
+            auto& s = local();
+            bump(s.live[t], int64_t(bytes));
+            bump(s.allocated[t], uint64_t(bytes));
+            bump(s.allocs[t], uint64_t(1));
+        }
+
+        static void sub(tag t, size_t bytes) {
+            if(!enabled()) {
+                return;
+            }
+            bump(local().live[t], -int64_t(bytes));
+        }
+
+        struct totals {
+            int64_t live {0};
+            uint64_t allocated {0};
+            uint64_t allocs {0};
+        };
+
+        //
+        // process-wide totals for t, summed over all threads.
+        static totals total(tag t);
+
+        struct usage {
+            int64_t live {0};        // bytes
+            int64_t peak {0};        // highest live bytes at a step end
+            uint64_t allocated {0};  // bytes since the meter started
+            uint64_t allocs {0};
+            uint64_t last_step {0};  // bytes allocated during the last step
+        };
+
+        //
+        // per-step view of the totals, from the meter's creation on.
+        struct meter {
+            meter();
+
+            void sample();
+
+            const usage& operator[](tag t) const { return usage_[t]; }
+            uint64_t steps() const { return steps_; }
+
+            //
+            // live, peak, allocation per step averaged over the run, and
+            // the bytes allocated in the last step, by tag.
+            void report(std::ostream& os) const;
+
+        private:
+            std::array<totals, tag_count> base_;
+            std::array<usage, tag_count> usage_;
+            uint64_t steps_ {0};
+        };
+
+    private:
+        struct shard {
+            std::atomic<int64_t> live[tag_count] {};
+            std::atomic<uint64_t> allocated[tag_count] {};
+            std::atomic<uint64_t> allocs[tag_count] {};
+        };
+
+        template <typename T>
+        static void bump(std::atomic<T>& v, T n) {
+            // single writer; readers only need a consistent word.
+            v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        static shard& local() {
+            thread_local shard* s = attach();
+            return *s;
+        }
+
+        static shard* attach();
+        static std::vector<std::unique_ptr<shard>>& shards();
+
+        static inline std::atomic<bool> enabled_ {false};
+    };
+
+    //
+    // slab_allocator that counts against a memory tag.
+    //
+    template <typename T, memory::tag Tag>
+    struct tagged_allocator {
+        using value_type = T;
+
+        template <typename U>
+        struct rebind {
+            using other = tagged_allocator<U, Tag>;
+        };
+
+        tagged_allocator() noexcept {};
+        template <typename U>
+        tagged_allocator(const tagged_allocator<U, Tag>&) noexcept {}
+
+        T* allocate(size_t n) {
+            memory::add(Tag, n * sizeof(T));
+            return slab_allocator<T>().allocate(n);
+        }
+
+        void deallocate(T* p, size_t n) {
+            memory::sub(Tag, n * sizeof(T));
+            slab_allocator<T>().deallocate(p, n);
+        }
+
+        template <typename U>
+        bool operator==(const tagged_allocator<U, Tag>&) const { return true; }
+        template <typename U>
+        bool operator!=(const tagged_allocator<U, Tag>&) const { return false; }
+    };
+
+    template <memory::tag Tag>
+    using tagged_string = std::basic_string<char, std::char_traits<char>, tagged_allocator<char, Tag>>;
+
+    //
+    // make_pooled counterpart that counts the object against Tag.
+    //
+    template <typename T, memory::tag Tag, typename... Args>
+    std::shared_ptr<T> make_tagged(Args&&... args) {
+        return std::allocate_shared<T>(tagged_allocator<T, Tag>(), std::forward<Args>(args)...);
+    }
+}
+
+#endif /* SIM_MEMORY_HH */
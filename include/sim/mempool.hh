@@ -0,0 +1,158 @@
+#ifndef SIM_MEMPOOL_HH
+#define SIM_MEMPOOL_HH
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "sim/memory.hh"
+#include "sim/sha.hh"
+
+namespace sim {
+
+    //
+    // mempool, pending txs kept ordered by hash as they arrive.
+    //
+    // insert, erase and lookup are O(log n); a block template of the first K
+    // txs (and their merkle root) is produced in O(K) without sorting.  with
+    // a capacity set, inserting into a full pool evicts according to the
+    // policy:
+    //
+    //   evict_last    drop whichever tx would be picked last (highest hash),
+    //                 which may be the incoming one
+    //   evict_oldest  drop the longest-waiting tx
+    //   reject_new    keep the pool as is and refuse the incoming tx
+    //
+    // Tx needs a hash() returning sha256_t.  not synchronised; call from
+    // under the owner's lock.
+    //
+    template <typename Tx>
+    struct mempool {
+        using tx_ptr = std::shared_ptr<Tx>;
+
+        enum class eviction {
+            evict_last,
+            evict_oldest,
+            reject_new
+        };
+
+        struct block_template {
+            std::vector<tx_ptr> txs;
+            sha256_t merkle;
+        };
+
+        mempool(size_t capacity = 0, eviction policy = eviction::evict_last)
+        : capacity_(capacity)
+        , policy_(policy) {};
+
+        //
+        // returns false if the tx was already pooled or was not admitted.
+        bool insert(tx_ptr t) {
+            const auto sha = t->hash();
+            if(by_hash_.find(sha) != by_hash_.end()) {
+                return false;
+            }
+            if(capacity_ > 0 && by_hash_.size() >= capacity_) {
+                switch(policy_) {
+                    case eviction::reject_new:
+                        evicted_++;
+                        return false;
+                    case eviction::evict_last: {
+                        auto last = std::prev(by_hash_.end());
+                        if(sha > last->first) {
+                            evicted_++;
+                            return false;
+                        }
+                        erase(last);
+                        break;
+                    }
+                    case eviction::evict_oldest:
+                        erase(by_hash_.find(by_age_.begin()->second));
+                        break;
+                }
+                evicted_++;
+            }
+            const uint64_t seq = next_seq_++;
+            by_hash_.emplace(sha, entry { std::move(t), seq });
+            by_age_.emplace(seq, sha);
+            return true;
+        }
+
+        bool contains(const sha256_t& sha) const {
+            return by_hash_.find(sha) != by_hash_.end();
+        }
+
+        bool erase(const sha256_t& sha) {
+            auto it = by_hash_.find(sha);
+            if(it == by_hash_.end()) {
+                return false;
+            }
+            erase(it);
+            return true;
+        }
+
+        //
+        // the first k txs in hash order and their merkle root.
+        block_template peek(size_t k) const {
+            block_template b;
+            b.txs.reserve(std::min(k, by_hash_.size()));
+            std::vector<sha256_t> hashes;
+            hashes.reserve(b.txs.capacity());
+            for(auto it = by_hash_.begin(); it != by_hash_.end() && b.txs.size() < k; ++it) {
+                b.txs.push_back(it->second.txn);
+                hashes.push_back(it->first);
+            }
+            b.merkle = merkle256(hashes);
+            return b;
+        }
+
+        //
+        // as peek, removing the returned txs from the pool.
+        block_template take(size_t k) {
+            auto b = peek(k);
+            for(size_t i = 0; i < b.txs.size(); i++) {
+                erase(by_hash_.begin());
+            }
+            return b;
+        }
+
+        template <typename F>
+        void for_each(F&& fn) const {
+            for(auto& it : by_hash_) {
+                fn(it.second.txn);
+            }
+        }
+
+        size_t size() const { return by_hash_.size(); }
+        bool empty() const { return by_hash_.empty(); }
+        size_t capacity() const { return capacity_; }
+        uint64_t evicted() const { return evicted_; }
+
+    private:
+        struct entry {
+            tx_ptr txn;
+            uint64_t seq;
+        };
+
+        using hash_index = std::map<sha256_t, entry, std::less<sha256_t>, tagged_allocator<std::pair<const sha256_t, entry>, memory::tx>>;
+        using age_index = std::map<uint64_t, sha256_t, std::less<uint64_t>, tagged_allocator<std::pair<const uint64_t, sha256_t>, memory::tx>>;
+
+        void erase(typename hash_index::iterator it) {
+            by_age_.erase(it->second.seq);
+            by_hash_.erase(it);
+        }
+
+        hash_index by_hash_;
+        age_index by_age_;
+        const size_t capacity_;
+        const eviction policy_;
+        uint64_t next_seq_ {0};
+        uint64_t evicted_ {0};
+    };
+}
+
+#endif /* SIM_MEMPOOL_HH */
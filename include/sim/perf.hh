@@ -0,0 +1,134 @@
+#ifndef SIM_PERF_HH
+#define SIM_PERF_HH
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+    //
+    // profiler, hardware counters (perf_event_open) around component
+    // stepping, aggregated per frame.  a frame is a ';'-separated path:
+    // the engine opens "step;<component type>" around each chunk of a
+    // group and "hooks" around the step-begin hooks, and code being
+    // stepped can open nested phases with profiler::scope:
+    //
+    //   sim::profiler::scope p("deliver");
+    //
+    // counters are per thread and opened on first use.  any that cannot
+    // be opened (no pmu in a vm, perf_event_paranoid, seccomp) are left
+    // out of the report; wall time is always measured.  when profiling is
+    // off, a scope is a thread-local load and a branch.
+    //
+    class profiler {
+    public:
+        enum counter {
+            cycles,
+            instructions,
+            llc_misses,
+            branch_misses,
+            wall_ns,
+            counter_count
+        };
+
+        struct sample {
+            uint64_t v[counter_count] {};
+        };
+
+        struct totals {
+            uint64_t calls {0};
+            uint64_t v[counter_count] {};
+        };
+
+        profiler();
+        ~profiler();
+
+        profiler(const profiler&) = delete;
+        profiler& operator=(const profiler&) = delete;
+
+        //
+        // make p the profiler that scopes on this thread report to;
+        // nullptr turns them off.
+        static void bind(profiler* p);
+
+        struct scope {
+            explicit scope(const char* phase);
+            explicit scope(const std::string& phase) : scope(phase.c_str()) {}
+            ~scope();
+
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+        private:
+            profiler* owner_ {nullptr};
+            size_t depth_ {0};
+            sample start_;
+        };
+
+        //
+        // continue the calling thread's frame path on another thread, for
+        // work fanned out from inside a scope:
+        //
+        //   auto path = sim::profiler::path();
+        //   ... on a worker: sim::profiler::inherit in(path);
+        //
+        static std::string path();
+
+        struct inherit {
+            explicit inherit(const std::string& path);
+            ~inherit();
+
+            inherit(const inherit&) = delete;
+            inherit& operator=(const inherit&) = delete;
+        private:
+            std::string saved_;
+        };
+
+        //
+        // inclusive totals per frame, merged over all threads.
+        std::map<std::string, totals> frames() const;
+
+        //
+        // table of inclusive counts per frame followed by folded stacks
+        // ("frame;child self-count" lines, cycles when available and wall
+        // ns otherwise) that flamegraph.pl and speedscope read directly.
+        void report(std::ostream& os) const;
+
+        bool available(counter c) const;
+        const std::string& unavailable_reason() const { return reason_; }
+
+        //
+        // readable name for a type, for frame names: demangled and put
+        // through frame_name.
+        static std::string type_name(const char* mangled);
+
+        //
+        // a demangled name fit for a frame: no spaces or ';', which the
+        // folded stacks use as separators, and template arguments past the
+        // first level elided.
+        static std::string frame_name(const std::string& name);
+
+        //
+        // a frame path as written in the folded stacks.
+        static std::string folded_frame(const std::string& path);
+
+    private:
+        struct shard;
+        struct thread_state;
+
+        static thread_state& tls();
+        shard& local();
+
+        mutable std::mutex mut_;
+        std::vector<std::unique_ptr<shard>> shards_;
+        bool available_[counter_count] {};
+        std::string reason_;
+        uint64_t generation_;
+    };
+}
+
+#endif /* SIM_PERF_HH */
@@ -0,0 +1,55 @@
+#ifndef SIM_RNG_HH
+#define SIM_RNG_HH
+
+#include <cstdint>
+#include <limits>
+
+namespace sim {
+
+    //
+    // rng, a splitmix64 stream: eight bytes of state, so every component and
+    // behavior can have its own.  satisfies UniformRandomBitGenerator, so it
+    // works with the std distributions.
+    //
+    // engine::rand_int and rand_real draw from the stream bound to the
+    // calling thread, which the engine binds to the component (or
+    // co_scheduler to the node) being run.  draws then depend only on the
+    // seed and on what that component did, not on which thread ran it or
+    // what ran before it.
+    //
+    struct rng {
+        using result_type = uint64_t;
+
+        explicit rng(uint64_t seed = 0) : state_(seed) {};
+
+        //
+        // the stream for (seed, stream), e.g. (engine seed, component id).
+        rng(uint64_t seed, uint64_t stream) : state_(mix(seed ^ mix(stream + 0x9e3779b97f4a7c15ull))) {};
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+        result_type operator()() {
+            return mix(state_ += 0x9e3779b97f4a7c15ull);
+        }
+
+        //
+        // the stream draws on this thread come from; nullptr outside
+        // components and behaviors.
+        static rng* current() { return current_; }
+        static void bind(rng* r) { current_ = r; }
+
+    private:
+        static uint64_t mix(uint64_t z) {
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+
+        uint64_t state_;
+
+        static inline thread_local rng* current_ {nullptr};
+    };
+}
+
+#endif /* SIM_RNG_HH */
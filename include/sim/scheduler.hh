@@ -0,0 +1,298 @@
+#ifndef SIM_SCHEDULER_HH
+#define SIM_SCHEDULER_HH
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+extern "C" {
+    #include <pthread.h>
+    #include <sched.h>
+}
+#endif
+
+namespace sim {
+
+    //
+    // work-stealing batch scheduler.
+    //
+    // a batch is a list of tasks, each covering a contiguous [begin, end) range
+    // of items.  the batch is dealt to per-thread deques in contiguous runs;
+    // a thread pops from the front of its own deque and, once empty, steals
+    // from the back of the others.  the calling thread takes part as worker 0
+    // and run() returns once every task has completed (a single counter
+    // barrier).  task and thread state is reused from batch to batch, so
+    // a steady-state run() performs no allocation.
+    //
+    // a batch can also come with its own split, one range of tasks per
+    // thread, for callers that keep related work on the same thread from
+    // batch to batch; pin() then keeps each thread on one cpu.
+    //
+    struct scheduler {
+        using task_f = void(*)(void* ctx, size_t begin, size_t end);
+
+        struct task {
+            task_f fn;
+            void* ctx;
+            size_t begin;
+            size_t end;
+        };
+
+        //
+        // items per task used by parallel_for when no grain is given: 64
+        // pointers' worth of components keeps a task within a few cache lines.
+        static constexpr size_t default_grain = 64;
+
+        explicit scheduler(size_t threads = std::thread::hardware_concurrency())
+        : deques_(std::max<size_t>(threads, 1)) {
+            for(size_t i = 1; i < deques_.size(); i++) {
+                workers_.emplace_back([this, i] { worker(i); });
+            }
+        }
+
+        ~scheduler() {
+            {
+                std::unique_lock<std::mutex> lk(mut_);
+                stop_ = true;
+                gen_++;
+            }
+            wake_cv_.notify_all();
+            for(auto& it : workers_) {
+                it.join();
+            }
+        }
+
+        scheduler(const scheduler&) = delete;
+        scheduler& operator=(const scheduler&) = delete;
+
+        size_t threads() const { return deques_.size(); }
+
+        //
+        // pin thread i to the i-th cpu this process may run on (wrapping
+        // around), the calling thread counting as thread 0 from its next
+        // run().  returns false where affinity can't be set.
+        bool pin() {
+#ifdef __linux__
+            cpu_set_t allowed;
+            CPU_ZERO(&allowed);
+            if(::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+                return false;
+            }
+            cpus_.clear();
+            for(int c = 0; c < CPU_SETSIZE; c++) {
+                if(CPU_ISSET(c, &allowed)) {
+                    cpus_.push_back(c);
+                }
+            }
+            if(cpus_.empty()) {
+                return false;
+            }
+            bool ok = true;
+            for(size_t i = 1; i < deques_.size(); i++) {
+                ok = pin_to(workers_[i - 1].native_handle(), cpus_[i % cpus_.size()]) && ok;
+            }
+            pinned_caller_ = std::thread::id();
+            return ok;
+#else
+            return false;
+#endif
+        }
+
+        //
+        // run every task once and wait for all of them.  with splits
+        // (threads() + 1 task indices), thread i starts on tasks
+        // [splits[i], splits[i + 1]) instead of an even share.
+        void run(const std::vector<task>& tasks, const std::vector<size_t>* splits = nullptr) {
+#ifdef __linux__
+            if(!cpus_.empty() && pinned_caller_ != std::this_thread::get_id()) {
+                pin_to(::pthread_self(), cpus_[0]);
+                pinned_caller_ = std::this_thread::get_id();
+            }
+#endif
+            if(tasks.empty()) {
+                return;
+            }
+            if(deques_.size() == 1 || tasks.size() == 1) {
+                for(auto& it : tasks) {
+                    it.fn(it.ctx, it.begin, it.end);
+                }
+                return;
+            }
+            tasks_.store(tasks.data(), std::memory_order_relaxed);
+            pending_.store(tasks.size(), std::memory_order_relaxed);
+            const size_t n = deques_.size();
+            for(size_t i = 0; i < n; i++) {
+                const uint64_t head = splits ? (*splits)[i] : tasks.size() * i / n;
+                const uint64_t tail = splits ? (*splits)[i + 1] : tasks.size() * (i + 1) / n;
+                deques_[i].range.store(pack(head, tail), std::memory_order_release);
+            }
+            {
+                std::unique_lock<std::mutex> lk(mut_);
+                gen_++;
+            }
+            wake_cv_.notify_all();
+
+            drain(0);
+
+            for(int spin = 0; pending_.load(std::memory_order_acquire) > 0; spin++) {
+                if(spin < spin_limit) {
+                    std::this_thread::yield();
+                } else {
+                    std::unique_lock<std::mutex> lk(mut_);
+                    done_cv_.wait(lk, [this] { return pending_.load(std::memory_order_acquire) == 0; });
+                }
+            }
+        }
+
+        //
+        // call fn(i) for every i in [0, n), grain items per task.  with
+        // splits (threads() + 1 item indices), thread i starts on items
+        // [splits[i], splits[i + 1]).
+        template <typename F>
+        void parallel_for(size_t n, F& fn, size_t grain = 0, const std::vector<size_t>* splits = nullptr) {
+            if(grain == 0) {
+                // keep a few tasks per thread so there is something to steal.
+                grain = std::min(default_grain, std::max<size_t>(1, n / (deques_.size() * 4)));
+            }
+            auto chunk = [](void* ctx, size_t begin, size_t end) {
+                auto& f = *static_cast<F*>(ctx);
+                for(size_t i = begin; i < end; i++) {
+                    f(i);
+                }
+            };
+            batch_.clear();
+            if(!splits) {
+                for(size_t i = 0; i < n; i += grain) {
+                    batch_.push_back({ chunk, &fn, i, std::min(n, i + grain) });
+                }
+                run(batch_);
+                return;
+            }
+            batch_splits_.clear();
+            for(size_t t = 0; t < deques_.size(); t++) {
+                batch_splits_.push_back(batch_.size());
+                const size_t end = (*splits)[t + 1];
+                for(size_t i = (*splits)[t]; i < end; i += grain) {
+                    batch_.push_back({ chunk, &fn, i, std::min(end, i + grain) });
+                }
+            }
+            batch_splits_.push_back(batch_.size());
+            run(batch_, &batch_splits_);
+        }
+
+    private:
+        static constexpr int spin_limit = 64;
+
+#ifdef __linux__
+        static bool pin_to(pthread_t thread, int cpu) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            return ::pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+        }
+#endif
+
+        //
+        // a deque is a [head, tail) window into the batch packed into one
+        // word; the owner advances head, thieves retreat tail, both by CAS.
+        struct alignas(64) deque {
+            std::atomic<uint64_t> range {0};
+        };
+
+        static uint64_t pack(uint64_t head, uint64_t tail) { return head | (tail << 32); }
+        static uint64_t head(uint64_t r) { return r & 0xffffffff; }
+        static uint64_t tail(uint64_t r) { return r >> 32; }
+
+        bool pop(size_t self, size_t& index) {
+            auto& d = deques_[self].range;
+            auto r = d.load(std::memory_order_acquire);
+            while(head(r) < tail(r)) {
+                if(d.compare_exchange_weak(r, pack(head(r) + 1, tail(r)), std::memory_order_acq_rel)) {
+                    index = head(r);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool steal(size_t self, size_t& index) {
+            const size_t n = deques_.size();
+            for(size_t i = 1; i < n; i++) {
+                auto& d = deques_[(self + i) % n].range;
+                auto r = d.load(std::memory_order_acquire);
+                while(head(r) < tail(r)) {
+                    if(d.compare_exchange_weak(r, pack(head(r), tail(r) - 1), std::memory_order_acq_rel)) {
+                        index = tail(r) - 1;
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        void drain(size_t self) {
+            size_t index = 0;
+            while(pop(self, index) || steal(self, index)) {
+                // the batch pointer is read after winning the slot, so it is
+                // always the batch that slot was dealt from.
+                auto& t = tasks_.load(std::memory_order_acquire)[index];
+                t.fn(t.ctx, t.begin, t.end);
+                if(pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::unique_lock<std::mutex> lk(mut_);
+                    done_cv_.notify_all();
+                }
+            }
+        }
+
+        void worker(size_t self) {
+            uint64_t seen = 0;
+            while(true) {
+                {
+                    std::unique_lock<std::mutex> lk(mut_);
+                    wake_cv_.wait(lk, [this, seen] { return gen_ != seen; });
+                    seen = gen_;
+                    if(stop_) {
+                        return;
+                    }
+                }
+                drain(self);
+            }
+        }
+
+        std::vector<deque> deques_;
+        std::vector<std::thread> workers_;
+        std::vector<task> batch_;
+        std::vector<size_t> batch_splits_;
+        std::vector<int> cpus_;
+        std::thread::id pinned_caller_;
+        std::atomic<const task*> tasks_ {nullptr};
+        std::atomic<size_t> pending_ {0};
+        std::mutex mut_;
+        std::condition_variable wake_cv_;
+        std::condition_variable done_cv_;
+        uint64_t gen_ {0};
+        bool stop_ {false};
+    };
+
+    //
+    // serial, an executor that runs parallel_for on the calling thread;
+    // the default for code that takes an engine or a scheduler to spread
+    // its work over.
+    //
+    struct serial {
+        template <typename F>
+        void parallel_for(size_t n, F&& fn) {
+            for(size_t i = 0; i < n; i++) {
+                fn(i);
+            }
+        }
+    };
+}
+
+#endif /* SIM_SCHEDULER_HH */
@@ -2,10 +2,15 @@
 #define SIM_SHA_HH
 #include <cryptopp/sha.h>
 #include <cstdint>
+#include <cstring>
+#include <cmath>
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <algorithm>
 #include <array>
+#include <mutex>
+#include <vector>
 
 namespace sim {
 
@@ -33,6 +38,17 @@ namespace sim {
         return bytes_to_str(sha.data(), sha.size()).substr(0,6);
     }
     
+    //
+    // hasher for unordered containers keyed by sha256_t, digests are already
+    // uniformly distributed so the leading bytes are used as-is.
+    struct sha256_hash {
+        size_t operator()(const sha256_t& sha) const {
+            size_t h;
+            std::memcpy(&h, sha.data(), sizeof(h));
+            return h;
+        }
+    };
+    
     inline sha256_t merkle256(const std::vector<sha256_t>& shas) {
         
         if(shas.size() > 0) {
@@ -56,6 +72,114 @@ namespace sim {
         }
         
     };
+    
+    //
+    // merkle_tree, incremental merkle256: the same root for the same
+    // leaves, but every level is kept, so changing or appending a leaf only
+    // rehashes the path from it to the root.  paths are marked on mutation
+    // and rehashed on the next root().
+    //
+    // root() may be called concurrently; mutators must not race with it.
+    //
+    struct merkle_tree {
+        merkle_tree() {};
+        merkle_tree(const merkle_tree& other) {
+            *this = other;
+        }
+        merkle_tree& operator=(const merkle_tree& other) {
+            if(this != &other) {
+                std::lock_guard<std::mutex> lk(other.mut_);
+                levels_ = other.levels_;
+                dirty_ = other.dirty_;
+            }
+            return *this;
+        }
+        
+        size_t size() const { return levels_.empty() ? 0 : levels_[0].size(); }
+        
+        void assign(std::vector<sha256_t> leaves) {
+            levels_.clear();
+            dirty_.clear();
+            const size_t n = leaves.size();
+            levels_.emplace_back(std::move(leaves));
+            for(size_t i = 0; i < n; i++) {
+                dirty_.push_back(i);
+            }
+        }
+        
+        void push_back(const sha256_t& leaf) {
+            if(levels_.empty()) {
+                levels_.emplace_back();
+            }
+            levels_[0].push_back(leaf);
+            dirty_.push_back(levels_[0].size() - 1);
+        }
+        
+        void set(size_t i, const sha256_t& leaf) {
+            levels_[0][i] = leaf;
+            dirty_.push_back(i);
+        }
+        
+        sha256_t root() const {
+            std::lock_guard<std::mutex> lk(mut_);
+            const size_t n = size();
+            if(n == 0) {
+                return {};
+            }
+            if(!dirty_.empty()) {
+                rehash();
+            }
+            return levels_.back()[0];
+        }
+        
+    private:
+        //
+        // root of an all-zero subtree of the given height, which is what
+        // merkle256's padding amounts to.
+        static const sha256_t& zero(size_t height) {
+            static const std::vector<sha256_t> zeros = [] {
+                std::vector<sha256_t> z(1);
+                for(int i = 0; i < 64; i++) {
+                    sha256_t pair[2] { z.back(), z.back() };
+                    z.push_back(sha256(pair[0].data(), sizeof(pair)));
+                }
+                return z;
+            }();
+            return zeros[height];
+        }
+        
+        void rehash() const {
+            const size_t n = levels_[0].size();
+            size_t height = 0;
+            while((size_t(1) << height) < n) {
+                height++;
+            }
+            levels_.resize(height + 1);
+            std::sort(dirty_.begin(), dirty_.end());
+            dirty_.erase(std::unique(dirty_.begin(), dirty_.end()), dirty_.end());
+            for(size_t l = 1; l <= height; l++) {
+                auto& below = levels_[l - 1];
+                auto& level = levels_[l];
+                level.resize((n + (size_t(1) << l) - 1) >> l);
+                for(auto& i : dirty_) {
+                    i >>= 1;
+                }
+                dirty_.erase(std::unique(dirty_.begin(), dirty_.end()), dirty_.end());
+                for(auto i : dirty_) {
+                    sha256_t pair[2] {
+                        below[2 * i],
+                        2 * i + 1 < below.size() ? below[2 * i + 1] : zero(l - 1)
+                    };
+                    level[i] = sha256(pair[0].data(), sizeof(pair));
+                }
+            }
+            dirty_.clear();
+        }
+        
+        mutable std::mutex mut_;
+        mutable std::vector<std::vector<sha256_t>> levels_;
+        mutable std::vector<size_t> dirty_;
+    };
 
 }
 
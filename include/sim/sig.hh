@@ -0,0 +1,144 @@
+#ifndef SIM_SIG_HH
+#define SIM_SIG_HH
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "sim/sha.hh"
+#include "sim/span.hh"
+
+namespace sim {
+
+    using pubkey_t = std::array<uint8_t, 33>;     // compressed secp256k1 point
+    using signature_t = std::array<uint8_t, 64>;  // r || s
+
+    //
+    // keypair, an ecdsa key on secp256k1 (CryptoPP) derived from 32 bytes
+    // of seed, so keys drawn from the engine's rng repeat with the seed.
+    // signing is deterministic as well: the nonce comes from the key and
+    // the digest, so the same tx always gets the same signature and hash.
+    // a keypair signs on one thread at a time; verify() is thread-safe.
+    //
+    class keypair {
+    public:
+        explicit keypair(const sha256_t& seed);
+        ~keypair();
+
+        keypair(const keypair&) = delete;
+        keypair& operator=(const keypair&) = delete;
+
+        const pubkey_t& public_key() const { return pub_; }
+
+        signature_t sign(const sha256_t& digest) const;
+
+    private:
+        struct impl;
+        std::unique_ptr<impl> impl_;
+        pubkey_t pub_ {};
+    };
+
+    //
+    // check sig over digest against key, uncached.  false for keys that
+    // don't decode to a curve point.
+    bool verify(const pubkey_t& key, const sha256_t& digest, const signature_t& sig);
+
+    //
+    // verifier, signature checks with a cache keyed by the digest of
+    // (key, digest, sig), shared by every node that holds it: a tx
+    // gossiped to n nodes is verified once and found n - 1 times.
+    //
+    // batches are deduplicated, looked up, and the misses verified in
+    // parallel on exec (an engine or a sim::scheduler, anything with
+    // parallel_for(n, fn)).  the cache is sharded and thread-safe, and
+    // keeps the most recent capacity results.
+    //
+    class verifier {
+    public:
+        struct request {
+            pubkey_t key;
+            sha256_t digest;
+            signature_t sig;
+        };
+
+        struct stats {
+            uint64_t requests {0};
+            uint64_t hits {0};      // from the cache or earlier in the batch
+            uint64_t verified {0};
+            uint64_t failed {0};
+        };
+
+        explicit verifier(size_t capacity = 1 << 16);
+
+        verifier(const verifier&) = delete;
+        verifier& operator=(const verifier&) = delete;
+
+        bool check(const request& r);
+
+        //
+        // ok[i] = whether batch[i] verified.
+        template <typename Exec>
+        void check(span<const request> batch, std::vector<uint8_t>& ok, Exec& exec) {
+            ok.assign(batch.size(), 0);
+            std::vector<sha256_t> keys(batch.size());
+            std::vector<size_t> misses;
+            std::unordered_map<sha256_t, size_t, sha256_hash> first;
+            std::vector<size_t> repeats;
+            for(size_t i = 0; i < batch.size(); i++) {
+                keys[i] = key_of(batch[i]);
+                bool v = false;
+                if(lookup(keys[i], v)) {
+                    ok[i] = v;
+                } else if(first.emplace(keys[i], i).second) {
+                    misses.push_back(i);
+                } else {
+                    repeats.push_back(i);
+                }
+            }
+            auto body = [&batch, &ok, &misses](size_t j) {
+                auto& r = batch[misses[j]];
+                ok[misses[j]] = sim::verify(r.key, r.digest, r.sig);
+            };
+            exec.parallel_for(misses.size(), body);
+            for(auto i : misses) {
+                store(keys[i], ok[i]);
+            }
+            for(auto i : repeats) {
+                ok[i] = ok[first[keys[i]]];
+            }
+            requests_ += batch.size();
+            hits_ += batch.size() - misses.size();
+        }
+
+        stats counters() const;
+
+    private:
+        struct shard {
+            std::mutex mut;
+            std::unordered_map<sha256_t, bool, sha256_hash> results;
+            std::deque<sha256_t> order;
+        };
+
+        static constexpr size_t shard_count = 16;
+
+        static sha256_t key_of(const request& r);
+        shard& shard_of(const sha256_t& key) { return shards_[key[sizeof(size_t)] % shard_count]; }
+        bool lookup(const sha256_t& key, bool& ok);
+        void store(const sha256_t& key, bool ok);
+
+        const size_t shard_capacity_;
+        std::array<shard, shard_count> shards_;
+        std::atomic<uint64_t> requests_ {0};
+        std::atomic<uint64_t> hits_ {0};
+        std::atomic<uint64_t> verified_ {0};
+        std::atomic<uint64_t> failed_ {0};
+    };
+}
+
+#endif /* SIM_SIG_HH */
@@ -2,89 +2,583 @@
 #ifndef SIM_HH
 #define SIM_HH
 #include <experimental/optional>
+#include <functional>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <unordered_map>
+#include <typeinfo>
 #include <iomanip>
 #include <sstream>
+#include <limits>
 #include <random>
-#include <future>
+#include <thread>
 #include <vector>
+#include <deque>
 #include <queue>
+#include <mutex>
 #include <map>
 #include <set>
 
-#include <unpause/async>
-
 #include "sim/sha.hh"
+#include "sim/alloc.hh"
+#include "sim/scheduler.hh"
+#include "sim/digest.hh"
+#include "sim/rng.hh"
+#include "sim/perf.hh"
+#include "sim/memory.hh"
+#include "sim/span.hh"
 
 namespace sim {
     namespace stx = std::experimental;
     
     
     struct engine;
+    struct registry;
+    
+    using component_id = uint32_t;
+    constexpr component_id invalid_component = std::numeric_limits<component_id>::max();
     
     //
     //  component interface
     //
     struct component {
+        component() {};
+        component(const component& other) : current_step_(other.current_step_) {};
+        component& operator=(const component& other) {
+            current_step_ = other.current_step_;
+            return *this;
+        };
+        
         virtual void step() = 0;
+        
+        //
+        // id assigned on registration, in registration order.
+        component_id id() const { return id_; }
     protected:
         friend struct engine;
+        friend struct registry;
         void set_current_step(int64_t current_step) {
             current_step_ = current_step;
         };
         
         int64_t current_step_ {0};
+    private:
+        component_id id_ {invalid_component};
+        rng rng_; // seeded on registration, see engine::rand_int
+    };
+    
+    
+    //
+    // registry, holds registered components grouped by concrete type.
+    // groups are kept in the order their first member was registered and
+    // members in registration order, so iteration order does not depend on
+    // where components happen to live in memory.
+    //
+    // a group registered through add<T> steps its members with a qualified,
+    // non-virtual T::step() call; add(component&) and components whose
+    // dynamic type is not T go to a group stepped through the vtable.
+    //
+    struct registry {
+        using step_f = void(*)(component* const* members, size_t begin, size_t end, int64_t current_step);
+        
+        struct group {
+            const std::type_info* type;
+            step_f step;
+            std::vector<component*> members;
+            int64_t current_step {0};
+            uint64_t* digest {nullptr};
+            profiler* prof {nullptr};
+            std::string frame; // profiler frame, "step;<type>"
+        };
+        
+        template <typename T>
+        component_id add(T& c) {
+            static_assert(std::is_base_of<component, T>(), "T must be a component");
+            if(typeid(c) != typeid(T)) {
+                return add(static_cast<component&>(c));
+            }
+            return add(c, typeid(T), &step_members<T>);
+        }
+        
+        component_id add(component& c) {
+            return add(c, typeid(component), &step_members_virtual);
+        }
+        
+        void remove(component& c) {
+            auto it = members_.find(&c);
+            if(it != members_.end()) {
+                auto& m = it->second->members;
+                m.erase(std::find(m.begin(), m.end(), &c));
+                members_.erase(it);
+                c.id_ = invalid_component;
+            }
+        }
+        
+        const std::vector<std::unique_ptr<group>>& groups() const { return groups_; }
+        size_t size() const { return members_.size(); }
+        
+        //
+        // one past the highest id handed out so far.
+        component_id id_bound() const { return next_id_; }
+        
+        //
+        // an id for something run outside the registry that still wants
+        // its own rng stream and digest slot, such as a node's behaviors.
+        component_id reserve() {
+            reserved_.push_back(next_id_);
+            return next_id_++;
+        }
+        
+        bool reserved(component_id id) const {
+            return std::binary_search(reserved_.begin(), reserved_.end(), id);
+        }
+        
+        const component* find(component_id id) const {
+            for(auto& it : members_) {
+                if(it.first->id_ == id) {
+                    return it.first;
+                }
+            }
+            return nullptr;
+        }
+        
+    private:
+        component_id add(component& c, const std::type_info& type, step_f step) {
+            if(members_.find(&c) != members_.end()) {
+                return c.id_;
+            }
+            auto it = std::find_if(groups_.begin(), groups_.end(), [&type](const std::unique_ptr<group>& g) {
+                return *g->type == type;
+            });
+            if(it == groups_.end()) {
+                groups_.emplace_back(new group { &type, step, {} });
+                groups_.back()->frame = "step;" + profiler::type_name(type.name());
+                it = groups_.end() - 1;
+            }
+            (*it)->members.push_back(&c);
+            members_.emplace(&c, it->get());
+            c.id_ = next_id_++;
+            return c.id_;
+        }
+        
+        template <typename T>
+        static void step_members(component* const* members, size_t begin, size_t end, int64_t current_step) {
+            for(size_t i = begin; i < end; i++) {
+                members[i]->set_current_step(current_step);
+                digest::enter(members[i]->id_);
+                rng::bind(&members[i]->rng_);
+                static_cast<T*>(members[i])->T::step();
+            }
+            rng::bind(nullptr);
+        }
+        
+        static void step_members_virtual(component* const* members, size_t begin, size_t end, int64_t current_step) {
+            for(size_t i = begin; i < end; i++) {
+                members[i]->set_current_step(current_step);
+                digest::enter(members[i]->id_);
+                rng::bind(&members[i]->rng_);
+                members[i]->step();
+            }
+            rng::bind(nullptr);
+        }
+        
+        std::vector<std::unique_ptr<group>> groups_;
+        std::unordered_map<component*, group*> members_;
+        std::vector<component_id> reserved_;
+        component_id next_id_ {0};
     };
     
     
     //
     // engine will call step on all registered components, increasing
-    // time by 1 step.
+    // time by 1 step.  components are stepped in parallel on the engine's
+    // scheduler and step() returns once all of them have finished.
     //
     struct engine {
 
-        engine(int64_t seed)
-        : gen_(seed) {};
+        //
+        // setting SIM_PROFILE in the environment turns on profiling,
+        // SIM_MEMORY the memory report and SIM_PIN pins the engine's
+        // threads (see pin_threads).
+        engine(int64_t seed, size_t threads = std::thread::hardware_concurrency())
+        : scheduler_(threads)
+        , seed_(uint64_t(seed))
+        , gen_(uint64_t(seed)) {
+            const char* p = std::getenv("SIM_PROFILE");
+            if(p && *p && *p != '0') {
+                enable_profiling();
+            }
+            const char* mem = std::getenv("SIM_MEMORY");
+            if(mem && *mem && *mem != '0') {
+                enable_memory_report();
+            }
+            const char* pin = std::getenv("SIM_PIN");
+            if(pin && *pin && *pin != '0') {
+                pin_threads();
+            }
+        };
+        
+        ~engine() {
+            if(profiler_) {
+                profiler_->report(std::cerr);
+            }
+            if(memory_) {
+                memory_->report(std::cerr);
+            }
+        }
         
-        void register_component(component& c) {
+        //
+        // register with the static type of c; members of the same concrete
+        // type are stepped together without virtual dispatch.
+        template <typename T>
+        component_id register_component(T& c) {
             c.set_current_step(current_step_);
-            components_.insert(&c);
-        };
+            dirty_ = true;
+            const bool fresh = c.id() == invalid_component;
+            auto id = components_.add(c);
+            if(fresh) {
+                c.rng_ = stream(id);
+            }
+            return id;
+        }
+        
+        //
+        // an id outside the registry (see registry::reserve), with its own
+        // rng stream from stream(id).
+        component_id reserve_id() {
+            return components_.reserve();
+        }
+        
+        //
+        // the rng stream of component (or reserved) id, seeded from the
+        // engine's seed and the id alone.
+        rng stream(component_id id) const {
+            return rng(seed_, id);
+        }
         
         void unregister_component(component& c) {
-            components_.erase(&c);
+            components_.remove(c);
+            dirty_ = true;
         };
         
+        //
+        // affinity hint: step c with the other components of partition
+        // part.  partition p is dealt to thread p % threads() each step and
+        // only leaves it when another thread runs dry and steals, so
+        // components that exchange packets (a node and its links) should
+        // share a partition; sim::topology::partition finds such parts.
+        // components without a hint are spread evenly in registration order.
+        void place(const component& c, uint32_t part) {
+            if(c.id() == invalid_component) {
+                return;
+            }
+            if(placement_.size() <= c.id()) {
+                placement_.resize(c.id() + 1, unplaced);
+            }
+            placement_[c.id()] = part;
+            dirty_ = true;
+        }
+        
+        //
+        // partition of c, or unplaced.
+        uint32_t placement(const component& c) const {
+            return c.id() < placement_.size() ? placement_[c.id()] : unplaced;
+        }
+        
+        static constexpr uint32_t unplaced = std::numeric_limits<uint32_t>::max();
+        
+        size_t threads() const { return scheduler_.threads(); }
+        
+        //
+        // keep each of the engine's threads on one cpu, so a partition's
+        // packet queues stay in one core's cache.  returns false where
+        // affinity can't be set.
+        bool pin_threads() { return scheduler_.pin(); }
+        
+        //
+        // fn(step) runs on the stepping thread at the start of every step,
+        // before any component, for whole-population passes.  frame names
+        // it in profiles.
+        void on_step_begin(std::function<void(int64_t)> fn, std::string frame = "hooks") {
+            step_hooks_.push_back({ std::move(frame), std::move(fn) });
+        }
+        
+        //
+        // as on_step_begin, but after every component has been stepped, so
+        // it sees what links delivered this step (see co_scheduler).
+        void on_step_end(std::function<void(int64_t)> fn, std::string frame = "hooks") {
+            end_hooks_.push_back({ std::move(frame), std::move(fn) });
+        }
+        
+        //
+        // fn(i) for i in [0, n) on the engine's threads, returning when all
+        // are done.  only from outside component stepping, e.g. from a step
+        // hook.  during a step with digests on, fn can digest::enter() a
+        // slot of its own (see registry::reserve); it digests nothing until
+        // it does.
+        //
+        // with splits (threads() + 1 indices), thread i starts on
+        // [splits[i], splits[i + 1]), as place() does for components.
+        template <typename F>
+        void parallel_for(size_t n, F&& fn, const std::vector<size_t>* splits = nullptr) {
+            auto prof = profiler_.get();
+            auto slots = digest::bound();
+            const std::string path = prof ? profiler::path() : std::string();
+            auto body = [&fn, prof, slots, &path](size_t i) {
+                digest::bind(slots);
+                profiler::bind(prof);
+                if(prof) {
+                    profiler::inherit in(path);
+                    fn(i);
+                } else {
+                    fn(i);
+                }
+            };
+            scheduler_.parallel_for(n, body, 0, splits);
+        }
+        
         void step() {
             current_step_++;
-            std::list<std::future<void>> futures;
-            for(auto& it : components_) {
-                auto p = std::make_shared<std::promise<void>>();
-                futures.emplace_back(p->get_future());
-                unpause::async::run(pool_, [this, it, p] {
-                    it->set_current_step(current_step_);
-                    it->step();
-                    p->set_value();
-                });
+            if(digest_on_) {
+                begin_digest();
+            }
+            profiler::bind(profiler_.get());
+            run_hooks(step_hooks_);
+            if(dirty_) {
+                build_tasks();
+                dirty_ = false;
+            }
+            for(auto& it : components_.groups()) {
+                it->current_step = current_step_;
+                it->digest = digest_on_ ? digest_slots_.data() : nullptr;
+                it->prof = profiler_.get();
+            }
+            scheduler_.run(tasks_, splits_.empty() ? nullptr : &splits_);
+            if(!end_hooks_.empty()) {
+                if(digest_on_) {
+                    // component stepping left this thread in some slot.
+                    digest::bind(digest_slots_.data());
+                    digest::enter(digest_slots_.size() - 1);
+                }
+                profiler::bind(profiler_.get());
+                run_hooks(end_hooks_);
+            }
+            profiler::bind(nullptr);
+            if(digest_on_) {
+                end_digest();
             }
+            if(memory_) {
+                memory_->sample();
+            }
+        }
+        
+        const registry& components() const { return components_; }
+        int64_t current_step() const { return current_step_; }
+        
+        //
+        // keep a per-step digest from the next step on (see sim::digest).
+        // with keep_slots every component's slot is kept as well, so a
+        // divergence can be traced to the component it started in, at the
+        // cost of 8 bytes per component per step.
+        void enable_digest(bool keep_slots = false) {
+            digest_on_ = true;
+            keep_slots_ = keep_slots;
+            trace_ = {};
+            trace_.first_step = current_step_ + 1;
+        }
+        
+        const digest::trace& digest_trace() const { return trace_; }
+        
+        //
+        // hardware counters per component type and phase (see
+        // sim::profiler), reported to stderr when the engine goes away.
+        void enable_profiling() {
+            if(!profiler_) {
+                profiler_.reset(new profiler());
+            }
+        }
+        
+        const profiler* profile() const { return profiler_.get(); }
+        
+        //
+        // live and peak bytes and allocation per step for each memory tag
+        // (see sim::memory), sampled at the end of every step from now on
+        // and reported to stderr when the engine goes away.  the counts are
+        // process-wide, so with several engines each sees them all, and
+        // start with the first call, so make it before setting up.
+        void enable_memory_report() {
+            if(!memory_) {
+                memory_.reset(new memory::meter());
+            }
+        }
+        
+        const memory::meter* memory_usage() const { return memory_.get(); }
+        
+        //
+        // "step 120, component 37 (N3sim4linkI6packetEE)", for reports.
+        std::string describe(const digest::divergence& d) const {
+            if(!d) {
+                return "no divergence";
+            }
+            std::string str = "step " + std::to_string(d.step);
+            if(d.slot < 0) {
+                return str;
+            }
+            auto c = components_.find(component_id(d.slot));
+            if(c) {
+                return str + ", component " + std::to_string(d.slot) + " (" + typeid(*c).name() + ")";
+            }
+            if(components_.reserved(component_id(d.slot))) {
+                return str + ", slot " + std::to_string(d.slot) + " (behaviors)";
+            }
+            return str + ", engine (step hooks and draws outside components)";
         }
         
+        //
+        // draws come from the stream of the component or behavior being run
+        // (see sim::rng), so they are the same whatever the thread count,
+        // and are added to its digest slot.  anything else, such as setup
+        // between steps and step hooks, draws from the engine's own stream
+        // and must do so from the thread that calls step().
         template <typename IntType = int>
         IntType rand_int(IntType min, IntType max) {
             static_assert(std::is_integral<IntType>(), "IntType must be integral");
-            return std::uniform_int_distribution<IntType>(min,max)(gen_);
+            auto r = rng::current();
+            auto v = std::uniform_int_distribution<IntType>(min,max)(r ? *r : gen_);
+            digest::add(v);
+            return v;
         }
 
         template <typename RealType = float>
         RealType rand_real(RealType min, RealType max) {
             static_assert(std::is_floating_point<RealType>(), "RealType must be floating point");
-            return std::uniform_real_distribution<RealType>(min,max)(gen_);
+            auto r = rng::current();
+            auto v = std::uniform_real_distribution<RealType>(min,max)(r ? *r : gen_);
+            digest::add(v);
+            return v;
         }
 
     private:
-        unpause::async::thread_pool pool_;
-        std::mt19937 gen_;
+        //
+        // the members of one group that are stepped together: the whole
+        // group, or with placement its members on one thread.
+        struct slice {
+            registry::group* g;
+            std::vector<component*> members;
+        };
+        
+        //
+        // split every slice into chunks; rebuilt only when registration or
+        // placement changes.
+        void build_tasks() {
+            tasks_.clear();
+            slices_.clear();
+            splits_.clear();
+            const size_t threads = scheduler_.threads();
+            const size_t grain = std::min(scheduler::default_grain, std::max<size_t>(1, components_.size() / (threads * 4)));
+            auto add = [this, grain](registry::group* g, std::vector<component*> members) {
+                slices_.push_back({ g, std::move(members) });
+                auto& sl = slices_.back();
+                const size_t n = sl.members.size();
+                for(size_t i = 0; i < n; i += grain) {
+                    tasks_.push_back({ [](void* ctx, size_t begin, size_t end) {
+                        auto sl = static_cast<slice*>(ctx);
+                        auto g = sl->g;
+                        digest::bind(g->digest);
+                        profiler::bind(g->prof);
+                        profiler::scope p(g->frame);
+                        g->step(sl->members.data(), begin, end, g->current_step);
+                    }, &sl, i, std::min(n, i + grain) });
+                }
+            };
+            if(placement_.empty() || threads == 1) {
+                for(auto& it : components_.groups()) {
+                    add(it.get(), it->members);
+                }
+                return;
+            }
+            
+            // members by thread, then by group, so each thread's share is a
+            // contiguous run of tasks.
+            auto& groups = components_.groups();
+            size_t unplaced_total = 0;
+            for(auto& it : groups) {
+                for(auto c : it->members) {
+                    unplaced_total += placement(*c) == unplaced;
+                }
+            }
+            std::vector<std::vector<std::vector<component*>>> by_thread(threads, std::vector<std::vector<component*>>(groups.size()));
+            size_t unplaced_seen = 0;
+            for(size_t gi = 0; gi < groups.size(); gi++) {
+                for(auto c : groups[gi]->members) {
+                    const uint32_t part = placement(*c);
+                    const size_t t = part != unplaced ? part % threads : unplaced_seen++ * threads / unplaced_total;
+                    by_thread[t][gi].push_back(c);
+                }
+            }
+            for(size_t t = 0; t < threads; t++) {
+                splits_.push_back(tasks_.size());
+                for(size_t gi = 0; gi < groups.size(); gi++) {
+                    if(!by_thread[t][gi].empty()) {
+                        add(groups[gi].get(), std::move(by_thread[t][gi]));
+                    }
+                }
+            }
+            splits_.push_back(tasks_.size());
+        }
+        
+        //
+        // component slots come first, by id; the engine's own slot is last.
+        void run_hooks(std::vector<std::pair<std::string, std::function<void(int64_t)>>>& hooks) {
+            for(auto& it : hooks) {
+                profiler::scope p(it.first);
+                it.second(current_step_);
+                if(digest_on_) {
+                    // a parallel_for in the hook leaves this thread in
+                    // whatever slot its share of the work entered last.
+                    digest::bind(digest_slots_.data());
+                    digest::enter(digest_slots_.size() - 1);
+                }
+            }
+        }
+        
+        void begin_digest() {
+            digest_slots_.assign(components_.id_bound() + 1, digest::seed);
+            digest::bind(digest_slots_.data());
+            digest::enter(digest_slots_.size() - 1);
+        }
+        
+        void end_digest() {
+            digest::bind(nullptr);
+            uint64_t h = digest::mix(digest::seed, uint64_t(current_step_));
+            for(auto s : digest_slots_) {
+                h = digest::mix(h, s);
+            }
+            trace_.steps.push_back(h);
+            if(keep_slots_) {
+                trace_.slots.push_back(digest_slots_);
+            }
+        }
+        
+        scheduler scheduler_;
+        const uint64_t seed_;
+        rng gen_;
         int64_t current_step_ {0};
-        std::set<component*> components_;
+        registry components_;
+        std::vector<scheduler::task> tasks_;
+        std::deque<slice> slices_;
+        std::vector<size_t> splits_;
+        std::vector<uint32_t> placement_;
+        std::vector<std::pair<std::string, std::function<void(int64_t)>>> step_hooks_;
+        std::vector<std::pair<std::string, std::function<void(int64_t)>>> end_hooks_;
+        std::vector<uint64_t> digest_slots_;
+        std::unique_ptr<profiler> profiler_;
+        std::unique_ptr<memory::meter> memory_;
+        digest::trace trace_;
+        bool dirty_ {false};
+        bool digest_on_ {false};
+        bool keep_slots_ {false};
     };
     
     
@@ -96,52 +590,108 @@ namespace sim {
     // packets will be queued for n steps of latency where n is specified in
     // the ctor.
     //
+    // a per_peer link queues a copy of each packet for every other peer,
+    // which is the cheapest for two.  a multicast link (a gossip bus, a lan
+    // segment) appends each packet once to a shared log that every peer
+    // reads through its own cursor; entries are dropped once all cursors
+    // are past them.  peers join a multicast link with node::attach.
+    //
     template <typename PacketType>
     struct link : public component {
         
         static_assert(std::is_copy_constructible<PacketType>(), "PacketType must be copy-constructible");
         
         using packet_callback_f = std::function<void(const PacketType&)>;
+        using packets_callback_f = std::function<void(span<const PacketType>)>;
+        //
+        // a receiver's entry point: target is whatever was registered with
+        // it, typically the receiving node.
+        using deliver_f = void(*)(void* target, const link& from, span<const PacketType> pkts);
+        
+        enum fanout {
+            per_peer,
+            multicast
+        };
         
         //
         // Ctor. Specify latency in number of steps. Default is 1.
-        link(int64_t latency = 1) : latency_(latency) {};
+        link(int64_t latency = 1, fanout mode = per_peer) : latency_(latency), mode_(mode) {
+            receivers_.reserve(2);
+        };
         link(const link& other)
-        : packet_callbacks_(other.packet_callbacks_)
-        , packets_(other.packets_)
+        : receivers_(other.receivers_)
+        , log_(other.log_)
+        , log_base_(other.log_base_)
+        , sent_(other.sent_)
         , latency_(other.latency_)
+        , mode_(other.mode_)
         , cur_peerid_(other.cur_peerid_) {};
         
         void step() override {
+            if(mode_ == multicast) {
+                step_multicast();
+                return;
+            }
+            // due packets are moved out under the lock into the thread's
+            // step arena and delivered after it is released.  receivers are
+            // copied out too, as one may join while others are delivered to.
+            arena::scope scratch(arena::local());
+            arena_vector<target> cb;
+            arena_vector<PacketType> due;
             mut_.lock();
-            auto cb = packet_callbacks_;
+            cb.reserve(receivers_.size());
+            for(auto& it : receivers_) {
+                if(it.q) {
+                    cb.push_back({ it.fn, it.target, it.q.get(), it.peerid });
+                }
+            }
             mut_.unlock();
             for(auto& it : cb) {
+                due.clear();
                 mut_.lock();
-                auto iit = packets_.find(it.first);
-                if(iit != packets_.end()) {
-                    mut_.unlock();
-                    while(!iit->second.empty() && (current_step_ - iit->second.front().start_step) >= latency_) {
-                        mut_.lock();
-                        auto payload = iit->second.front().payload;
-                        iit->second.pop();
-                        mut_.unlock();
-                        it.second(payload);
-                    }
-                } else {
-                    mut_.unlock();
+                auto& q = *it.q;
+                while(!q.empty() && (current_step_ - q.front().start_step) >= latency_) {
+                    due.emplace_back(std::move(q.front().payload));
+                    q.pop();
+                }
+                mut_.unlock();
+                if(due.empty()) {
+                    continue;
                 }
+                profiler::scope p("deliver");
+                deliver(it, span<const PacketType>(due.data(), due.size()));
             }
         }
         
         //
         // send a packet to all other peers
         void send_packet(int peerid, const PacketType& payload) {
+            send_packet(peerid, payload, current_step_);
+        }
+        
+        //
+        // as above, stamped with the sender's step.  the link's own step
+        // lags by one until it has been stepped, which depends on thread
+        // timing, so senders stepped by the engine should use this.
+        void send_packet(int peerid, const PacketType& payload, int64_t step) {
             mut_.lock();
-            packet p(current_step_, payload);
-            for(auto& it : packet_callbacks_) {
-                if(it.first != peerid) {
-                    packets_[it.first].push(p);
+            sent_++;
+            if(mode_ == multicast) {
+                const bool heard = receivers_.size() > 1
+                    || (receivers_.size() == 1 && receivers_.front().peerid != peerid);
+                if(heard) {
+                    log_.emplace_back(step, peerid, payload);
+                }
+                mut_.unlock();
+                return;
+            }
+            packet p(step, payload);
+            for(auto& it : receivers_) {
+                if(it.peerid != peerid) {
+                    if(!it.q) {
+                        it.q.reset(new packet_queue());
+                    }
+                    it.q->push(p);
                 }
             }
             mut_.unlock();
@@ -151,15 +701,49 @@ namespace sim {
         //
         // set callback for packet received
         void set_packet_callback(int peerid, packet_callback_f func) {
-            mut_.lock();
-            packet_callbacks_.emplace(peerid, func);
-            mut_.unlock();
+            set_packets_callback(peerid, [func = std::move(func)](span<const PacketType> pkts) {
+                for(auto& it : pkts) {
+                    func(it);
+                }
+            });
+        }
+        
+        //
+        // as above, but called once per step with everything due for the
+        // peer, in send order.
+        void set_packets_callback(int peerid, packets_callback_f func) {
+            auto owned = std::make_shared<packets_callback_f>(std::move(func));
+            add_receiver(peerid, &call_back, owned.get(), owned);
+        }
+        
+        //
+        // as above, without a std::function: fn(target, *this, pkts).  this
+        // is how nodes receive (see node::connect).
+        void set_receiver(int peerid, deliver_f fn, void* target) {
+            add_receiver(peerid, fn, target, nullptr);
         }
     
         int next_peerid() {
             return ++cur_peerid_;
         }
         
+        fanout mode() const { return mode_; }
+        
+        //
+        // packets sent so far; read between steps.
+        uint64_t sent() const { return sent_; }
+        
+        //
+        // packets held: queued copies for per_peer, log entries for multicast.
+        size_t queued() {
+            std::lock_guard<std::mutex> lk(mut_);
+            size_t n = log_.size();
+            for(auto& it : receivers_) {
+                n += it.q ? it.q->size() : 0;
+            }
+            return n;
+        }
+        
     private:
         struct packet {
             packet(int64_t step, const PacketType& data) : start_step(step), payload(data) {};
@@ -167,11 +751,152 @@ namespace sim {
             PacketType payload;
         };
         
+        using packet_queue = std::queue<packet, std::deque<packet, tagged_allocator<packet, memory::link>>>;
+        
+        //
+        // a peer's entry point, its queue (per_peer; made on the first
+        // packet for it) and its read position in the log (multicast).
+        struct receiver {
+            receiver(int peerid, deliver_f fn, void* target, std::shared_ptr<packets_callback_f> owned, uint64_t cursor)
+            : peerid(peerid), fn(fn), target(target), owned(std::move(owned)), cursor(cursor) {};
+            receiver(const receiver& other)
+            : peerid(other.peerid)
+            , fn(other.fn)
+            , target(other.target)
+            , owned(other.owned)
+            , q(other.q ? new packet_queue(*other.q) : nullptr)
+            , cursor(other.cursor) {};
+            receiver(receiver&&) = default;
+            receiver& operator=(receiver&&) = default;
+            
+            int peerid;
+            deliver_f fn;
+            void* target;
+            std::shared_ptr<packets_callback_f> owned; // target, for set_packets_callback
+            std::unique_ptr<packet_queue> q;
+            uint64_t cursor;
+        };
+        
+        //
+        // what step() needs of a receiver, copied out under the lock.
+        struct target {
+            deliver_f fn;
+            void* target;
+            packet_queue* q;
+            int peerid;
+        };
+        
+        static void call_back(void* target, const link&, span<const PacketType> pkts) {
+            (*static_cast<packets_callback_f*>(target))(pkts);
+        }
+        
+        void add_receiver(int peerid, deliver_f fn, void* target, std::shared_ptr<packets_callback_f> owned) {
+            std::lock_guard<std::mutex> lk(mut_);
+            // a peer hears what is sent after it joins, as with per_peer.
+            const uint64_t cursor = log_base_ + log_.size();
+            for(auto& it : receivers_) {
+                if(it.peerid == peerid) {
+                    it.fn = fn;
+                    it.target = target;
+                    it.owned = std::move(owned);
+                    return;
+                }
+            }
+            receivers_.emplace_back(peerid, fn, target, std::move(owned), cursor);
+        }
+        
+        void deliver(const target& t, span<const PacketType> pkts) const {
+            for(auto& it : pkts) {
+                digest::add_packet(it);
+            }
+            t.fn(t.target, *this, pkts);
+        }
+        
+        struct log_entry {
+            log_entry(int64_t step, int sender, const PacketType& data) : start_step(step), from(sender), payload(data) {};
+            const int64_t start_step;
+            const int from;
+            PacketType payload;
+        };
+        
+        //
+        // the due prefix of the log is found under the lock and delivered
+        // from outside it.  senders only append, which leaves deque
+        // elements in place, and only this step pops the front.  payloads
+        // are gathered once into the step arena so that each peer gets
+        // them as spans, split around its own packets.
+        void step_multicast() {
+            arena::scope scratch(arena::local());
+            struct reader {
+                target t;
+                size_t index; // into receivers_
+                uint64_t from; // its cursor, as read under the lock
+            };
+            arena_vector<reader> cb;
+            arena_vector<const log_entry*> due;
+            mut_.lock();
+            const uint64_t first = log_base_;
+            for(auto& e : log_) {
+                if((current_step_ - e.start_step) < latency_) {
+                    break;
+                }
+                due.push_back(&e);
+            }
+            if(!due.empty()) {
+                cb.reserve(receivers_.size());
+                for(size_t i = 0; i < receivers_.size(); i++) {
+                    auto& r = receivers_[i];
+                    cb.push_back({ { r.fn, r.target, nullptr, r.peerid }, i, r.cursor });
+                }
+            }
+            mut_.unlock();
+            if(due.empty()) {
+                return;
+            }
+            const uint64_t end = first + due.size();
+            {
+                profiler::scope p("deliver");
+                arena_vector<PacketType> payloads;
+                payloads.reserve(due.size());
+                for(auto e : due) {
+                    payloads.push_back(e->payload);
+                }
+                for(auto& it : cb) {
+                    size_t run = size_t(std::max(it.from, first) - first);
+                    for(size_t i = run; i <= due.size(); i++) {
+                        if(i == due.size() || due[i]->from == it.t.peerid) {
+                            if(i > run) {
+                                deliver(it.t, span<const PacketType>(payloads.data() + run, i - run));
+                            }
+                            run = i + 1;
+                        }
+                    }
+                }
+            }
+            // cursors are written under the lock, like add_receiver's.
+            std::lock_guard<std::mutex> lk(mut_);
+            for(auto& it : cb) {
+                auto& c = receivers_[it.index].cursor;
+                c = std::max(c, end);
+            }
+            uint64_t consumed = end;
+            for(auto& it : receivers_) {
+                consumed = std::min(consumed, it.cursor);
+            }
+            while(log_base_ < consumed) {
+                log_.pop_front();
+                log_base_++;
+            }
+        }
+        
         std::mutex mut_;
         
-        std::map<int, packet_callback_f>  packet_callbacks_;
-        std::map<int, std::queue<packet>> packets_;
+        std::vector<receiver> receivers_; // in join order
+        std::deque<log_entry, tagged_allocator<log_entry, memory::link>> log_;
+        uint64_t log_base_ {0}; // position of log_.front()
+        uint64_t sent_ {0};
         const int64_t latency_ {1};
+        const fanout mode_ {per_peer};
         int cur_peerid_{0};
     };
     
@@ -180,46 +905,157 @@ namespace sim {
         node(engine& engine) : engine_(engine) {}
         
         virtual void packet_callback(const PacketType& pkt) {};
+        //
+        // as packet_callback, with the link it came over; the default just
+        // forwards.  called from the link's step.
+        virtual void packet_callback(const link<PacketType>& from, const PacketType& pkt) {
+            packet_callback(pkt);
+        }
+        //
+        // everything due from one link this step, in send order; called
+        // once per link and step.  the default hands the packets to
+        // packet_callback one at a time.  override it to take a lock once
+        // per batch and handle the packets in a loop with no per-packet
+        // virtual call.
+        virtual void on_packets(const link<PacketType>& from, span<const PacketType> pkts) {
+            for(auto& it : pkts) {
+                packet_callback(from, it);
+            }
+        }
         virtual void send_packet(const PacketType& pkt) {
-            for(auto& it : link_) {
-                if(it.second) {
-                    it.second->send_packet(peerid_[it.first], pkt);
+            for(auto& it : peers_) {
+                it.lk->send_packet(it.peerid, pkt, engine_.current_step());
+            }
+        }
+        //
+        // send over one link only, e.g. to answer the peer a packet came
+        // from.  false if this node isn't on lk.
+        bool send_packet_to(const link<PacketType>& lk, const PacketType& pkt) {
+            for(auto& it : peers_) {
+                if(it.lk.get() == &lk) {
+                    it.lk->send_packet(it.peerid, pkt, engine_.current_step());
+                    return true;
                 }
             }
+            return false;
+        }
+        //
+        // this node's links in registration (id) order, which unlike the
+        // order they were made in is the same every run.
+        std::vector<const link<PacketType>*> links() const {
+            std::vector<const link<PacketType>*> res;
+            for(auto& it : peers_) {
+                res.push_back(it.lk.get());
+            }
+            std::sort(res.begin(), res.end(), [](auto a, auto b) { return a->id() < b->id(); });
+            return res;
         }
         
         virtual void disconnect(node<PacketType>& other) {
-            if(link_.find(&other) != link_.end() && this != &other) {
+            auto it = find(&other);
+            if(it != peers_.end() && this != &other) {
+                // erased first, so other's call back here finds nothing.
+                peers_.erase(it);
+                links_version_++;
                 other.disconnect(*this);
-                link_.erase(&other);
-                peerid_.erase(&other);
             }
         }
         virtual void connect(node<PacketType>& other, int latency = 1) {
-            if(link_.find(&other) == link_.end() && this != &other) {
+            if(find(&other) == peers_.end() && this != &other) {
                 auto l = std::make_shared<link<PacketType>>(latency);
                 engine_.register_component(*l);
                 connect(&other, l);
                 other.connect(this, l);
             }
         }
-        bool connected() const { return !link_.empty(); }
-        size_t connections() const { return link_.size(); }
+        bool connected() const { return !peers_.empty(); }
+        size_t connections() const { return peers_.size(); }
+        //
+        // bumped whenever a link is added or removed, for nodes that keep
+        // their own view of links().
+        uint64_t links_version() const { return links_version_; }
         bool has_peer(node<PacketType>& other) const {
-            return link_.find(&other) != link_.end();
+            return find(&other) != peers_.end();
+        }
+        //
+        // room for n links, for bulk loaders that know the degree up front.
+        void reserve_links(size_t n) {
+            peers_.reserve(n);
+        }
+        
+        //
+        // join a shared link as one more peer.  what this node sends on it
+        // reaches every other attached node, and it hears all of them.
+        void attach(std::shared_ptr<link<PacketType>> lk) {
+            if(find(lk.get()) == peers_.end()) {
+                connect(lk.get(), lk);
+            }
+        }
+        
+        //
+        // connect a and b over an existing, already registered link.  used by
+        // bulk loaders such as sim::connect(engine&, const topology&, ...).
+        // an end whose dynamic type is its static type A (or B) gets packets
+        // through A::on_packets called directly, which the link's step can
+        // inline, as the registry steps components by type; any other goes
+        // through the vtable.
+        template <typename A, typename B>
+        static void join(A& a, B& b, std::shared_ptr<link<PacketType>> lk) {
+            node& na = a;
+            node& nb = b;
+            if(na.find(&nb) == na.peers_.end() && &na != &nb) {
+                na.connect(&nb, lk, delivery(a));
+                nb.connect(&na, lk, delivery(b));
+            }
+        }
+        
+        //
+        // the entry point links call for n: T::on_packets when T is n's
+        // dynamic type, otherwise the virtual on_packets.
+        template <typename T>
+        static typename link<PacketType>::deliver_f delivery(T& n) {
+            static_assert(std::is_base_of<node, T>(), "T must be a node");
+            if(typeid(n) != typeid(T)) {
+                return &deliver_to;
+            }
+            return &deliver_as<T>;
         }
     protected:
-        void connect(void* ptr, std::shared_ptr<link<PacketType>>& lk) {
-            link_.emplace(ptr, lk);
-            peerid_.emplace(ptr, lk->next_peerid());
-            lk->set_packet_callback(peerid_[ptr], [this](const PacketType& pkt) {
-                packet_callback(pkt);
-            });
+        //
+        // one per link: who is at the other end (the node, or for a shared
+        // link the link itself) and our peer id on it.  a node has a handful
+        // of links, so a vector searched in order beats a map, and adding
+        // one is an append.
+        struct peer {
+            const void* key;
+            std::shared_ptr<link<PacketType>> lk;
+            int peerid;
+        };
+        
+        typename std::vector<peer>::const_iterator find(const void* key) const {
+            return std::find_if(peers_.begin(), peers_.end(), [key](const peer& p) { return p.key == key; });
+        }
+        
+        void connect(const void* key, std::shared_ptr<link<PacketType>>& lk,
+                     typename link<PacketType>::deliver_f fn = &deliver_to) {
+            const int peerid = lk->next_peerid();
+            peers_.push_back({ key, lk, peerid });
+            links_version_++;
+            lk->set_receiver(peerid, fn, this);
+        }
+        
+        static void deliver_to(void* target, const link<PacketType>& from, span<const PacketType> pkts) {
+            static_cast<node*>(target)->on_packets(from, pkts);
+        }
+        
+        template <typename T>
+        static void deliver_as(void* target, const link<PacketType>& from, span<const PacketType> pkts) {
+            static_cast<T*>(static_cast<node*>(target))->T::on_packets(from, pkts);
         }
     protected:
         engine& engine_;
-        std::map<void*, std::shared_ptr<link<PacketType>>> link_;
-        std::map<void*, const int> peerid_;
+        std::vector<peer> peers_;
+        uint64_t links_version_ {0};
     };
 }
 
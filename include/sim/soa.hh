@@ -0,0 +1,113 @@
+#ifndef SIM_SOA_HH
+#define SIM_SOA_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "sim/span.hh"
+
+namespace sim {
+
+    //
+    // column tag.  per-node state is declared as one tag type per field:
+    //
+    //   struct last_step : sim::column<int64_t> {};
+    //   struct interval : sim::column<int32_t> {};
+    //   sim::soa<last_step, interval> state;
+    //   auto row = state.push_back();
+    //   state.get<last_step>()[row] = 0;
+    //
+    // a pass over one field of every node then reads that column alone,
+    // not a cache line or more of each node.  columns of distinct rows are
+    // distinct objects, so rows owned by different threads may be written
+    // concurrently; columns of bytes share lines between neighbours,
+    // though, so fields written every step want rows placed by thread.
+    //
+    template <typename T>
+    struct column {
+        using value_type = T;
+    };
+
+    //
+    // cache-line aligned allocator, so every column starts on its own line
+    // and scans over it vectorise cleanly.
+    //
+    template <typename T>
+    struct aligned_allocator {
+        using value_type = T;
+        static constexpr size_t alignment = 64;
+
+        aligned_allocator() noexcept {};
+        template <typename U>
+        aligned_allocator(const aligned_allocator<U>&) noexcept {}
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+        }
+        void deallocate(T* p, size_t) {
+            ::operator delete(p, std::align_val_t(alignment));
+        }
+
+        template <typename U>
+        bool operator==(const aligned_allocator<U>&) const { return true; }
+        template <typename U>
+        bool operator!=(const aligned_allocator<U>&) const { return false; }
+    };
+
+    //
+    // soa, structure-of-arrays table with one contiguous column per tag.
+    // a row is a node; rows are only added, and should all be added before
+    // the simulation starts stepping, since growing a column moves it, so
+    // hold row numbers, not references.  column types need to be default
+    // constructible, and copyable unless their move is noexcept.
+    //
+    template <typename... Columns>
+    struct soa {
+        soa(size_t rows = 0) {
+            resize(rows);
+        }
+
+        size_t size() const { return size_; }
+
+        void resize(size_t rows) {
+            std::apply([rows](auto&... col) { (col.resize(rows), ...); }, cols_);
+            size_ = rows;
+        }
+
+        void reserve(size_t rows) {
+            std::apply([rows](auto&... col) { (col.reserve(rows), ...); }, cols_);
+        }
+
+        //
+        // append a value-initialised row, returning its index.
+        size_t push_back() {
+            std::apply([](auto&... col) { (col.emplace_back(), ...); }, cols_);
+            return size_++;
+        }
+
+        template <typename C>
+        span<typename C::value_type> get() {
+            auto& col = std::get<vec<C>>(cols_);
+            return span<typename C::value_type>(col.data(), col.size());
+        }
+
+        template <typename C>
+        span<const typename C::value_type> get() const {
+            auto& col = std::get<vec<C>>(cols_);
+            return span<const typename C::value_type>(col.data(), col.size());
+        }
+
+    private:
+        template <typename C>
+        struct vec : std::vector<typename C::value_type, aligned_allocator<typename C::value_type>> {};
+
+        std::tuple<vec<Columns>...> cols_;
+        size_t size_ {0};
+    };
+}
+
+#endif /* SIM_SOA_HH */
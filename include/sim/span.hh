@@ -0,0 +1,45 @@
+#ifndef SIM_SPAN_HH
+#define SIM_SPAN_HH
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace sim {
+
+    //
+    // span, non-owning view over contiguous elements: the part of
+    // std::span that links and codecs use, with a dynamic extent only.
+    //
+    template <typename T>
+    struct span {
+        using element_type = T;
+        using value_type = typename std::remove_cv<T>::type;
+
+        span() {};
+        span(T* data, size_t size) : data_(data), size_(size) {};
+        template <typename Container,
+                  typename = decltype(static_cast<T*>(std::declval<Container&>().data()))>
+        span(Container& c) : data_(c.data()), size_(c.size()) {}
+        template <typename U,
+                  typename = typename std::enable_if<std::is_convertible<U(*)[], T(*)[]>::value>::type>
+        span(const span<U>& other) : data_(other.data()), size_(other.size()) {}
+
+        T* data() const { return data_; }
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        T& operator[](size_t i) const { return data_[i]; }
+        T* begin() const { return data_; }
+        T* end() const { return data_ + size_; }
+
+        span subspan(size_t offset, size_t count) const {
+            return span(data_ + offset, count);
+        }
+
+    private:
+        T* data_ {nullptr};
+        size_t size_ {0};
+    };
+}
+
+#endif /* SIM_SPAN_HH */
@@ -0,0 +1,172 @@
+#ifndef SIM_TALLY_HH
+#define SIM_TALLY_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "sim/bitmap.hh"
+#include "sim/memory.hh"
+#include "sim/sha.hh"
+
+namespace sim {
+
+    //
+    // tally, the opinions a node has counted towards deciding a block: one
+    // bitmap of voter ids per (round, block hash), the first opinion per
+    // voter winning, and for each peer the votes it is known to have.
+    //
+    // opinions travel as bundles.  bundle_for(peer) encodes the entries the
+    // peer lacks any of our votes for and merge() decodes one back in, so a
+    // round costs O(steps x edges) packets rather than one per opinion and
+    // edge, and merging is a few word-wise ors.  who wins a round doesn't
+    // depend on how the opinions were packed, only on when they arrived.
+    //
+    struct tally {
+        static constexpr size_t none = std::numeric_limits<size_t>::max();
+
+        struct entry {
+            int seq;
+            sha256_t block_sha;
+            bitmap nodes;
+        };
+
+        struct bundle {
+            std::vector<entry> entries;
+            size_t height {0}; // of the sender's chain
+
+            size_t bytes() const {
+                size_t n = sizeof(height);
+                for(auto& it : entries) {
+                    n += sizeof(it.seq) + sizeof(it.block_sha) + it.nodes.bytes();
+                }
+                return n;
+            }
+        };
+
+        explicit tally(size_t peers = 0) : peers_(peers) {}
+
+        size_t peers() const { return peers_; }
+
+        //
+        // follow a change of peers: moved[i] is the new index of peer i, or
+        // none if it is gone, and there are now n.  a new peer is known to
+        // have nothing, so its next bundle carries everything.
+        void remap(const std::vector<size_t>& moved, size_t n) {
+            for(auto& it : entries_) {
+                std::vector<bitmap> known(n);
+                for(size_t i = 0; i < it.known.size() && i < moved.size(); i++) {
+                    if(moved[i] != none) {
+                        known[moved[i]] = std::move(it.known[i]);
+                    }
+                }
+                it.known = std::move(known);
+            }
+            peers_ = n;
+        }
+
+        //
+        // count the voters in nodes not counted yet for (seq, sha), and note
+        // that peer (none for our own) has all of nodes.  returns how many
+        // were new.
+        size_t add(int seq, const sha256_t& sha, const bitmap& nodes, size_t peer = none) {
+            auto fresh = nodes.without(voted_);
+            auto it = std::find_if(entries_.begin(), entries_.end(), [seq, &sha](const state& e) {
+                return e.op.seq == seq && e.op.block_sha == sha;
+            });
+            if(it == entries_.end()) {
+                if(fresh.empty()) {
+                    return 0;
+                }
+                entries_.push_back({ { seq, sha, {} }, std::vector<bitmap>(peers_) });
+                it = entries_.end() - 1;
+            }
+            if(peer < it->known.size()) {
+                it->known[peer].merge(nodes);
+            }
+            if(fresh.empty()) {
+                return 0;
+            }
+            const size_t added = it->op.nodes.merge(fresh);
+            voted_.merge(fresh);
+            voters_ += added;
+            return added;
+        }
+
+        size_t merge(const bundle& b, size_t peer = none) {
+            size_t added = 0;
+            for(auto& it : b.entries) {
+                added += add(it.seq, it.block_sha, it.nodes, peer);
+            }
+            return added;
+        }
+
+        //
+        // the voters in b not counted yet, an upper bound on what merging
+        // it adds (a voter may be in several of its entries).
+        size_t fresh(const bundle& b) const {
+            size_t n = 0;
+            for(auto& it : b.entries) {
+                n += it.nodes.without(voted_).count();
+            }
+            return n;
+        }
+
+        //
+        // the entries peer doesn't have all of our votes for, which it is
+        // then taken to have.  empty when there is nothing to send.
+        bundle bundle_for(size_t peer) {
+            bundle b;
+            for(auto& it : entries_) {
+                if(peer < it.known.size() && !it.op.nodes.without(it.known[peer]).empty()) {
+                    b.entries.push_back(it.op);
+                    it.known[peer].merge(it.op.nodes);
+                }
+            }
+            return b;
+        }
+
+        //
+        // the hash with the most votes in round seq, the lowest on a tie,
+        // and its votes; zero votes if the round has none.
+        std::pair<sha256_t, size_t> leader(int seq) const {
+            std::pair<sha256_t, size_t> best {};
+            for(auto& it : entries_) {
+                if(it.op.seq != seq) {
+                    continue;
+                }
+                const size_t votes = it.op.nodes.count();
+                if(votes > best.second || (votes == best.second && it.op.block_sha < best.first)) {
+                    best = { it.op.block_sha, votes };
+                }
+            }
+            return best;
+        }
+
+        bool voted(size_t id) const { return voted_.test(id); }
+        size_t voters() const { return voters_; }
+
+        //
+        // a new round; the peers stay.
+        void clear() {
+            entries_.clear();
+            voted_.clear();
+            voters_ = 0;
+        }
+
+    private:
+        struct state {
+            entry op;
+            std::vector<bitmap> known; // per peer, the votes it has
+        };
+
+        std::vector<state, tagged_allocator<state, memory::node>> entries_;
+        bitmap voted_; // every voter counted this round
+        size_t voters_ {0};
+        size_t peers_;
+    };
+}
+
+#endif /* SIM_TALLY_HH */
@@ -0,0 +1,558 @@
+#ifndef SIM_TOPOLOGY_HH
+#define SIM_TOPOLOGY_HH
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sim/scheduler.hh"
+#include "sim/span.hh"
+#include "sim/sim.hh"
+
+namespace sim {
+
+    //
+    // topology, an undirected graph over nodes [0, n) with a latency (in
+    // steps) per edge, plus a CSR adjacency built from the edge list.
+    //
+    // the generators below split their work into fixed-size chunks, each with
+    // its own rng seeded from (seed, chunk), and run the chunks through exec's
+    // parallel_for: pass the engine (or a sim::scheduler) to use its threads,
+    // or nothing to run them on the calling thread.  chunk boundaries do not
+    // depend on the thread count, so the same seed always yields the same
+    // graph.  edges are normalised (a < b), self loops
+    // and duplicates are dropped and the list is sorted.
+    //
+    struct topology {
+        using latency_range = std::pair<int, int>;
+
+        struct edge {
+            uint32_t a;
+            uint32_t b;
+            int32_t latency;
+        };
+
+        uint32_t nodes {0};
+        std::vector<edge> edges;
+        std::vector<uint32_t> offsets;   // nodes + 1 entries into neighbors
+        std::vector<uint32_t> neighbors;
+        std::vector<int32_t> latencies;  // parallel to neighbors
+
+        size_t degree(uint32_t i) const { return offsets[i + 1] - offsets[i]; }
+        span<const uint32_t> neighbors_of(uint32_t i) const {
+            return span<const uint32_t>(neighbors.data() + offsets[i], degree(i));
+        }
+
+        //
+        // d-regular: the union of d/2 random hamiltonian cycles, plus a
+        // random perfect matching for an odd d, connected by construction.
+        // edges that land twice are swapped with a random edge outside the
+        // first cycle ((u, v), (x, y) becoming (u, x), (v, y)), which keeps
+        // every degree and that cycle.  the few a large graph gets are all
+        // placed this way; a small, dense one may need a fresh draw.  throws
+        // std::invalid_argument when no d-regular graph on n nodes exists
+        // (d >= n, or n and d both odd).
+        template <typename Exec = serial>
+        static topology random_regular(uint32_t n, uint32_t d, uint64_t seed, latency_range latency = {1, 1},
+                                       Exec&& exec = Exec()) {
+            if(d >= n || (d % 2 == 1 && n % 2 == 1)) {
+                throw std::invalid_argument("random_regular: no " + std::to_string(d) + "-regular graph on "
+                                            + std::to_string(n) + " nodes");
+            }
+            if(d + 1 == n) {
+                // complete: nothing to draw, and no room to swap in.
+                std::vector<std::vector<edge>> parts(1);
+                for(uint32_t a = 0; a < n; a++) {
+                    for(uint32_t b = a + 1; b < n; b++) {
+                        parts[0].push_back({ a, b, 0 });
+                    }
+                }
+                return finish(n, parts, seed, latency, exec);
+            }
+            const uint32_t cycles = d / 2;
+            const uint32_t rounds = cycles + d % 2;
+            for(uint64_t attempt = 0; attempt < max_attempts; attempt++) {
+                std::vector<std::vector<edge>> parts(rounds);
+                parallel(exec, rounds, [&](size_t c) {
+                    auto gen = rng(seed, attempt * rounds + c);
+                    std::vector<uint32_t> perm(n);
+                    std::iota(perm.begin(), perm.end(), 0);
+                    std::shuffle(perm.begin(), perm.end(), gen);
+                    auto& out = parts[c];
+                    out.reserve(n);
+                    if(c < cycles) {
+                        for(uint32_t i = 0; i < n; i++) {
+                            out.push_back({ perm[i], perm[(i + 1) % n], int32_t(c) });
+                        }
+                    } else {
+                        for(uint32_t i = 0; i + 1 < n; i += 2) {
+                            out.push_back({ perm[i], perm[i + 1], int32_t(c) });
+                        }
+                    }
+                });
+                std::vector<std::vector<edge>> simple(1);
+                if(make_simple(parts, simple[0], rng(seed, ~attempt))) {
+                    return finish(n, simple, seed, latency, exec);
+                }
+            }
+            throw std::runtime_error("random_regular: no simple " + std::to_string(d) + "-regular graph on "
+                                     + std::to_string(n) + " nodes found");
+        }
+
+        //
+        // G(n, p), each pair present independently with probability p.
+        // rows are skipped through geometrically, so the cost is in the
+        // number of edges rather than pairs.
+        template <typename Exec = serial>
+        static topology erdos_renyi(uint32_t n, double p, uint64_t seed, latency_range latency = {1, 1},
+                                    Exec&& exec = Exec()) {
+            const size_t chunks = (n + chunk_nodes - 1) / chunk_nodes;
+            std::vector<std::vector<edge>> parts(chunks);
+            if(p > 0) {
+                parallel(exec, chunks, [&](size_t c) {
+                    auto gen = rng(seed, c);
+                    std::uniform_real_distribution<double> u(0, 1);
+                    const double lq = std::log(1 - std::min(p, 1 - 1e-12));
+                    const uint32_t end = std::min<uint32_t>(n, uint32_t((c + 1) * chunk_nodes));
+                    for(uint32_t i = uint32_t(c * chunk_nodes); i < end; i++) {
+                        double j = i;
+                        while(true) {
+                            j += 1 + std::floor(std::log(1 - u(gen)) / lq);
+                            if(j >= n) {
+                                break;
+                            }
+                            parts[c].push_back({ i, uint32_t(j), 0 });
+                        }
+                    }
+                });
+            }
+            return finish(n, parts, seed, latency, exec);
+        }
+
+        //
+        // ring lattice with k neighbours per node (k/2 each side), each edge
+        // rewired to a uniformly random endpoint with probability beta.
+        template <typename Exec = serial>
+        static topology watts_strogatz(uint32_t n, uint32_t k, double beta, uint64_t seed, latency_range latency = {1, 1},
+                                       Exec&& exec = Exec()) {
+            const size_t chunks = (n + chunk_nodes - 1) / chunk_nodes;
+            std::vector<std::vector<edge>> parts(chunks);
+            parallel(exec, chunks, [&](size_t c) {
+                auto gen = rng(seed, c);
+                std::uniform_real_distribution<double> u(0, 1);
+                std::uniform_int_distribution<uint32_t> pick(0, n - 1);
+                const uint32_t end = std::min<uint32_t>(n, uint32_t((c + 1) * chunk_nodes));
+                for(uint32_t i = uint32_t(c * chunk_nodes); i < end; i++) {
+                    for(uint32_t j = 1; j <= k / 2; j++) {
+                        uint32_t other = (i + j) % n;
+                        if(u(gen) < beta) {
+                            other = pick(gen);
+                        }
+                        parts[c].push_back({ i, other, 0 });
+                    }
+                }
+            });
+            return finish(n, parts, seed, latency, exec);
+        }
+
+        //
+        // preferential attachment, m edges per new node (batagelj-brandes).
+        // each node's targets depend on every earlier node, so generation is
+        // sequential; it is O(n * m) and only the finishing passes run in
+        // parallel.
+        template <typename Exec = serial>
+        static topology barabasi_albert(uint32_t n, uint32_t m, uint64_t seed, latency_range latency = {1, 1},
+                                        Exec&& exec = Exec()) {
+            std::vector<std::vector<edge>> parts(1);
+            auto gen = rng(seed, 0);
+            std::vector<uint32_t> ends(size_t(2) * n * m);
+            for(uint32_t v = 0; v < n; v++) {
+                for(uint32_t i = 0; i < m; i++) {
+                    const size_t at = 2 * (size_t(v) * m + i);
+                    ends[at] = v;
+                    ends[at + 1] = ends[std::uniform_int_distribution<size_t>(0, at)(gen)];
+                }
+            }
+            parts[0].reserve(size_t(n) * m);
+            for(size_t i = 0; i < ends.size(); i += 2) {
+                parts[0].push_back({ ends[i], ends[i + 1], 0 });
+            }
+            return finish(n, parts, seed, latency, exec);
+        }
+
+        //
+        // nodes placed uniformly on the unit torus, each connected to its k
+        // nearest neighbours.  latency grows linearly with distance from
+        // latency.first (co-located) to latency.second (furthest possible).
+        template <typename Exec = serial>
+        static topology geographic(uint32_t n, uint32_t k, uint64_t seed, latency_range latency = {1, 1},
+                                   Exec&& exec = Exec()) {
+            const size_t chunks = (n + chunk_nodes - 1) / chunk_nodes;
+            std::vector<float> x(n), y(n);
+            parallel(exec, chunks, [&](size_t c) {
+                auto gen = rng(seed, c);
+                std::uniform_real_distribution<float> u(0, 1);
+                const uint32_t end = std::min<uint32_t>(n, uint32_t((c + 1) * chunk_nodes));
+                for(uint32_t i = uint32_t(c * chunk_nodes); i < end; i++) {
+                    x[i] = u(gen);
+                    y[i] = u(gen);
+                }
+            });
+
+            // bucket into a grid of ~2 nodes per cell.
+            const uint32_t g = std::max<uint32_t>(1, uint32_t(std::sqrt(n / 2.0)));
+            auto cell_of = [g](float v) { return std::min(g - 1, uint32_t(v * g)); };
+            std::vector<uint32_t> cell_start(size_t(g) * g + 1, 0);
+            std::vector<uint32_t> cell_nodes(n);
+            for(uint32_t i = 0; i < n; i++) {
+                cell_start[cell_of(y[i]) * g + cell_of(x[i]) + 1]++;
+            }
+            std::partial_sum(cell_start.begin(), cell_start.end(), cell_start.begin());
+            {
+                auto fill = cell_start;
+                for(uint32_t i = 0; i < n; i++) {
+                    cell_nodes[fill[cell_of(y[i]) * g + cell_of(x[i])]++] = i;
+                }
+            }
+
+            auto dist = [&x, &y](uint32_t a, uint32_t b) {
+                float dx = std::fabs(x[a] - x[b]);
+                float dy = std::fabs(y[a] - y[b]);
+                dx = std::min(dx, 1 - dx);
+                dy = std::min(dy, 1 - dy);
+                return std::sqrt(dx * dx + dy * dy);
+            };
+            const float max_dist = std::sqrt(0.5f);
+            const int span_lat = latency.second - latency.first;
+
+            std::vector<std::vector<edge>> parts(chunks);
+            parallel(exec, chunks, [&](size_t c) {
+                std::vector<std::pair<float, uint32_t>> best;
+                const uint32_t end = std::min<uint32_t>(n, uint32_t((c + 1) * chunk_nodes));
+                for(uint32_t i = uint32_t(c * chunk_nodes); i < end; i++) {
+                    best.clear();
+                    const int cx = int(cell_of(x[i]));
+                    const int cy = int(cell_of(y[i]));
+                    // widen the search ring until it holds k candidates and
+                    // no unvisited cell can be closer than the kth.  with an
+                    // even g the last ring wraps onto itself: offsets r and
+                    // -r are the same column (or row), so only -r is taken.
+                    for(int r = 0; r <= int(g / 2); r++) {
+                        const bool wraps = 2 * r == int(g) && r > 0;
+                        for(int dy = -r; dy <= r; dy++) {
+                            for(int dx = -r; dx <= r; dx++) {
+                                if(std::max(std::abs(dx), std::abs(dy)) != r || (wraps && (dx == r || dy == r))) {
+                                    continue;
+                                }
+                                const uint32_t cell = uint32_t((cy + dy + int(g)) % int(g)) * g + uint32_t((cx + dx + int(g)) % int(g));
+                                for(auto it = cell_start[cell]; it < cell_start[cell + 1]; it++) {
+                                    const uint32_t j = cell_nodes[it];
+                                    if(j != i) {
+                                        best.emplace_back(dist(i, j), j);
+                                    }
+                                }
+                            }
+                        }
+                        if(best.size() >= k) {
+                            std::nth_element(best.begin(), best.begin() + (k - 1), best.end());
+                            if(best[k - 1].first <= float(r) / g) {
+                                break;
+                            }
+                        }
+                    }
+                    const size_t take = std::min<size_t>(k, best.size());
+                    std::partial_sort(best.begin(), best.begin() + take, best.end());
+                    for(size_t it = 0; it < take; it++) {
+                        const auto lat = latency.first + int32_t(std::lround(span_lat * best[it].first / max_dist));
+                        parts[c].push_back({ i, best[it].second, lat });
+                    }
+                }
+            });
+            return finish(n, parts, seed, latency, exec, false);
+        }
+
+        //
+        // split the nodes into parts of near-equal size with few edges
+        // between them, for engine::place.  label propagation: starting
+        // from contiguous blocks of ids, each node in turn joins the part
+        // most of its neighbours are in, if that part has room (slack over
+        // an even share).  sequential and deterministic, O(rounds * edges).
+        std::vector<uint32_t> partition(uint32_t parts, uint32_t rounds = 16, double slack = 0.05) const {
+            std::vector<uint32_t> part(nodes, 0);
+            if(parts <= 1 || nodes == 0) {
+                return part;
+            }
+            std::vector<uint32_t> size(parts, 0);
+            for(uint32_t i = 0; i < nodes; i++) {
+                part[i] = uint32_t(uint64_t(i) * parts / nodes);
+                size[part[i]]++;
+            }
+            const uint32_t room = uint32_t(std::ceil(double(nodes) / parts * (1 + slack)));
+            std::vector<uint32_t> weight(parts, 0);
+            std::vector<uint32_t> touched;
+            for(uint32_t r = 0; r < rounds; r++) {
+                size_t moved = 0;
+                for(uint32_t i = 0; i < nodes; i++) {
+                    for(auto j : neighbors_of(i)) {
+                        if(weight[part[j]]++ == 0) {
+                            touched.push_back(part[j]);
+                        }
+                    }
+                    const uint32_t cur = part[i];
+                    uint32_t best = cur;
+                    for(auto p : touched) {
+                        if(weight[p] > weight[best] && size[p] < room) {
+                            best = p;
+                        }
+                    }
+                    for(auto p : touched) {
+                        weight[p] = 0;
+                    }
+                    touched.clear();
+                    if(best != cur) {
+                        size[cur]--;
+                        size[best]++;
+                        part[i] = best;
+                        moved++;
+                    }
+                }
+                if(moved == 0) {
+                    break;
+                }
+            }
+            return part;
+        }
+
+        //
+        // edges whose ends are in different parts.
+        size_t cut(const std::vector<uint32_t>& part) const {
+            size_t n = 0;
+            for(auto& e : edges) {
+                n += part[e.a] != part[e.b];
+            }
+            return n;
+        }
+
+    private:
+        static constexpr size_t chunk_nodes = 4096;
+
+        static uint64_t mix(uint64_t z) {
+            // splitmix64 finaliser
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+        static std::mt19937_64 rng(uint64_t seed, uint64_t chunk) {
+            return std::mt19937_64(mix(seed + 0x9e3779b97f4a7c15ULL * (chunk + 1)));
+        }
+
+        static constexpr uint64_t max_attempts = 64;
+
+        //
+        // random_regular's repair: merge the rounds (latency holds the round)
+        // into out without duplicates, swapping each extra copy away as
+        // described there.  false if some copy found no partner.
+        static bool make_simple(std::vector<std::vector<edge>>& parts, std::vector<edge>& out, std::mt19937_64 gen) {
+            auto key = [](uint32_t a, uint32_t b) {
+                return a < b ? uint64_t(a) << 32 | b : uint64_t(b) << 32 | a;
+            };
+            std::vector<uint64_t> keys;
+            std::vector<int32_t> round;
+            std::vector<std::pair<uint64_t, int32_t>> all;
+            for(auto& it : parts) {
+                for(auto& e : it) {
+                    all.emplace_back(key(e.a, e.b), e.latency);
+                }
+                std::vector<edge>().swap(it);
+            }
+            std::sort(all.begin(), all.end());
+            keys.reserve(all.size());
+            round.reserve(all.size());
+            std::vector<uint64_t> extra;
+            for(auto& it : all) {
+                if(!keys.empty() && keys.back() == it.first) {
+                    extra.push_back(it.first);
+                } else {
+                    keys.push_back(it.first);
+                    round.push_back(it.second);
+                }
+            }
+            if(extra.empty()) {
+                out.reserve(keys.size());
+                for(auto k : keys) {
+                    out.push_back({ uint32_t(k >> 32), uint32_t(k), 0 });
+                }
+                return true;
+            }
+            std::vector<std::pair<uint64_t, int32_t>>().swap(all);
+
+            // removed edges are marked with round -1; added ones are few
+            // and kept apart.
+            std::vector<uint64_t> added;
+            auto has = [&](uint64_t k) {
+                auto it = std::lower_bound(keys.begin(), keys.end(), k);
+                if(it != keys.end() && *it == k && round[size_t(it - keys.begin())] >= 0) {
+                    return true;
+                }
+                return std::find(added.begin(), added.end(), k) != added.end();
+            };
+            std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+            for(auto k : extra) {
+                const uint32_t u = uint32_t(k >> 32), v = uint32_t(k);
+                bool placed = false;
+                for(size_t tries = 0; tries < 64 + 4 * keys.size() && !placed; tries++) {
+                    const size_t j = pick(gen);
+                    if(round[j] <= 0) {
+                        continue; // the first cycle, or gone already
+                    }
+                    uint32_t x = uint32_t(keys[j] >> 32), y = uint32_t(keys[j]);
+                    if(gen() & 1) {
+                        std::swap(x, y);
+                    }
+                    if(x == u || x == v || y == u || y == v || has(key(u, x)) || has(key(v, y))) {
+                        continue;
+                    }
+                    round[j] = -1;
+                    added.push_back(key(u, x));
+                    added.push_back(key(v, y));
+                    placed = true;
+                }
+                if(!placed) {
+                    return false;
+                }
+            }
+            out.reserve(keys.size() + added.size());
+            for(size_t i = 0; i < keys.size(); i++) {
+                if(round[i] >= 0) {
+                    out.push_back({ uint32_t(keys[i] >> 32), uint32_t(keys[i]), 0 });
+                }
+            }
+            for(auto k : added) {
+                out.push_back({ uint32_t(k >> 32), uint32_t(k), 0 });
+            }
+            return true;
+        }
+
+        template <typename Exec, typename F>
+        static void parallel(Exec& exec, size_t count, F&& fn) {
+            exec.parallel_for(count, fn);
+        }
+
+        //
+        // merge chunk outputs, normalise, dedupe, assign latencies and build
+        // the adjacency.
+        template <typename Exec>
+        static topology finish(uint32_t n, std::vector<std::vector<edge>>& parts, uint64_t seed,
+                               latency_range latency, Exec& exec, bool assign_latency = true) {
+            topology t;
+            t.nodes = n;
+            size_t total = 0;
+            for(auto& it : parts) {
+                total += it.size();
+            }
+            t.edges.reserve(total);
+            for(auto& it : parts) {
+                for(auto& e : it) {
+                    if(e.a != e.b) {
+                        t.edges.push_back(e.a < e.b ? e : edge { e.b, e.a, e.latency });
+                    }
+                }
+                std::vector<edge>().swap(it);
+            }
+            std::sort(t.edges.begin(), t.edges.end(), [](const edge& l, const edge& r) {
+                return l.a < r.a || (l.a == r.a && (l.b < r.b || (l.b == r.b && l.latency < r.latency)));
+            });
+            t.edges.erase(std::unique(t.edges.begin(), t.edges.end(), [](const edge& l, const edge& r) {
+                return l.a == r.a && l.b == r.b;
+            }), t.edges.end());
+
+            if(assign_latency) {
+                // per-edge latency from a hash of its endpoints, independent of order.
+                const uint64_t range = uint64_t(std::max(0, latency.second - latency.first)) + 1;
+                const size_t chunks = (t.edges.size() + chunk_nodes - 1) / chunk_nodes;
+                parallel(exec, chunks, [&](size_t c) {
+                    const size_t end = std::min(t.edges.size(), (c + 1) * chunk_nodes);
+                    for(size_t i = c * chunk_nodes; i < end; i++) {
+                        auto& e = t.edges[i];
+                        const uint64_t h = mix(seed ^ (uint64_t(e.a) << 32 | e.b));
+                        e.latency = latency.first + int32_t(h % range);
+                    }
+                });
+            }
+
+            t.offsets.assign(size_t(n) + 1, 0);
+            for(auto& e : t.edges) {
+                t.offsets[e.a + 1]++;
+                t.offsets[e.b + 1]++;
+            }
+            std::partial_sum(t.offsets.begin(), t.offsets.end(), t.offsets.begin());
+            t.neighbors.resize(t.edges.size() * 2);
+            t.latencies.resize(t.edges.size() * 2);
+            std::vector<uint32_t> fill(t.offsets.begin(), t.offsets.end() - 1);
+            for(auto& e : t.edges) {
+                t.neighbors[fill[e.a]] = e.b;
+                t.latencies[fill[e.a]++] = e.latency;
+                t.neighbors[fill[e.b]] = e.a;
+                t.latencies[fill[e.b]++] = e.latency;
+            }
+            return t;
+        }
+    };
+
+    //
+    // create and register a link for every edge of t, between node_at(a) and
+    // node_at(b).  links are allocated together in one block, which is kept
+    // alive by the links' shared_ptrs held in the nodes, and returned in
+    // edge order.  each node's link list is sized to its degree first, so
+    // loading an edge is two appends.  with parts (see topology::partition)
+    // each link is placed in the part of its lower-numbered end.
+    //
+    template <typename PacketType, typename NodeAt>
+    std::shared_ptr<std::deque<link<PacketType>>> connect(engine& e, const topology& t, NodeAt&& node_at,
+                                                          const std::vector<uint32_t>* parts = nullptr) {
+        auto links = std::make_shared<std::deque<link<PacketType>>>();
+        for(uint32_t i = 0; i < t.nodes; i++) {
+            node_at(i).reserve_links(t.degree(i));
+        }
+        for(auto& it : t.edges) {
+            links->emplace_back(it.latency);
+            auto& lk = links->back();
+            e.register_component(lk);
+            if(parts) {
+                e.place(lk, (*parts)[it.a]);
+            }
+            node<PacketType>::join(node_at(it.a), node_at(it.b), std::shared_ptr<link<PacketType>>(links, &lk));
+        }
+        return links;
+    }
+
+    //
+    // packets sent over links within a part and across parts, from the
+    // links connect() returned.  read between steps.
+    //
+    struct traffic {
+        uint64_t local {0};
+        uint64_t cross {0};
+    };
+
+    template <typename PacketType>
+    traffic measure_traffic(const topology& t, const std::vector<uint32_t>& parts, const std::deque<link<PacketType>>& links) {
+        traffic tr;
+        for(size_t i = 0; i < t.edges.size() && i < links.size(); i++) {
+            auto& e = t.edges[i];
+            (parts[e.a] == parts[e.b] ? tr.local : tr.cross) += links[i].sent();
+        }
+        return tr;
+    }
+}
+
+#endif /* SIM_TOPOLOGY_HH */
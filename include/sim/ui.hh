@@ -8,6 +8,8 @@
 #include <mutex>
 #include <map>
 
+#include "sim/memory.hh"
+
 extern "C" {
     #include <ncurses.h>
 }
@@ -36,9 +38,9 @@ namespace sim {
         std::map<element, WINDOW*> wnd_;
         std::map<element, bool> dirty_;
         std::map<element, std::mutex> mut_;
-        std::deque<std::string> loglines_;
+        std::deque<tagged_string<memory::log>, tagged_allocator<tagged_string<memory::log>, memory::log>> loglines_;
         std::chrono::steady_clock::time_point last_draw_ {std::chrono::steady_clock::now()};
-        int max_loglines_{10};
+        size_t max_loglines_{10};
     };
 
 }
@@ -0,0 +1,132 @@
+#include "sim/sim.hh"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+
+//
+// packet delivery micro-benchmark: one link, one sender, one receiver whose
+// handler takes a lock, as node handlers do.  run as
+// `./deliver-bench [packets per step] [steps]`.
+//
+// per-packet callback is the path every packet took before on_packets: a
+// std::function call and a lock per packet.  node, packet_callback is a
+// node that only overrides packet_callback, so the default on_packets
+// makes a virtual call and takes the lock per packet.  node, on_packets
+// takes the lock once per batch.  node, on_packets, join is the same node
+// connected with node::join, which has the link call batched::on_packets
+// directly rather than through the vtable.  times are for engine::step()
+// alone, which dequeues and delivers; sending happens between steps.
+//
+
+namespace {
+
+    using clock_type = std::chrono::steady_clock;
+
+    struct packet {
+        uint64_t value;
+    };
+
+    struct sender : sim::node<packet> {
+        using sim::node<packet>::node;
+    };
+
+    struct per_packet : sim::node<packet> {
+        using sim::node<packet>::node;
+
+        void packet_callback(const packet& pkt) override {
+            std::lock_guard<std::mutex> lk(mut);
+            sum += pkt.value;
+        }
+
+        std::mutex mut;
+        uint64_t sum {0};
+    };
+
+    struct batched : sim::node<packet> {
+        using sim::node<packet>::node;
+
+        void on_packets(const sim::link<packet>&, sim::span<const packet> pkts) override {
+            std::lock_guard<std::mutex> lk(mut);
+            for(auto& it : pkts) {
+                sum += it.value;
+            }
+        }
+
+        std::mutex mut;
+        uint64_t sum {0};
+    };
+
+    void report(const char* name, size_t items, double secs, uint64_t sum) {
+        printf("%-28s %10zu items %9.3f ms %8.1f ns/item   (sum %" PRIu64 ")\n",
+               name, items, secs * 1e3, secs * 1e9 / items, sum);
+    }
+
+    //
+    // step the engine with count packets queued before each step.
+    template <typename Send>
+    double run(sim::engine& e, size_t count, size_t steps, Send&& send) {
+        double secs = 0;
+        for(size_t s = 0; s < steps; s++) {
+            for(size_t i = 0; i < count; i++) {
+                send(packet { i });
+            }
+            auto start = clock_type::now();
+            e.step();
+            secs += std::chrono::duration<double>(clock_type::now() - start).count();
+        }
+        // the last batch is still in flight.
+        e.step();
+        return secs;
+    }
+
+    void bench_callback(size_t count, size_t steps) {
+        sim::engine e(1, 1);
+        auto lk = std::make_shared<sim::link<packet>>(1);
+        e.register_component(*lk);
+        const int from = lk->next_peerid();
+        const int to = lk->next_peerid();
+        std::mutex mut;
+        uint64_t sum = 0;
+        lk->set_packet_callback(from, [](const packet&) {});
+        lk->set_packet_callback(to, [&mut, &sum](const packet& pkt) {
+            std::lock_guard<std::mutex> g(mut);
+            sum += pkt.value;
+        });
+        auto secs = run(e, count, steps, [&](const packet& pkt) {
+            lk->send_packet(from, pkt, e.current_step());
+        });
+        report("per-packet callback", count * steps, secs, sum);
+    }
+
+    template <typename Receiver>
+    void bench_node(const char* name, size_t count, size_t steps, bool join = false) {
+        sim::engine e(1, 1);
+        sender a(e);
+        Receiver b(e);
+        if(join) {
+            auto lk = std::make_shared<sim::link<packet>>(1);
+            e.register_component(*lk);
+            sim::node<packet>::join(a, b, lk);
+        } else {
+            a.connect(b, 1);
+        }
+        auto secs = run(e, count, steps, [&a](const packet& pkt) {
+            a.send_packet(pkt);
+        });
+        report(name, count * steps, secs, b.sum);
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000;
+    const size_t steps = argc > 2 ? strtoul(argv[2], nullptr, 10) : 200;
+    bench_callback(count, steps);
+    bench_node<per_packet>("node, packet_callback", count, steps);
+    bench_node<batched>("node, on_packets", count, steps);
+    bench_node<batched>("node, on_packets, join", count, steps, true);
+    return 0;
+}
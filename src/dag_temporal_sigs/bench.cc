@@ -0,0 +1,147 @@
+#include "payload.hh"
+#include "sim/scheduler.hh"
+#include "sim/sig.hh"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+
+//
+// dts micro-benchmarks.  run as `./dts-bench [txs] [sigs]`.
+//
+
+namespace {
+
+    using clock_type = std::chrono::steady_clock;
+
+    double seconds_since(clock_type::time_point start) {
+        return std::chrono::duration<double>(clock_type::now() - start).count();
+    }
+
+    void report(const char* name, size_t items, double secs) {
+        printf("%-24s %10zu items %9.3f ms %8.1f ns/item %12.0f items/s\n",
+               name, items, secs * 1e3, secs * 1e9 / items, items / secs);
+    }
+
+    void bench_payload(size_t count) {
+        std::mt19937_64 gen(1);
+        std::vector<std::vector<uint8_t>> payloads(count);
+        size_t ops = 0;
+        sim::sha256_t token;
+        for(auto& b : token) {
+            b = static_cast<uint8_t>(gen());
+        }
+
+        auto start = clock_type::now();
+        for(auto& p : payloads) {
+            token[0]++;
+            const int64_t amount = static_cast<int64_t>(gen());
+            dts::payload::append(p,
+                dts::payload::field(dts::op_t::Announce, "treasury@1a2b3c"),
+                dts::payload::field(dts::op_t::CreateToken, token),
+                dts::payload::field(dts::op_t::CreateToken, token),
+                dts::payload::field(dts::op_t::CreateToken, token),
+                dts::payload::field(dts::op_t::Spend, amount),
+                dts::payload::field(dts::op_t::Data, 0.5));
+            ops += 6;
+        }
+        report("payload encode", ops, seconds_since(start));
+
+        size_t bytes = 0;
+        int64_t sum = 0;
+        start = clock_type::now();
+        for(auto& p : payloads) {
+            bool ok = dts::payload::visit(p, [&sum, &bytes](const dts::payload::op_view& v) {
+                bytes += v.value.size();
+                if(v.type == dts::type_t::i64) {
+                    sum += v.as_i64();
+                }
+            });
+            if(!ok) {
+                printf("malformed payload\n");
+                exit(1);
+            }
+        }
+        report("payload decode+visit", ops, seconds_since(start));
+
+        start = clock_type::now();
+        size_t valid = 0;
+        for(auto& p : payloads) {
+            valid += dts::payload::validate(p);
+        }
+        report("payload validate (tx)", valid, seconds_since(start));
+        printf("  (%zu value bytes, checksum %" PRId64 ")\n", bytes, sum);
+    }
+
+    //
+    // sign count digests over a handful of keys, verify them one by one,
+    // then as a batch through sim::verifier on all cores, then again as
+    // if gossiped to receipts more nodes, which the cache answers.
+    void bench_sigs(size_t count, size_t receipts) {
+        std::mt19937_64 gen(2);
+        auto random_sha = [&gen] {
+            sim::sha256_t sha;
+            for(auto& b : sha) {
+                b = static_cast<uint8_t>(gen());
+            }
+            return sha;
+        };
+        std::vector<std::unique_ptr<sim::keypair>> keys;
+        for(int i = 0; i < 16; i++) {
+            keys.emplace_back(new sim::keypair(random_sha()));
+        }
+        std::vector<sim::verifier::request> batch(count);
+        for(auto& it : batch) {
+            it.digest = random_sha();
+        }
+
+        auto start = clock_type::now();
+        for(size_t i = 0; i < count; i++) {
+            auto& k = *keys[i % keys.size()];
+            batch[i].key = k.public_key();
+            batch[i].sig = k.sign(batch[i].digest);
+        }
+        report("ecdsa sign", count, seconds_since(start));
+
+        start = clock_type::now();
+        size_t valid = 0;
+        for(auto& it : batch) {
+            valid += sim::verify(it.key, it.digest, it.sig);
+        }
+        report("ecdsa verify", count, seconds_since(start));
+
+        sim::scheduler sched;
+        sim::verifier verifier(count * 2);
+        std::vector<uint8_t> ok;
+        start = clock_type::now();
+        verifier.check(batch, ok, sched);
+        report("verifier batch (cold)", count, seconds_since(start));
+
+        start = clock_type::now();
+        for(size_t r = 0; r < receipts; r++) {
+            verifier.check(batch, ok, sched);
+        }
+        report("verifier batch (cached)", count * receipts, seconds_since(start));
+
+        auto c = verifier.counters();
+        printf("  (%zu/%zu valid, %zu threads, %" PRIu64 " verified %" PRIu64 " cache hits)\n",
+               valid, count, sched.threads(), c.verified, c.hits);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t txs = 100000;
+    size_t sigs = 2000;
+    if(argc > 1) {
+        txs = std::strtoul(argv[1], 0, 10);
+    }
+    if(argc > 2) {
+        sigs = std::strtoul(argv[2], 0, 10);
+    }
+    bench_payload(txs);
+    bench_sigs(sigs, 8);
+    return 0;
+}
@@ -1,17 +1,27 @@
 #include "sim/dag.hh"
+#include "sim/dag_store.hh"
+#include "payload.hh"
+#include "sim/sig.hh"
 #include "sim/ui.hh"
 #include "sim/sim.hh"
+#include "sim/log.hh"
+#include "sim/topology.hh"
 
+#include <cstring>
+#include <deque>
 #include <sstream>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
 
-//const int numberNodes = 5;
+const int numberNodes = 5;
 //const int numberObservers = numberNodes / 5;
-//const int msPerStep = 50;
-//const int stepsPerSecond = 1000 / msPerStep;
-//const int stepsPer100ms = stepsPerSecond / 10;
-//const std::pair<int, int> stepsPerTxRange { stepsPer100ms * 10, stepsPer100ms * 25 };
-//const std::pair<int, int> latencyRange { stepsPer100ms, stepsPer100ms * 4 };
+const int msPerStep = 50;
+const int stepsPerSecond = 1000 / msPerStep;
+const int stepsPer100ms = stepsPerSecond / 10;
+const std::pair<int, int> stepsPerTxRange { stepsPer100ms * 10, stepsPer100ms * 25 };
+const std::pair<int, int> latencyRange { stepsPer100ms, stepsPer100ms * 4 };
 
 struct token {
     token() {};
@@ -24,20 +34,23 @@ struct token {
         key[1] = e.rand_int<uint64_t>(0, std::numeric_limits<uint64_t>::max());
         key[2] = e.rand_int<uint64_t>(0, std::numeric_limits<uint64_t>::max());
         key[3] = e.rand_int<uint64_t>(0, std::numeric_limits<uint64_t>::max());
+        sim::sha256_t seed;
+        std::memcpy(seed.data(), key, sizeof(key));
+        keys = std::make_shared<sim::keypair>(seed);
     }
     
 
-    uint64_t key[4]; // 256-bit key
+    uint64_t key[4]; // 256-bit key, the seed of keys
+    std::shared_ptr<const sim::keypair> keys;
     uint64_t time { std::numeric_limits<uint64_t>::max() };
     std::string alias;
-    sim::sha256_t hash;
-    sim::sha256_t recompute_hash() {
+    // derived from the fields above on every call, so it can't go stale.
+    sim::sha256_t hash() const {
         std::vector<uint8_t> d;
-        d.insert(d.end(), (uint8_t*)key, (uint8_t*)key+sizeof(key));
+        d.insert(d.end(), (const uint8_t*)key, (const uint8_t*)key+sizeof(key));
         d.insert(d.end(), alias.begin(), alias.end());
-        d.insert(d.end(), (uint8_t*)&time, (uint8_t*)&time+sizeof(time));
-        hash = sim::sha256(d.data(), d.size());
-        return hash;
+        d.insert(d.end(), (const uint8_t*)&time, (const uint8_t*)&time+sizeof(time));
+        return sim::sha256(d.data(), d.size());
     }
     std::string to_string() {
         std::stringstream ss;
@@ -49,75 +62,127 @@ struct token {
 };
 
 struct tx : public sim::tx {
-    sim::sha256_t sig;
-
-    enum class op_t : uint8_t {
-        Announce = 0,
-        CreateToken,
-        RevealToken,
-        Spend,
-        Code,
-        Data
-    };
-
-    enum class type_t : uint8_t {
-        i32,
-        i64,
-        f32,
-        f64,
-        str,
-        token
-    };
-
-    void recompute_hash() override {
-        sim::tx::recompute_hash();
-        std::vector<uint8_t> d;
-        d.insert(d.end(), sha.data(), sha.data()+sha.size());
-        d.insert(d.end(), sig.data(), sig.data()+sig.size());
-        sha = sim::sha256(d.data(), d.size());
+    using op_t = dts::op_t;
+    using type_t = dts::type_t;
+
+    const sim::signature_t& sig() const { return sig_; }
+    const sim::pubkey_t& signer() const { return signer_; }
+
+    //
+    // sign everything but the signature, the signer's key included.  sign
+    // after the last edit; any edit afterwards leaves the signature invalid.
+    void sign(const sim::keypair& keys) {
+        signer_ = keys.public_key();
+        sig_ = keys.sign(signed_hash());
+        invalidate();
+    }
+
+    sim::verifier::request verify_request() const {
+        return { signer_, signed_hash(), sig_ };
     }
 
     template <typename T>
     void addOp(op_t op, T& data) {
-
-        payload.push_back(static_cast<std::underlying_type<op_t>::type>(op));
-
-        if constexpr(std::is_integral<T>()) {
-            if constexpr(sizeof(T) == sizeof(int32_t)) {
-                payload.push_back(static_cast<std::underlying_type<type_t>::type>(type_t::i32));
-            } else {
-                payload.push_back(static_cast<std::underlying_type<type_t>::type>(type_t::i64));
-            }
-            payload.insert(payload.end(), (uint8_t*)&data, (uint8_t*)&data+sizeof(data));
-        } else if constexpr(std::is_floating_point<T>()) {
-            if constexpr(sizeof(T) == sizeof(float)) {
-                payload.push_back(static_cast<std::underlying_type<type_t>::type>(type_t::f32));
-            } else {
-                payload.push_back(static_cast<std::underlying_type<type_t>::type>(type_t::f64));
-            }
-            payload.insert(payload.end(), (uint8_t*)&data, (uint8_t*)&data+sizeof(data));
-        } else if constexpr(std::is_same<T, std::string>()) {
-            payload.push_back(static_cast<std::underlying_type<type_t>::type>(type_t::str));
-            uint16_t size = static_cast<uint16_t>(data.size());
-            payload.insert(payload.end(), (uint8_t*)&size, (uint8_t*)&size+sizeof(size));
-            payload.insert(payload.end(), data.begin(), data.end());
-        } else if constexpr(std::is_same<T, token>()) {
-            payload.push_back(static_cast<std::underlying_type<type_t>::type>(type_t::token));
-            data.recompute_hash();
-            payload.insert(payload.end(), data.hash.data(), data.hash.data()+data.hash.size());
+        if constexpr(std::is_same<T, token>()) {
+            const auto hash = data.hash();
+            edit_payload([&](std::vector<uint8_t>& p) { dts::payload::append(p, op, hash); });
         } else {
-            static_assert("unsupported");
+            edit_payload([&](std::vector<uint8_t>& p) { dts::payload::append(p, op, data); });
         }
     }
+
+    sim::sha256_t signed_hash() const {
+        auto sha = sim::tx::compute_hash();
+        std::vector<uint8_t> d;
+        d.insert(d.end(), sha.data(), sha.data()+sha.size());
+        d.insert(d.end(), signer_.data(), signer_.data()+signer_.size());
+        return sim::sha256(d.data(), d.size());
+    }
+
+protected:
+    sim::sha256_t compute_hash() const override {
+        auto sha = signed_hash();
+        std::vector<uint8_t> d;
+        d.insert(d.end(), sha.data(), sha.data()+sha.size());
+        d.insert(d.end(), sig_.data(), sig_.data()+sig_.size());
+        return sim::sha256(d.data(), d.size());
+    }
+
+private:
+    sim::pubkey_t signer_ {};
+    sim::signature_t sig_ {};
 };
 
 struct packet {
-
+    std::shared_ptr<const tx> txn;
 };
 
+//
+// issues a signed tx every txsteps steps onto the shared ledger and gossips
+// it; checks the signature of every tx it hears of before passing it on.
+// the verifier is shared, so each tx is verified by the first node to hear
+// of it and found in the cache by the rest.
+//
 struct node : public sim::node<packet>, public sim::component {
+    node(sim::engine& e, sim::verifier& verifier, sim::dag_store<tx>& ledger, std::mutex& ledger_mut,
+         std::string alias, int txsteps)
+    : sim::node<packet>(e)
+    , alias(std::move(alias))
+    , verifier(verifier)
+    , ledger(ledger)
+    , ledger_mut(ledger_mut)
+    , identity(e)
+    , txsteps(txsteps) {}
+
+    void step() override {
+        if(current_step_ - last_txstep <= txsteps) {
+            return;
+        }
+        last_txstep = current_step_;
+        auto t = std::make_shared<tx>();
+        auto name = alias + "#" + std::to_string(issued++);
+        t->addOp(tx::op_t::Announce, name);
+        {
+            std::lock_guard<std::mutex> lk(ledger_mut);
+            auto rand01 = [this] { return engine_.rand_real<double>(0, 1); };
+            auto tips = ledger.select_tips(0.0, 8, rand01);
+            t->set_trunk(ledger.at(tips.first).txn->hash());
+            t->set_branch(ledger.at(tips.second).txn->hash());
+            t->sign(*identity.keys);
+            ledger.attach(t);
+        }
+        std::lock_guard<std::mutex> lk(mut);
+        seen.insert(t->hash());
+        send_packet(packet { t });
+    }
+
+    void on_packets(const sim::link<packet>&, sim::span<const packet> pkts) override {
+        std::lock_guard<std::mutex> lk(mut);
+        for(auto& it : pkts) {
+            if(!seen.insert(it.txn->hash()).second) {
+                continue;
+            }
+            if(!verifier.check(it.txn->verify_request())) {
+                rejected++;
+                continue;
+            }
+            accepted++;
+            send_packet(it);
+        }
+    }
 
     std::string alias;
+    sim::verifier& verifier;
+    sim::dag_store<tx>& ledger;
+    std::mutex& ledger_mut;
+    const token identity;
+    const int txsteps;
+    std::mutex mut;
+    std::unordered_set<sim::sha256_t, sim::sha256_hash> seen;
+    int64_t last_txstep {0};
+    uint64_t issued {0};
+    uint64_t accepted {0};
+    uint64_t rejected {0};
 };
 
 int main(int argc, char* argv[]) {
@@ -128,6 +193,11 @@ int main(int argc, char* argv[]) {
     }
     sim::engine engine(seed);
     std::atomic<bool> run {true};
+    sim::dag_store<tx> ledger;
+    std::mutex ledger_mut;
+    // one per process, so a tx is verified once however many receive it.
+    sim::verifier verifier;
+    std::deque<node> nodes;
 
     {
         sim::ui ui {};
@@ -141,9 +211,8 @@ int main(int argc, char* argv[]) {
             t.time = 2;
             g0->addOp(tx::op_t::Announce, "treasury");
             g0->addOp(tx::op_t::CreateToken, t);
-            g0->sig = t.hash;
-            g0->recompute_hash();
-            std::string identity = "treasury@" + sim::sha_shortcode(g0->sha);
+            g0->sign(*t.keys);
+            std::string identity = "treasury@" + sim::sha_shortcode(g0->hash());
             ui.log(t.to_string());
             ui.log("ident: " + identity);
             for(int i = 0 ; i < 3 ; i++) {
@@ -152,12 +221,30 @@ int main(int argc, char* argv[]) {
                 g1->addOp(tx::op_t::CreateToken, tx);
                 ui.log(tx.to_string());
             }
-            g1->sig = t.hash;
-            g1->trunk = g0->sha;
-            g1->recompute_hash();
-            ui.log("g1:" + sim::sha_shortcode(g0->sha) + " <- " + sim::sha_shortcode(g1->sha));
+            g1->set_trunk(g0->hash());
+            g1->sign(*t.keys);
+            ui.log("g1:" + sim::sha_shortcode(g0->hash()) + " <- " + sim::sha_shortcode(g1->hash()));
+            std::vector<sim::verifier::request> batch { g0->verify_request(), g1->verify_request() };
+            std::vector<uint8_t> ok;
+            verifier.check(batch, ok, engine);
+            if(!ok[0] || !ok[1]) {
+                ui.log("genesis signatures don't verify");
+            }
+            ledger.attach(g0);
+            ledger.attach(g1);
+            ui.log("ledger: " + std::to_string(ledger.size()) + " txs, " + std::to_string(ledger.tips().size()) + " tips");
         }
 
+        for(int i = 0; i < numberNodes; i++) {
+            nodes.emplace_back(engine, verifier, ledger, ledger_mut, "node" + std::to_string(i),
+                               engine.rand_int<>(stepsPerTxRange.first, stepsPerTxRange.second));
+            engine.register_component(nodes.back());
+        }
+        auto topology = sim::topology::random_regular(numberNodes, 2, seed, latencyRange);
+        sim::connect<packet>(engine, topology, [&nodes](uint32_t i) -> node& {
+            return nodes[i];
+        });
+
         std::thread t([&]() {
             auto next_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
             int i = 0;
@@ -180,5 +267,14 @@ int main(int argc, char* argv[]) {
         t.join();
     }
 
+    uint64_t issued = 0, accepted = 0, rejected = 0;
+    for(auto& it : nodes) {
+        issued += it.issued;
+        accepted += it.accepted;
+        rejected += it.rejected;
+    }
+    auto c = verifier.counters();
+    sim::log().info("txs: {} issued, {} receipts accepted, {} rejected; signatures: {} checks, {} verified, {} from the cache",
+                    issued, accepted, rejected, c.requests, c.verified, c.hits);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,305 @@
+#ifndef DTS_PAYLOAD_HH
+#define DTS_PAYLOAD_HH
+
+#include "sim/sha.hh"
+#include "sim/span.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+//
+// dts tx payload codec.
+//
+// a payload is a sequence of ops, each encoded as
+//
+//   [op_t : u8][type_t : u8][value]
+//
+// where value is 4 bytes (i32, f32), 8 bytes (i64, f64), a varint length
+// (leb128, 7 bits a byte, low first) followed by that many bytes (str) or
+// a 32-byte token hash (token).  other multi-byte values are in host order.
+//
+// this is a wire format change from the old tx::addOp: strings carried a
+// u16 host-order length, which truncated anything from 64 KiB up, and a
+// string literal (addOp(op, "treasury")) wrote the op byte and nothing
+// else.  literals are now encoded like any other string, so such txs are
+// longer and hash differently.
+//
+// encoding computes the final size first and writes each op in one pass;
+// decoding walks a span of the payload in place, checking bounds and enum
+// ranges as it goes, and never allocates.
+//
+namespace dts {
+
+    enum class op_t : uint8_t {
+        Announce = 0,
+        CreateToken,
+        RevealToken,
+        Spend,
+        Code,
+        Data
+    };
+
+    enum class type_t : uint8_t {
+        i32,
+        i64,
+        f32,
+        f64,
+        str,
+        token
+    };
+
+    namespace payload {
+
+        constexpr size_t header_size = 2;
+        constexpr size_t max_varint = 10; // bytes for a 64-bit length
+
+        inline size_t varint_size(uint64_t v) {
+            size_t n = 1;
+            while(v >= 0x80) {
+                v >>= 7;
+                n++;
+            }
+            return n;
+        }
+
+        inline uint8_t* put_varint(uint8_t* out, uint64_t v) {
+            while(v >= 0x80) {
+                *out++ = static_cast<uint8_t>(v | 0x80);
+                v >>= 7;
+            }
+            *out++ = static_cast<uint8_t>(v);
+            return out;
+        }
+
+        //
+        // read a varint from data at pos, advancing pos.  false if it runs
+        // past the end or doesn't fit 64 bits.
+        inline bool get_varint(sim::span<const uint8_t> data, size_t& pos, uint64_t& v) {
+            v = 0;
+            for(size_t i = 0; i < max_varint; i++) {
+                if(pos == data.size()) {
+                    return false;
+                }
+                const uint8_t b = data[pos++];
+                if(i == max_varint - 1 && b > 1) {
+                    return false;
+                }
+                v |= uint64_t(b & 0x7f) << (7 * i);
+                if(!(b & 0x80)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //
+        // encoded size of a value, excluding the op/type header.
+        template <typename T>
+        size_t value_size(const T& v) {
+            if constexpr(std::is_integral<T>()) {
+                return sizeof(T) <= sizeof(int32_t) ? sizeof(int32_t) : sizeof(int64_t);
+            } else if constexpr(std::is_floating_point<T>()) {
+                return sizeof(T) <= sizeof(float) ? sizeof(float) : sizeof(double);
+            } else if constexpr(std::is_same<T, sim::sha256_t>()) {
+                return sizeof(sim::sha256_t);
+            } else {
+                static_assert(std::is_convertible<const T&, std::string_view>(), "unsupported payload value");
+                const size_t size = std::string_view(v).size();
+                return varint_size(size) + size;
+            }
+        }
+
+        template <typename T>
+        size_t encoded_size(const T& v) {
+            return header_size + value_size(v);
+        }
+
+        //
+        // write one op at out, which must have encoded_size(v) bytes available.
+        // returns the end of the written op.
+        template <typename T>
+        uint8_t* encode(uint8_t* out, op_t op, const T& v) {
+            auto put = [&out](const void* p, size_t n) {
+                std::memcpy(out, p, n);
+                out += n;
+            };
+            auto tag = [&out](type_t t) {
+                *out++ = static_cast<uint8_t>(t);
+            };
+            *out++ = static_cast<uint8_t>(op);
+            if constexpr(std::is_integral<T>()) {
+                if constexpr(sizeof(T) <= sizeof(int32_t)) {
+                    const int32_t x = static_cast<int32_t>(v);
+                    tag(type_t::i32);
+                    put(&x, sizeof(x));
+                } else {
+                    const int64_t x = static_cast<int64_t>(v);
+                    tag(type_t::i64);
+                    put(&x, sizeof(x));
+                }
+            } else if constexpr(std::is_floating_point<T>()) {
+                if constexpr(sizeof(T) <= sizeof(float)) {
+                    const float x = static_cast<float>(v);
+                    tag(type_t::f32);
+                    put(&x, sizeof(x));
+                } else {
+                    const double x = static_cast<double>(v);
+                    tag(type_t::f64);
+                    put(&x, sizeof(x));
+                }
+            } else if constexpr(std::is_same<T, sim::sha256_t>()) {
+                tag(type_t::token);
+                put(v.data(), v.size());
+            } else {
+                const std::string_view s(v);
+                tag(type_t::str);
+                out = put_varint(out, s.size());
+                put(s.data(), s.size());
+            }
+            return out;
+        }
+
+        //
+        // append one op to a payload with a single resize.
+        template <typename T>
+        void append(std::vector<uint8_t>& payload, op_t op, const T& v) {
+            const size_t at = payload.size();
+            payload.resize(at + encoded_size(v));
+            encode(payload.data() + at, op, v);
+        }
+
+        //
+        // several ops appended with one resize, e.g.
+        //   append(payload, field(op_t::Announce, name), field(op_t::CreateToken, hash));
+        template <typename T>
+        struct field_ref {
+            op_t op;
+            const T& value;
+        };
+
+        template <typename T>
+        field_ref<T> field(op_t op, const T& value) {
+            return { op, value };
+        }
+
+        template <typename... Ts>
+        void append(std::vector<uint8_t>& payload, const field_ref<Ts>&... fields) {
+            const size_t at = payload.size();
+            payload.resize(at + (encoded_size(fields.value) + ... + 0));
+            uint8_t* out = payload.data() + at;
+            ((out = encode(out, fields.op, fields.value)), ...);
+        }
+
+        //
+        // decoded op, pointing into the payload it was read from.
+        struct op_view {
+            op_t op;
+            type_t type;
+            sim::span<const uint8_t> value;
+
+            int32_t as_i32() const { return load<int32_t>(); }
+            int64_t as_i64() const { return load<int64_t>(); }
+            float as_f32() const { return load<float>(); }
+            double as_f64() const { return load<double>(); }
+            std::string_view as_str() const {
+                return std::string_view(reinterpret_cast<const char*>(value.data()), value.size());
+            }
+            sim::sha256_t as_token() const { return load<sim::sha256_t>(); }
+
+        private:
+            template <typename T>
+            T load() const {
+                T x;
+                std::memcpy(&x, value.data(), sizeof(T));
+                return x;
+            }
+        };
+
+        //
+        // forward reader over a payload.  next() yields one op at a time and
+        // returns false at the end or at the first malformed op, after which
+        // ok() tells the two apart.
+        struct reader {
+            reader(sim::span<const uint8_t> data) : data_(data) {};
+
+            bool next(op_view& out) {
+                if(pos_ == data_.size() || !ok_) {
+                    return false;
+                }
+                ok_ = false;
+                if(data_.size() - pos_ < header_size) {
+                    return false;
+                }
+                const uint8_t op = data_[pos_];
+                const uint8_t type = data_[pos_ + 1];
+                if(op > static_cast<uint8_t>(op_t::Data) || type > static_cast<uint8_t>(type_t::token)) {
+                    return false;
+                }
+                size_t at = pos_ + header_size;
+                size_t size = 0;
+                switch(static_cast<type_t>(type)) {
+                    case type_t::i32:
+                    case type_t::f32:
+                        size = 4;
+                        break;
+                    case type_t::i64:
+                    case type_t::f64:
+                        size = 8;
+                        break;
+                    case type_t::token:
+                        size = sizeof(sim::sha256_t);
+                        break;
+                    case type_t::str: {
+                        uint64_t len;
+                        if(!get_varint(data_, at, len) || len > data_.size() - at) {
+                            return false;
+                        }
+                        size = size_t(len);
+                        break;
+                    }
+                }
+                if(data_.size() - at < size) {
+                    return false;
+                }
+                out.op = static_cast<op_t>(op);
+                out.type = static_cast<type_t>(type);
+                out.value = data_.subspan(at, size);
+                pos_ = at + size;
+                ok_ = true;
+                return true;
+            }
+
+            bool ok() const { return ok_; }
+            bool done() const { return ok_ && pos_ == data_.size(); }
+
+        private:
+            sim::span<const uint8_t> data_;
+            size_t pos_ {0};
+            bool ok_ {true};
+        };
+
+        //
+        // call f(const op_view&) for each op.  returns false if the payload is
+        // malformed; ops before the fault will already have been visited.
+        template <typename F>
+        bool visit(sim::span<const uint8_t> data, F&& f) {
+            reader r(data);
+            op_view v;
+            while(r.next(v)) {
+                f(v);
+            }
+            return r.ok();
+        }
+
+        inline bool validate(sim::span<const uint8_t> data) {
+            return visit(data, [](const op_view&) {});
+        }
+    }
+}
+
+#endif /* DTS_PAYLOAD_HH */
@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <system_error>
+
+extern "C" {
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+}
+
+#include "sim/block_store.hh"
+
+namespace sim {
+
+    //
+    // record layout: prev_block, merkle, sha, u32 tx count, then
+    // (pubkey, sha) per tx.  host byte order, the file never outlives the
+    // machine that wrote it.
+    //
+    namespace {
+        const size_t record_header_size = 3 * sizeof(sha256_t) + sizeof(uint32_t);
+        const size_t record_tx_size = 2 * sizeof(sha256_t);
+
+        bool write_all(int fd, const uint8_t* data, size_t size, uint64_t offset) {
+            while(size > 0) {
+                auto n = ::pwrite(fd, data, size, off_t(offset));
+                if(n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if(n <= 0) {
+                    return false;
+                }
+                data += n;
+                size -= size_t(n);
+                offset += uint64_t(n);
+            }
+            return true;
+        }
+    }
+
+    //
+    // a backing file and its end, up to which extents have been handed out.
+    // the end only moves under the lock; records are written with pwrite
+    // into extents no other store touches.
+    //
+    struct block_store::file {
+        file(const std::string& path, bool unlink_after) {
+            if(unlink_after) {
+                std::vector<char> name(path.begin(), path.end());
+                name.push_back('\0');
+                fd = ::mkstemp(name.data());
+                if(fd >= 0) {
+                    ::unlink(name.data());
+                }
+            } else {
+                fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            }
+            if(fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "block_store: " + path);
+            }
+        }
+        ~file() {
+            ::close(fd);
+        }
+
+        //
+        // the offset of a new extent of size bytes.  the file is extended
+        // over it, sparsely, so the whole extent can be mapped at once.
+        uint64_t extend(uint64_t size) {
+            std::lock_guard<std::mutex> lk(mut);
+            const uint64_t at = end;
+            if(::ftruncate(fd, off_t(at + size)) != 0) {
+                throw std::system_error(errno, std::generic_category(), "block_store: extend");
+            }
+            end += size;
+            return at;
+        }
+
+        //
+        // the process-wide file behind default-constructed stores, made on
+        // first use and closed with the last store on it.
+        static std::shared_ptr<file> shared() {
+            static std::mutex mut;
+            static std::weak_ptr<file> current;
+            std::lock_guard<std::mutex> lk(mut);
+            auto f = current.lock();
+            if(!f) {
+                const char* dir = std::getenv("TMPDIR");
+                f = std::make_shared<file>(std::string(dir && *dir ? dir : "/tmp") + "/dlt-sim-blocks-XXXXXX", true);
+                current = f;
+            }
+            return f;
+        }
+
+        int fd {-1};
+        std::mutex mut;
+        uint64_t end {0};
+    };
+
+    block_store::block_store(size_t resident)
+    : file_(file::shared())
+    , window_(resident) {}
+
+    block_store::block_store(const std::string& path, size_t resident)
+    : file_(std::make_shared<file>(path, false))
+    , window_(resident) {}
+
+    block_store::~block_store() {
+        for(auto& it : extents_) {
+            if(it.map) {
+                ::munmap(it.map, it.size);
+            }
+#ifdef FALLOC_FL_PUNCH_HOLE
+            // give the blocks back; the file itself stays as long as it is.
+            ::fallocate(file_->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off_t(it.offset), off_t(it.size));
+#endif
+        }
+    }
+
+    uint64_t
+    block_store::reserved_bytes() const {
+        uint64_t total = 0;
+        for(auto& it : extents_) {
+            total += it.size;
+        }
+        return total;
+    }
+
+    //
+    // room for a record of size bytes: at the end of the last extent, or in
+    // a new one twice its size.  returns the record's offset in the file.
+    uint64_t
+    block_store::reserve(size_t bytes) {
+        if(extents_.empty() || extents_.back().size - extents_.back().used < bytes) {
+            const size_t page = size_t(::sysconf(_SC_PAGESIZE));
+            uint64_t size = extents_.empty() ? min_extent : std::min(extents_.back().size * 2, max_extent);
+            size = std::max<uint64_t>(size, (bytes + page - 1) / page * page);
+            extents_.push_back({ file_->extend(size), size });
+        }
+        auto& e = extents_.back();
+        const uint64_t at = e.offset + e.used;
+        e.used += bytes;
+        return at;
+    }
+
+    void
+    block_store::append(std::shared_ptr<block> b) {
+        std::vector<uint8_t> rec(record_header_size + record_tx_size * b->txs().size());
+        uint8_t* p = rec.data();
+        const uint32_t count = uint32_t(b->txs().size());
+        const sha256_t sha = b->hash();
+        const sha256_t merkle = b->merkle();
+        std::memcpy(p, b->prev_block().data(), sizeof(sha256_t)); p += sizeof(sha256_t);
+        std::memcpy(p, merkle.data(), sizeof(sha256_t)); p += sizeof(sha256_t);
+        std::memcpy(p, sha.data(), sizeof(sha256_t)); p += sizeof(sha256_t);
+        std::memcpy(p, &count, sizeof(count)); p += sizeof(count);
+        for(auto& t : b->txs()) {
+            const sha256_t tsha = t->hash();
+            std::memcpy(p, t->pubkey().data(), sizeof(sha256_t)); p += sizeof(sha256_t);
+            std::memcpy(p, tsha.data(), sizeof(sha256_t)); p += sizeof(sha256_t);
+        }
+        const uint64_t offset = reserve(rec.size());
+        if(!write_all(file_->fd, rec.data(), rec.size(), offset)) {
+            throw std::system_error(errno, std::generic_category(), "block_store: write");
+        }
+
+        index_.emplace(sha, headers_.size());
+        headers_.push_back({ sha, b->prev_block(), merkle, count, offset });
+        file_size_ += rec.size();
+
+        index_txs(*b, 1);
+        resident_.push_back(std::move(b));
+        while(resident_.size() > window_) {
+            index_txs(*resident_.front(), -1);
+            resident_.pop_front();
+        }
+    }
+
+    bool
+    block_store::contains(const sha256_t& sha) const {
+        return index_.find(sha) != index_.end();
+    }
+
+    int64_t
+    block_store::height_of(const sha256_t& sha) const {
+        auto it = index_.find(sha);
+        return it == index_.end() ? -1 : int64_t(it->second);
+    }
+
+    std::shared_ptr<block>
+    block_store::get(size_t height) {
+        if(height >= headers_.size()) {
+            return nullptr;
+        }
+        const size_t first_resident = headers_.size() - resident_.size();
+        if(height >= first_resident) {
+            return resident_[height - first_resident];
+        }
+        return read(headers_[height]);
+    }
+
+    std::shared_ptr<block>
+    block_store::get(const sha256_t& sha) {
+        auto it = index_.find(sha);
+        if(it == index_.end()) {
+            return nullptr;
+        }
+        return get(it->second);
+    }
+
+    bool
+    block_store::has_tx(const sha256_t& sha) const {
+        return resident_txs_.find(sha) != resident_txs_.end();
+    }
+
+    std::shared_ptr<block>
+    block_store::read(const header& h) {
+        const size_t size = record_header_size + record_tx_size * h.txs;
+        // extents are in file order; find the last one starting at or
+        // before the record.
+        auto e = std::upper_bound(extents_.begin(), extents_.end(), h.offset, [](uint64_t off, const extent& x) {
+            return off < x.offset;
+        });
+        if(e == extents_.begin()) {
+            return nullptr;
+        }
+        --e;
+        if(!e->map) {
+            void* m = ::mmap(nullptr, e->size, PROT_READ, MAP_SHARED, file_->fd, off_t(e->offset));
+            if(m == MAP_FAILED) {
+                return nullptr;
+            }
+            e->map = static_cast<uint8_t*>(m);
+        }
+        reads_++;
+
+        const uint64_t at = h.offset - e->offset;
+        const uint8_t* p = e->map + at + record_header_size;
+        std::vector<block::tx_ptr> txs;
+        txs.reserve(h.txs);
+        for(uint32_t i = 0; i < h.txs; i++) {
+            sha256_t pubkey, sha;
+            std::memcpy(pubkey.data(), p, sizeof(sha256_t)); p += sizeof(sha256_t);
+            std::memcpy(sha.data(), p, sizeof(sha256_t)); p += sizeof(sha256_t);
+            txs.push_back(make_tagged<tx, memory::tx>(pubkey, sha));
+        }
+        auto b = make_tagged<block, memory::chain>(h.prev_block, h.merkle, h.sha, std::move(txs));
+
+        // the copy is all the caller gets; let the pages go so pruned
+        // bodies don't creep back into the resident set.
+        const size_t page = size_t(::sysconf(_SC_PAGESIZE));
+        const size_t begin = at & ~(page - 1);
+        ::madvise(e->map + begin, at + size - begin, MADV_DONTNEED);
+        return b;
+    }
+
+    void
+    block_store::index_txs(const block& b, int delta) {
+        for(auto& t : b.txs()) {
+            auto sha = t->hash();
+            if(delta > 0) {
+                resident_txs_[sha]++;
+            } else {
+                auto it = resident_txs_.find(sha);
+                if(it != resident_txs_.end() && --it->second == 0) {
+                    resident_txs_.erase(it);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+
+#include "sim/crowd.hh"
+
+namespace sim {
+
+    delay_model
+    delay_model::from_topology(const topology& t, size_t sources, uint64_t seed, int64_t per_hop) {
+        delay_model m;
+        if(t.nodes == 0) {
+            return m;
+        }
+        std::mt19937_64 gen(seed);
+        std::uniform_int_distribution<uint32_t> pick(0, t.nodes - 1);
+        std::vector<int64_t> dist;
+        using entry = std::pair<int64_t, uint32_t>;
+        for(size_t s = 0; s < sources; s++) {
+            const uint32_t src = pick(gen);
+            dist.assign(t.nodes, std::numeric_limits<int64_t>::max());
+            std::priority_queue<entry, std::vector<entry>, std::greater<entry>> queue;
+            dist[src] = 0;
+            queue.push({ 0, src });
+            while(!queue.empty()) {
+                auto [d, u] = queue.top();
+                queue.pop();
+                if(d > dist[u]) {
+                    continue;
+                }
+                for(uint32_t i = t.offsets[u]; i < t.offsets[u + 1]; i++) {
+                    const uint32_t v = t.neighbors[i];
+                    const int64_t nd = d + t.latencies[i] + per_hop;
+                    if(nd < dist[v]) {
+                        dist[v] = nd;
+                        queue.push({ nd, v });
+                    }
+                }
+            }
+            for(uint32_t v = 0; v < t.nodes; v++) {
+                if(v != src && dist[v] != std::numeric_limits<int64_t>::max()) {
+                    m.record(dist[v]);
+                }
+            }
+        }
+        return m;
+    }
+
+    void
+    delay_model::record(int64_t delay, uint64_t count) {
+        const size_t d = size_t(std::max<int64_t>(1, delay));
+        if(d >= histogram_.size()) {
+            histogram_.resize(d + 1, 0);
+        }
+        histogram_[d] += count;
+        total_ += count;
+    }
+
+    int64_t
+    delay_model::sample(std::mt19937_64& gen) const {
+        if(total_ == 0) {
+            return 1;
+        }
+        uint64_t r = std::uniform_int_distribution<uint64_t>(0, total_ - 1)(gen);
+        for(size_t d = 0; d < histogram_.size(); d++) {
+            if(r < histogram_[d]) {
+                return int64_t(d);
+            }
+            r -= histogram_[d];
+        }
+        return max();
+    }
+
+    int64_t
+    delay_model::quantile(double q) const {
+        if(total_ == 0) {
+            return 1;
+        }
+        const uint64_t target = uint64_t(std::clamp(q, 0.0, 1.0) * double(total_ - 1));
+        uint64_t seen = 0;
+        for(size_t d = 0; d < histogram_.size(); d++) {
+            seen += histogram_[d];
+            if(seen > target) {
+                return int64_t(d);
+            }
+        }
+        return max();
+    }
+
+    double
+    delay_model::mean() const {
+        if(total_ == 0) {
+            return 1;
+        }
+        double sum = 0;
+        for(size_t d = 0; d < histogram_.size(); d++) {
+            sum += double(d) * double(histogram_[d]);
+        }
+        return sum / double(total_);
+    }
+
+    namespace {
+        size_t plurality(span<const uint64_t> seen) {
+            return size_t(std::max_element(seen.begin(), seen.end()) - seen.begin());
+        }
+    }
+
+    std::vector<uint64_t>
+    vote_model::votes(span<const uint64_t> seen, uint64_t members, std::mt19937_64& gen) const {
+        std::vector<uint64_t> res(seen.size(), 0);
+        uint64_t weight = 0;
+        for(auto s : seen) {
+            weight += s;
+        }
+        if(weight == 0) {
+            return res;
+        }
+        uint64_t voters = std::binomial_distribution<uint64_t>(members, std::clamp(participation, 0.0, 1.0))(gen);
+        const uint64_t followers = std::binomial_distribution<uint64_t>(voters, std::clamp(follow, 0.0, 1.0))(gen);
+        res[plurality(seen)] += followers;
+        voters -= followers;
+        // the rest as a multinomial, one binomial per option.
+        for(size_t i = 0; i < seen.size() && voters > 0; i++) {
+            const uint64_t k = i + 1 == seen.size() ? voters
+                : std::binomial_distribution<uint64_t>(voters, double(seen[i]) / double(weight))(gen);
+            res[i] += k;
+            voters -= k;
+            weight -= seen[i];
+            if(weight == 0) {
+                break;
+            }
+        }
+        return res;
+    }
+
+    void
+    vote_model::observe(span<const uint64_t> seen, span<const uint64_t> votes, uint64_t members) {
+        uint64_t weight = 0, total = 0;
+        for(auto s : seen) {
+            weight += s;
+        }
+        for(auto v : votes) {
+            total += v;
+        }
+        if(weight == 0 || members == 0 || votes.size() != seen.size()) {
+            return;
+        }
+        const size_t top = plurality(seen);
+        members_ += double(members);
+        voters_ += double(total);
+        plurality_ += double(votes[top]);
+        expected_ += double(total) * double(seen[top]) / double(weight);
+
+        participation = voters_ / members_;
+        // votes for the plurality = follow * voters + (1 - follow) * expected.
+        follow = voters_ > expected_ ? std::clamp((plurality_ - expected_) / (voters_ - expected_), 0.0, 1.0) : 1.0;
+    }
+}
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+
+#include "sim/memory.hh"
+
+namespace sim {
+
+    namespace {
+        std::mutex shards_mut;
+    }
+
+    //
+    // shards outlive their threads so that what a finished thread
+    // allocated stays counted.
+    std::vector<std::unique_ptr<memory::shard>>&
+    memory::shards() {
+        static std::vector<std::unique_ptr<shard>> all;
+        return all;
+    }
+
+    const char*
+    memory::name(tag t) {
+        static const char* names[tag_count] = { "link", "node", "chain", "tx", "log" };
+        return t < tag_count ? names[t] : "?";
+    }
+
+    memory::shard*
+    memory::attach() {
+        std::lock_guard<std::mutex> lk(shards_mut);
+        shards().emplace_back(new shard);
+        return shards().back().get();
+    }
+
+    memory::totals
+    memory::total(tag t) {
+        totals tot;
+        std::lock_guard<std::mutex> lk(shards_mut);
+        for(auto& s : shards()) {
+            tot.live += s->live[t].load(std::memory_order_relaxed);
+            tot.allocated += s->allocated[t].load(std::memory_order_relaxed);
+            tot.allocs += s->allocs[t].load(std::memory_order_relaxed);
+        }
+        return tot;
+    }
+
+    memory::meter::meter() {
+        enable();
+        for(int t = 0; t < tag_count; t++) {
+            base_[t] = total(tag(t));
+            usage_[t].live = usage_[t].peak = base_[t].live;
+        }
+    }
+
+    void
+    memory::meter::sample() {
+        steps_++;
+        for(int t = 0; t < tag_count; t++) {
+            auto tot = total(tag(t));
+            auto& u = usage_[t];
+            const uint64_t allocated = tot.allocated - base_[t].allocated;
+            u.last_step = allocated - u.allocated;
+            u.allocated = allocated;
+            u.allocs = tot.allocs - base_[t].allocs;
+            u.live = tot.live;
+            u.peak = std::max(u.peak, u.live);
+        }
+    }
+
+    void
+    memory::meter::report(std::ostream& os) const {
+        const double steps = double(std::max<uint64_t>(1, steps_));
+        os << "memory: " << steps_ << " steps (per step: averaged over the run; last: the final step)\n";
+        os << std::left << std::setw(8) << "tag" << std::right
+           << std::setw(16) << "live" << std::setw(16) << "peak"
+           << std::setw(16) << "bytes/step" << std::setw(16) << "allocs/step"
+           << std::setw(16) << "bytes last" << "\n";
+        for(int t = 0; t < tag_count; t++) {
+            auto& u = usage_[t];
+            os << std::left << std::setw(8) << name(tag(t)) << std::right
+               << std::setw(16) << u.live << std::setw(16) << u.peak
+               << std::setw(16) << std::fixed << std::setprecision(0) << u.allocated / steps
+               << std::setw(16) << std::setprecision(1) << u.allocs / steps
+               << std::setw(16) << u.last_step << "\n";
+        }
+    }
+}
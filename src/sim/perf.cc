@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+
+#include <cxxabi.h>
+
+#ifdef __linux__
+extern "C" {
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+}
+#endif
+
+#include "sim/perf.hh"
+
+namespace sim {
+
+    namespace {
+        const char* counter_names[profiler::counter_count] = {
+            "cycles", "instructions", "llc-misses", "branch-misses", "wall-ns"
+        };
+
+        std::atomic<uint64_t> next_generation {1};
+
+#ifdef __linux__
+        const uint64_t counter_configs[profiler::wall_ns] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        //
+        // user-space only, counting this thread on whichever cpu it runs.
+        // with group_fd -1 the counter leads a group that reads as one.
+        int open_counter(profiler::counter c, int group_fd = -1) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = counter_configs[c];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            return int(::syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+        }
+#endif
+    }
+
+    struct profiler::shard {
+        std::mutex mut;
+        std::map<std::string, totals> frames;
+    };
+
+    //
+    // per thread: the bound profiler, this thread's shard of it, the
+    // counters and the current frame path.  the counters that open form
+    // one group, so a sample is a single read(); members[i] is the
+    // counter in the i-th slot of what it returns.
+    struct profiler::thread_state {
+        profiler* bound {nullptr};
+        uint64_t generation {0};
+        shard* sh {nullptr};
+        int fds[wall_ns] {-1, -1, -1, -1};
+        counter members[wall_ns] {};
+        size_t count {0};
+        bool opened {false};
+        std::string path;
+
+        ~thread_state() {
+#ifdef __linux__
+            for(auto fd : fds) {
+                if(fd >= 0) {
+                    ::close(fd);
+                }
+            }
+#endif
+        }
+
+        void open() {
+#ifdef __linux__
+            int leader = -1;
+            for(int c = 0; c < wall_ns; c++) {
+                const int fd = open_counter(counter(c), leader);
+                if(fd < 0) {
+                    continue;
+                }
+                if(leader < 0) {
+                    leader = fd;
+                }
+                fds[c] = fd;
+                members[count++] = counter(c);
+            }
+#endif
+            opened = true;
+        }
+
+        void read(sample& s) {
+#ifdef __linux__
+            if(!opened) {
+                open();
+            }
+            if(count > 0) {
+                // { nr, value[nr] }, in the order the members joined.
+                uint64_t buf[1 + wall_ns];
+                const ssize_t want = ssize_t(sizeof(uint64_t) * (1 + count));
+                if(::read(fds[members[0]], buf, size_t(want)) == want && buf[0] == count) {
+                    for(size_t i = 0; i < count; i++) {
+                        s.v[members[i]] = buf[1 + i];
+                    }
+                }
+            }
+#endif
+            s.v[wall_ns] = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+    };
+
+    profiler::thread_state&
+    profiler::tls() {
+        thread_local thread_state state;
+        return state;
+    }
+
+    profiler::profiler()
+    : generation_(next_generation++) {
+        available_[wall_ns] = true;
+#ifdef __linux__
+        for(int c = 0; c < wall_ns; c++) {
+            int fd = open_counter(counter(c));
+            if(fd >= 0) {
+                available_[c] = true;
+                ::close(fd);
+            } else if(reason_.empty()) {
+                reason_ = std::string(counter_names[c]) + ": " + std::strerror(errno);
+            }
+        }
+#else
+        reason_ = "perf_event_open is linux only";
+#endif
+    }
+
+    profiler::~profiler() {}
+
+    void
+    profiler::bind(profiler* p) {
+        auto& t = tls();
+        t.bound = p;
+        if(p && (t.generation != p->generation_)) {
+            t.sh = &p->local();
+            t.generation = p->generation_;
+        }
+    }
+
+    profiler::shard&
+    profiler::local() {
+        std::lock_guard<std::mutex> lk(mut_);
+        shards_.emplace_back(new shard);
+        return *shards_.back();
+    }
+
+    profiler::scope::scope(const char* phase) {
+        auto& t = tls();
+        if(!t.bound) {
+            return;
+        }
+        owner_ = t.bound;
+        depth_ = t.path.size();
+        if(!t.path.empty()) {
+            t.path += ';';
+        }
+        t.path += phase;
+        t.read(start_);
+    }
+
+    profiler::scope::~scope() {
+        if(!owner_) {
+            return;
+        }
+        auto& t = tls();
+        sample end;
+        t.read(end);
+        if(t.bound == owner_) {
+            std::lock_guard<std::mutex> lk(t.sh->mut);
+            auto& tot = t.sh->frames[t.path];
+            tot.calls++;
+            for(int c = 0; c < counter_count; c++) {
+                tot.v[c] += end.v[c] - start_.v[c];
+            }
+        }
+        t.path.resize(depth_);
+    }
+
+    std::string
+    profiler::path() {
+        return tls().path;
+    }
+
+    profiler::inherit::inherit(const std::string& path) {
+        auto& t = tls();
+        saved_.swap(t.path);
+        t.path = path;
+    }
+
+    profiler::inherit::~inherit() {
+        tls().path.swap(saved_);
+    }
+
+    std::map<std::string, profiler::totals>
+    profiler::frames() const {
+        std::map<std::string, totals> all;
+        std::lock_guard<std::mutex> lk(mut_);
+        for(auto& sh : shards_) {
+            std::lock_guard<std::mutex> slk(sh->mut);
+            for(auto& it : sh->frames) {
+                auto& tot = all[it.first];
+                tot.calls += it.second.calls;
+                for(int c = 0; c < counter_count; c++) {
+                    tot.v[c] += it.second.v[c];
+                }
+            }
+        }
+        return all;
+    }
+
+    bool
+    profiler::available(counter c) const {
+        return available_[c];
+    }
+
+    void
+    profiler::report(std::ostream& os) const {
+        auto all = frames();
+        os << "profile:";
+        if(!reason_.empty()) {
+            os << " (unavailable: " << reason_ << ")";
+        }
+        os << "\n";
+        os << std::left << std::setw(48) << "frame" << std::right << std::setw(12) << "calls";
+        for(int c = 0; c < counter_count; c++) {
+            if(available_[c]) {
+                os << std::setw(16) << counter_names[c];
+            }
+        }
+        const bool ipc = available_[cycles] && available_[instructions];
+        if(ipc) {
+            os << std::setw(8) << "ipc";
+        }
+        os << "\n";
+        for(auto& it : all) {
+            os << std::left << std::setw(48) << it.first << std::right << std::setw(12) << it.second.calls;
+            for(int c = 0; c < counter_count; c++) {
+                if(available_[c]) {
+                    os << std::setw(16) << it.second.v[c];
+                }
+            }
+            if(ipc) {
+                const double cyc = double(std::max<uint64_t>(1, it.second.v[cycles]));
+                os << std::setw(8) << std::fixed << std::setprecision(2) << it.second.v[instructions] / cyc;
+            }
+            os << "\n";
+        }
+
+        // folded stacks: each frame's own share, its children subtracted.
+        const counter weight = available_[cycles] ? cycles : wall_ns;
+        os << "folded (" << counter_names[weight] << "):\n";
+        for(auto& it : all) {
+            uint64_t self = it.second.v[weight];
+            const std::string prefix = it.first + ';';
+            for(auto child = all.lower_bound(prefix); child != all.end() && child->first.compare(0, prefix.size(), prefix) == 0; ++child) {
+                if(child->first.find(';', prefix.size()) == std::string::npos) {
+                    self -= std::min(self, child->second.v[weight]);
+                }
+            }
+            os << folded_frame(it.first) << " " << self << "\n";
+        }
+    }
+
+    std::string
+    profiler::type_name(const char* mangled) {
+        int status = 0;
+        char* name = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+        if(status != 0 || !name) {
+            return mangled;
+        }
+        std::string str(name);
+        std::free(name);
+        return frame_name(str);
+    }
+
+    //
+    // "(anonymous namespace)" becomes "anon", spaces go, and template
+    // arguments nested inside others are elided, so
+    // "sim::link<std::vector<int, std::allocator<int> > >" reads
+    // "sim::link<std::vector<...>>".
+    std::string
+    profiler::frame_name(const std::string& name) {
+        static const std::string anon = "(anonymous namespace)";
+        std::string out;
+        out.reserve(name.size());
+        int depth = 0;
+        for(size_t i = 0; i < name.size(); i++) {
+            const char ch = name[i];
+            if(name.compare(i, anon.size(), anon) == 0) {
+                if(depth < 2) {
+                    out += "anon";
+                }
+                i += anon.size() - 1;
+                continue;
+            }
+            if(ch == '<') {
+                if(++depth == 2) {
+                    out += "<...";
+                    continue;
+                }
+            } else if(ch == '>' && depth > 0) {
+                if(depth-- == 2) {
+                    out += '>';
+                    continue;
+                }
+            }
+            if(depth >= 2 || ch == ' ') {
+                continue;
+            }
+            out += ch == ';' ? ',' : ch;
+        }
+        return out;
+    }
+
+    //
+    // a frame path as one folded-stack token: ';' separates frames, and the
+    // first space ends the stack, so phases named with spaces get '_'.
+    std::string
+    profiler::folded_frame(const std::string& path) {
+        std::string out(path);
+        std::replace(out.begin(), out.end(), ' ', '_');
+        return out;
+    }
+}
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cstring>
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/eccrypto.h>
+#include <cryptopp/integer.h>
+#include <cryptopp/oids.h>
+#include <cryptopp/sha.h>
+
+#include "sim/sig.hh"
+
+namespace sim {
+
+    namespace {
+        using ecdsa = CryptoPP::ECDSA<CryptoPP::ECP, CryptoPP::SHA256>;
+        using group = CryptoPP::DL_GroupParameters_EC<CryptoPP::ECP>;
+
+        //
+        // per thread: CryptoPP's curve arithmetic keeps scratch values in
+        // mutable members, so a group can't be shared between threads.
+        const group& secp256k1() {
+            thread_local const group g(CryptoPP::ASN1::secp256k1());
+            return g;
+        }
+
+        //
+        // the "random" source handed to the signer: sha256 over (secret,
+        // digest, counter), so the nonce is unique per key and message and
+        // the same every run.
+        struct nonce_source : CryptoPP::RandomNumberGenerator {
+            nonce_source(const sha256_t& secret, const sha256_t& digest) {
+                std::memcpy(state_, secret.data(), secret.size());
+                std::memcpy(state_ + secret.size(), digest.data(), digest.size());
+            }
+
+            void GenerateBlock(CryptoPP::byte* output, size_t size) override {
+                while(size > 0) {
+                    std::memcpy(state_ + 64, &counter_, sizeof(counter_));
+                    counter_++;
+                    auto block = sha256(state_, sizeof(state_));
+                    const size_t n = std::min(size, block.size());
+                    std::memcpy(output, block.data(), n);
+                    output += n;
+                    size -= n;
+                }
+            }
+
+        private:
+            uint8_t state_[64 + sizeof(uint64_t)];
+            uint64_t counter_ {0};
+        };
+    }
+
+    struct keypair::impl {
+        ecdsa::PrivateKey priv;
+        sha256_t secret;
+    };
+
+    keypair::keypair(const sha256_t& seed)
+    : impl_(new impl) {
+        auto& g = secp256k1();
+        CryptoPP::Integer x(seed.data(), seed.size());
+        x = x % g.GetSubgroupOrder();
+        if(x.IsZero()) {
+            x = CryptoPP::Integer::One();
+        }
+        impl_->priv.Initialize(g, x);
+        impl_->secret = seed;
+
+        ecdsa::PublicKey pub;
+        impl_->priv.MakePublicKey(pub);
+        g.GetCurve().EncodePoint(pub_.data(), pub.GetPublicElement(), true);
+    }
+
+    keypair::~keypair() {}
+
+    signature_t
+    keypair::sign(const sha256_t& digest) const {
+        signature_t sig {};
+        nonce_source nonce(impl_->secret, digest);
+        ecdsa::Signer signer(impl_->priv);
+        signer.SignMessage(nonce, digest.data(), digest.size(), sig.data());
+        return sig;
+    }
+
+    bool
+    verify(const pubkey_t& key, const sha256_t& digest, const signature_t& sig) {
+        auto& g = secp256k1();
+        CryptoPP::ECP::Point q;
+        if(!g.GetCurve().DecodePoint(q, key.data(), key.size())) {
+            return false;
+        }
+        ecdsa::PublicKey pub;
+        pub.Initialize(g, q);
+        ecdsa::Verifier v(pub);
+        return v.VerifyMessage(digest.data(), digest.size(), sig.data(), sig.size());
+    }
+
+    verifier::verifier(size_t capacity)
+    : shard_capacity_(std::max<size_t>(1, capacity / shard_count)) {}
+
+    bool
+    verifier::check(const request& r) {
+        requests_++;
+        const auto key = key_of(r);
+        bool ok = false;
+        if(lookup(key, ok)) {
+            hits_++;
+            return ok;
+        }
+        ok = sim::verify(r.key, r.digest, r.sig);
+        store(key, ok);
+        return ok;
+    }
+
+    verifier::stats
+    verifier::counters() const {
+        stats s;
+        s.requests = requests_;
+        s.hits = hits_;
+        s.verified = verified_;
+        s.failed = failed_;
+        return s;
+    }
+
+    sha256_t
+    verifier::key_of(const request& r) {
+        uint8_t buf[sizeof(r.key) + sizeof(r.digest) + sizeof(r.sig)];
+        std::memcpy(buf, r.key.data(), r.key.size());
+        std::memcpy(buf + r.key.size(), r.digest.data(), r.digest.size());
+        std::memcpy(buf + r.key.size() + r.digest.size(), r.sig.data(), r.sig.size());
+        return sha256(buf, sizeof(buf));
+    }
+
+    bool
+    verifier::lookup(const sha256_t& key, bool& ok) {
+        auto& s = shard_of(key);
+        std::lock_guard<std::mutex> lk(s.mut);
+        auto it = s.results.find(key);
+        if(it == s.results.end()) {
+            return false;
+        }
+        ok = it->second;
+        return true;
+    }
+
+    void
+    verifier::store(const sha256_t& key, bool ok) {
+        verified_++;
+        if(!ok) {
+            failed_++;
+        }
+        auto& s = shard_of(key);
+        std::lock_guard<std::mutex> lk(s.mut);
+        if(!s.results.emplace(key, ok).second) {
+            return;
+        }
+        s.order.push_back(key);
+        while(s.order.size() > shard_capacity_) {
+            s.results.erase(s.order.front());
+            s.order.pop_front();
+        }
+    }
+}
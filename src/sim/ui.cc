@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cinttypes>
 
 #include "sim/ui.hh"
@@ -47,7 +48,7 @@ namespace sim {
     void
     ui::log(std::string str) {
         std::unique_lock<std::mutex> mut(mut_[element::WND_LOG]);
-        loglines_.push_back(str);
+        loglines_.emplace_back(str.data(), str.size());
         if(loglines_.size() > max_loglines_) {
             loglines_.pop_front();
         }
@@ -117,7 +118,7 @@ namespace sim {
                 wnd_.erase(it);
             }
 
-            max_loglines_ = maxy / 2 - 4;
+            max_loglines_ = size_t(std::max(1, maxy / 2 - 4));
             wnd_.emplace(element::WND_LOG, create_newwin(h,w,y,x));
             it = wnd_.find(element::WND_LOG);
             dirty = true;
@@ -4,11 +4,23 @@
 #include <random>
 #include <limits>
 #include <deque>
+#include <fstream>
 
 #include "sim/ui.hh"
 #include "sim/sim.hh"
 #include "sim/log.hh"
 #include "sim/blockchain.hh"
+#include "sim/cpu.hh"
+#include "sim/topology.hh"
+#include "sim/coro.hh"
+#include "sim/mempool.hh"
+#include "sim/block_store.hh"
+#include "sim/digest.hh"
+#include "sim/perf.hh"
+#include "sim/bitmap.hh"
+#include "sim/tally.hh"
+#include "sim/crowd.hh"
+#include "sim/soa.hh"
 
 const int msPerStep = 50;
 const int stepsPerSecond = 1000 / msPerStep;
@@ -21,188 +33,629 @@ const int Z = N * 9 / 10; // number of block candidates before forming opinion
 const int observerCount = N / 5;
 const std::pair<int, int> stepsPerTxRange { stepsPer100ms * 10, stepsPer100ms * 25 };
 const std::pair<int, int> latencyRange { stepsPer100ms, stepsPer100ms * 4 };
+const size_t mempoolCapacity = 100000; // pending txs per node, highest hashes are evicted first
+const size_t blockMaxTxs = 10000;
+const double cpuBudgetPerStep = 400; // work units per step per node, 0 = unlimited (see sim::cost_model); about 15% used on average, bursts of opinions and blocks are deferred
+const size_t residentBlocks = 64; // block bodies kept in memory per node, older ones are read back from disk
+const size_t syncHeadersMax = 512; // block hashes per headers reply
+const size_t syncBlocksPerRequest = 16; // blocks per get_blocks request
+const size_t syncRequestsInFlight = 4; // get_blocks requests outstanding at once
+const int syncTimeoutSteps = latencyRange.second * 4; // without progress, try the next peer
+const int syncBackoffSteps = blockTimeSteps; // wait after no peer could help, doubled each time up to 16x
+const uint32_t crowdMembers = 0; // relay-only nodes, modelled as one sim::crowd every node links into; 0 = none
+const int lateNodes = 1; // nodes that are offline for the first lateJoinSteps and have to sync when they join
+const int lateJoinSteps = blockTimeSteps * 4;
 //static int tx_seqno = 0;
 static int next_nodeid = 0;
 
 
-struct opinion {
-    int nodeid;
-    int seq;
-    sim::sha256_t block_sha;
+//
+// opinions travel as bundles of a node's tally (see sim::tally); nodes
+// forward what they learnt at most once a step.
+//
+using opinions = sim::tally::bundle;
+
+//
+// chain sync, between a lagging node and one peer:
+//   get_headers  locator, our block hashes from the tip back, spaced
+//                exponentially further apart
+//   headers      the newest locator hash the peer has, then up to
+//                syncHeadersMax of the peer's block hashes after it
+//   get_blocks   a batch of those hashes
+//   blocks       the bodies, in order
+//
+struct sync_msg {
+    enum kind_t { get_headers, headers, get_blocks, blocks } kind;
+    std::vector<sim::sha256_t> hashes;
+    std::vector<std::shared_ptr<sim::block>> blks;
 };
 
 struct packet {
     std::shared_ptr<sim::tx> txn;
     std::shared_ptr<sim::block> blk;
-    std::shared_ptr<opinion> op;
+    std::shared_ptr<opinions> ops;
     std::shared_ptr<sim::sha256_t> give;
+    std::shared_ptr<sync_msg> sync;
 };
 
-struct node : public sim::node<packet>, public sim::component {
-    node(sim::engine& e, sim::ui* ui, int steps, int tx_steps, bool observer)
-    : sim::node<packet>(e)
+//
+// what of a delivered packet goes into the step digest (see sim::digest).
+uint64_t digest_value(const packet& pkt) {
+    sim::sha256_hash h;
+    uint64_t v = sim::digest::seed;
+    if(pkt.txn) {
+        v = sim::digest::mix(v, h(pkt.txn->hash()));
+    }
+    if(pkt.blk) {
+        v = sim::digest::mix(v, h(pkt.blk->hash()));
+    }
+    if(pkt.ops) {
+        for(auto& it : pkt.ops->entries) {
+            v = sim::digest::mix(sim::digest::mix(v, uint64_t(it.seq)), h(it.block_sha));
+            for(auto w : it.nodes.words()) {
+                v = sim::digest::mix(v, w);
+            }
+        }
+    }
+    if(pkt.give) {
+        v = sim::digest::mix(v, h(*pkt.give));
+    }
+    if(pkt.sync) {
+        v = sim::digest::mix(v, uint64_t(pkt.sync->kind));
+        for(auto& it : pkt.sync->hashes) {
+            v = sim::digest::mix(v, h(it));
+        }
+        for(auto& it : pkt.sync->blks) {
+            v = sim::digest::mix(v, h(it->hash()));
+        }
+    }
+    return v;
+}
+
+//
+// the fields of a node that whole-population passes read, kept in columns
+// of one table (see sim::soa): its cpu and the scalars of its chain sync.
+// the exit summaries sum single columns.
+//
+struct cpu_state : sim::column<sim::cpu> {};
+struct sync_peer : sim::column<const sim::link<packet>*> {};
+struct sync_target : sim::column<size_t> {};         // longest chain heard of
+struct sync_tried : sim::column<size_t> {};          // peers asked since the sync started
+struct sync_in_flight : sim::column<size_t> {};      // get_blocks without a reply
+struct sync_more : sim::column<uint8_t> {};          // the last headers reply was full
+struct sync_last_progress : sim::column<int64_t> {};
+struct sync_retry_at : sim::column<int64_t> {};
+struct sync_backoff : sim::column<int64_t> {};
+struct sync_blocks : sim::column<uint64_t> {};       // fetched by sync
+struct sync_messages : sim::column<uint64_t> {};     // sync packets sent, both roles
+using node_table = sim::soa<cpu_state, sync_peer, sync_target, sync_tried, sync_in_flight, sync_more,
+                            sync_last_progress, sync_retry_at, sync_backoff, sync_blocks, sync_messages>;
+
+//
+// a node is a handful of behaviors (see sim::co_node).  they all run on one
+// thread at a time, so the node's state needs no lock.
+//
+struct node : public sim::co_node<packet> {
+    node(sim::engine& e, sim::co_scheduler& sched, node_table& table, sim::ui* ui, int steps, int tx_steps, bool observer, int64_t joins_at = 0)
+    : sim::co_node<packet>(e, sched)
     , ui(ui)
     , blocksteps(steps)
     , txsteps(tx_steps)
+    , joins_at(joins_at)
+    , table(table)
+    , row(table.push_back())
     , id(++next_nodeid)
     , observer(observer)
     {
 
-        auto genesis = std::make_shared<sim::block>();
-        genesis->txs.emplace_back(new sim::tx(0xD34DBEEF));
-        genesis->recompute_hash();
-        blocks.push_back(genesis);
+        cpu() = sim::cpu(cpuBudgetPerStep);
+        col<sync_backoff>() = syncBackoffSteps;
+        blocks.append(genesis());
+        spawn(receive());
+        spawn(makeBlocks());
+        spawn(makeTxs());
+        spawn(decide());
+        spawn(payCpu());
+        spawn(retryTxs());
+        spawn(watchSync());
+        spawn(forwardOpinions());
 
     }; // id would be replaced by a public key
     
-    void packet_callback(const packet& pkt) override {
-        std::unique_lock<std::recursive_mutex> lk(mut);
+    //
+    // every node starts from the same genesis block, built once and shared.
+    static std::shared_ptr<sim::block> genesis() {
+        static std::shared_ptr<sim::block> g = [] {
+            auto b = std::make_shared<sim::block>();
+            b->add_tx(std::make_shared<sim::tx>(0xD34DBEEF));
+            return b;
+        }();
+        return g;
+    }
+    
+    sim::behavior receive() {
+        for(;;) {
+            auto d = co_await next_delivery();
+            if(!online()) {
+                continue; // lost, as packets to a node that is down are
+            }
+            cpu().step(now());
+            handlePacket(*d.from, d.pkt);
+        }
+    }
+    
+    //
+    // periodic timers fire once (now - last) > interval, i.e. every
+    // interval + 1 steps, as they did when nodes were polled.
+    sim::behavior makeBlocks() {
+        co_await sleep(blocksteps);
+        for(;;) {
+            if(online()) {
+                cpu().step(now());
+                createBlock();
+            }
+            co_await sleep(blocksteps + 1);
+        }
+    }
+    
+    sim::behavior makeTxs() {
+        co_await sleep(txsteps);
+        for(;;) {
+            if(online()) {
+                cpu().step(now());
+                auto txn = sim::tx { engine_.rand_int<int64_t>(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()) };
+                addTx(txn);
+            }
+            co_await sleep(txsteps + 1);
+        }
+    }
+    
+    //
+    // pays queued work down while the node is otherwise idle.
+    sim::behavior payCpu() {
+        for(;;) {
+            co_await when([this] { return cpu().backlog() > 0; });
+            co_await sleep(1);
+            cpu().step(now());
+        }
+    }
+    
+    //
+    // txs deferred by addTx, in arrival order, as far as each step's
+    // budget goes.
+    sim::behavior retryTxs() {
+        for(;;) {
+            co_await when([this] { return !tx_backlog.empty(); });
+            co_await sleep(1);
+            cpu().step(now());
+            // once the budget runs out, addTx queues the rest again in order.
+            std::deque<sim::tx> backlog;
+            backlog.swap(tx_backlog);
+            for(auto& it : backlog) {
+                addTx(it);
+            }
+        }
+    }
+    
+    //
+    // a late node neither hears nor says anything before it joins; its
+    // timers keep their phase so its rounds line up with everyone's.
+    bool online() const {
+        return now() >= joins_at;
+    }
+    
+    void handlePacket(const sim::link<packet>& from, const packet& pkt) {
         if(pkt.txn) {
             addTx(*pkt.txn);
         }
-        if(pkt.op && cur_seq > -1) {
-            if(opinions.find(pkt.op->nodeid) == opinions.end()) {
-                opinions.emplace(pkt.op->nodeid, pkt.op);
-                send_packet(pkt);
-            }
+        if(pkt.ops && pkt.ops->height > blocks.size()) {
+            // the sender's chain is longer than ours.
+            startSync(from, pkt.ops->height);
         }
-        if(pkt.blk) {
-            // got a block.
-            auto sha = pkt.blk->hash();
-            bool have = std::find_if(blocks.begin(), blocks.end(), [sha](std::shared_ptr<sim::block>& b) {
-                return sha == b->hash();
-            }) != blocks.end();
-            
-            if(!have && pkt.blk->prev_block == blocks.back()->hash()) {
-                blocks.push_back(pkt.blk);
-                if(pkt.blk->hash() != curr_winner) {
-                    log(std::to_string(id) + ":: conflict: " + sim::sha_shortcode(curr_winner) + " != " + sim::sha_shortcode(pkt.blk->hash()));
-                }
-                if(observer) {
-                    std::string str = std::to_string(id) + "-chain: ";
-                    for(auto& it : blocks) {
-                        auto sha = it->hash();
-                        str += sim::sha_shortcode(sha) + " ";
-                    }
-                    log(str);    
+        if(pkt.ops && cur_seq > -1) {
+            // each opinion we haven't counted yet carries its node's signature.
+            const size_t fresh = votes.fresh(*pkt.ops);
+            auto ops = pkt.ops;
+            cpu().submit(double(fresh) * cpu().model().sig_check, [this, &from, ops] {
+                if(cur_seq < 0) {
+                    return; // decided while the checks were queued.
                 }
-                send_packet(pkt);
-                int t = 0;
-                curr_winner = sim::sha256((uint8_t*)&t, sizeof(t));
-            }
+                addOpinions(*ops, &from);
+            });
+        }
+        if(pkt.blk) {
+            cpu().submit(blockCost(*pkt.blk), [this, &from, pkt] {
+                acceptBlock(from, pkt);
+            });
         }
         if(pkt.give) {
             auto sha = *pkt.give;
-            auto it = std::find_if(blocks.begin(), blocks.end(), [sha](std::shared_ptr<sim::block>& b) {
-                return sha == b->hash();
-            });
-            if(it != blocks.end()) {
+            if(auto blk = blocks.get(sha)) {
                 packet p;
-                p.blk = *it;
+                p.blk = blk;
                 send_packet(p);
             }
         }
+        if(pkt.sync) {
+            handleSync(from, *pkt.sync);
+        }
+    }
+    
+    //
+    // validating a block means rehashing its txs into the merkle root and
+    // checking its maker's signature.
+    double blockCost(const sim::block& blk) const {
+        return cpu().model().merkle(blk.txs().size()) + cpu().model().hash_bytes(64) + cpu().model().sig_check;
+    }
+    
+    void acceptBlock(const sim::link<packet>& from, const packet& pkt) {
+        sim::profiler::scope prof("accept_block");
+        auto sha = pkt.blk->hash();
+        bool have = blocks.contains(sha);
+        
+        if(!have && pkt.blk->prev_block() == blocks.back().sha) {
+            blocks.append(pkt.blk);
+            if(pkt.blk->hash() != curr_winner) {
+                log(std::to_string(id) + ":: conflict: " + sim::sha_shortcode(curr_winner) + " != " + sim::sha_shortcode(pkt.blk->hash()));
+            }
+            if(observer) {
+                std::string str = std::to_string(id) + "-chain: ";
+                for(auto& it : blocks.headers()) {
+                    str += sim::sha_shortcode(it.sha) + " ";
+                }
+                log(str);    
+            }
+            send_packet(pkt);
+            int t = 0;
+            curr_winner = sim::sha256((uint8_t*)&t, sizeof(t));
+        } else if(!have && !blocks.contains(pkt.blk->prev_block())) {
+            // builds on blocks we never got: we've fallen behind.
+            startSync(from, blocks.size() + 1);
+        }
     }
     
-    void step() override {
-        std::unique_lock<std::recursive_mutex> lk(mut);
-        if(current_step_ - last_blockstep > blocksteps) {
-            last_blockstep = current_step_;
-            createBlock();
+    //
+    // chain sync (see sync_msg).  one peer at a time; the headers it sends
+    // are fetched in batches of syncBlocksPerRequest with up to
+    // syncRequestsInFlight outstanding, so a node n blocks behind is back
+    // in about n / (syncBlocksPerRequest * syncRequestsInFlight) + 2 round
+    // trips.  the store is append-only, so a peer on another fork can't
+    // help; we move on to the next one.
+    //
+    void startSync(const sim::link<packet>& from, size_t height) {
+        col<sync_target>() = std::max(col<sync_target>(), height);
+        if(col<sync_peer>() || now() < col<sync_retry_at>()) {
+            return;
         }
-        if(current_step_ - last_txstep > txsteps) {
-            last_txstep = current_step_;
-            auto txn = sim::tx { engine_.rand_int<int64_t>(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()) };
-            addTx(txn);
+        const sim::link<packet>* peer = &from;
+        if(peer == crowd_link) {
+            // heard through the crowd, which only relays: ask a full peer.
+            auto peers = syncPeers();
+            if(peers.empty()) {
+                return;
+            }
+            peer = peers.front();
         }
-        if(opinions.size() >= Z) {
-            // decide on block.
-            std::vector<sim::sha256_t> hashes;
-            for(auto it = opinions.begin(); it != opinions.end(); ) {
-                if(it->second->seq != cur_seq) {
-                    it = opinions.erase(it);
-                } else {
-                    hashes.push_back(it->second->block_sha);
-                    ++it;
+        col<sync_peer>() = peer;
+        col<sync_tried>() = 1;
+        col<sync_last_progress>() = now();
+        requestHeaders();
+    }
+    
+    void requestHeaders() {
+        auto msg = sim::make_tagged<sync_msg, sim::memory::link>();
+        msg->kind = sync_msg::get_headers;
+        size_t step = 1;
+        for(int64_t h = int64_t(blocks.size()) - 1; h >= 0; h -= int64_t(step)) {
+            msg->hashes.push_back(blocks.at(size_t(h)).sha);
+            if(msg->hashes.size() >= 8) {
+                step *= 2;
+            }
+        }
+        if(msg->hashes.back() != blocks.at(0).sha) {
+            msg->hashes.push_back(blocks.at(0).sha);
+        }
+        sendSync(*col<sync_peer>(), msg);
+    }
+    
+    void requestBlocks() {
+        while(col<sync_in_flight>() < syncRequestsInFlight && !sync_wanted.empty()) {
+            auto msg = sim::make_tagged<sync_msg, sim::memory::link>();
+            msg->kind = sync_msg::get_blocks;
+            while(msg->hashes.size() < syncBlocksPerRequest && !sync_wanted.empty()) {
+                msg->hashes.push_back(sync_wanted.front());
+                sync_wanted.pop_front();
+            }
+            col<sync_in_flight>()++;
+            sendSync(*col<sync_peer>(), msg);
+        }
+    }
+    
+    void sendSync(const sim::link<packet>& to, std::shared_ptr<sync_msg> msg) {
+        packet p;
+        p.sync = std::move(msg);
+        col<sync_messages>()++;
+        send_packet_to(to, p);
+    }
+    
+    void handleSync(const sim::link<packet>& from, const sync_msg& msg) {
+        switch(msg.kind) {
+        case sync_msg::get_headers: {
+            for(auto& sha : msg.hashes) {
+                const int64_t h = blocks.height_of(sha);
+                if(h < 0) {
+                    continue;
+                }
+                auto reply = sim::make_tagged<sync_msg, sim::memory::link>();
+                reply->kind = sync_msg::headers;
+                for(size_t i = size_t(h); i < blocks.size() && reply->hashes.size() <= syncHeadersMax; i++) {
+                    reply->hashes.push_back(blocks.at(i).sha);
                 }
+                sendSync(from, reply);
+                break;
             }
-            std::sort(hashes.begin(), hashes.end(), [](sim::sha256_t& lhs, sim::sha256_t& rhs) -> bool {
-                return lhs < rhs;
-            });
-            sim::sha256_t cur_run{};
-            sim::sha256_t long_run{};
-            int cur_run_ct {0};
-            int long_run_ct {0};
-            
-            for(auto& hash : hashes) {
-                //printf("  hash: %s\n", sim::BytesToStr(hash.data(), hash.size()).c_str());
-                if (hash != cur_run) {
-                    if(cur_run_ct > long_run_ct) {
-                        long_run_ct = cur_run_ct;
-                        long_run = cur_run;
-                    }
-                    cur_run = hash;
-                    cur_run_ct = 1;
-                } else {
-                    cur_run_ct++;
+            break;
+        }
+        case sync_msg::get_blocks: {
+            auto reply = sim::make_tagged<sync_msg, sim::memory::link>();
+            reply->kind = sync_msg::blocks;
+            for(auto& sha : msg.hashes) {
+                if(auto blk = blocks.get(sha)) {
+                    reply->blks.push_back(blk);
                 }
             }
-            if(cur_run_ct > long_run_ct) {
-                long_run_ct = cur_run_ct;
-                long_run = cur_run;
+            sendSync(from, reply);
+            break;
+        }
+        case sync_msg::headers: {
+            if(&from != col<sync_peer>()) {
+                return; // from a peer we gave up on
             }
-            //sim::log().info("consensus looks like {}", sim::sha_shortcode(long_run));
-            if(current_block && long_run == current_block->hash()) {
-                // we got this one right
-                blocks.push_back(current_block);
-                if(observer) {
-                    std::string str = std::to_string(id) + "-chain: ";
-                    for(auto& it : blocks) {
-                        auto sha = it->hash();
-                        str += sim::sha_shortcode(sha) + " ";
+            col<sync_last_progress>() = now();
+            if(msg.hashes.empty() || msg.hashes.front() != blocks.back().sha) {
+                // forked below our tip, or nothing in common.
+                nextSyncPeer();
+                return;
+            }
+            sync_wanted.assign(msg.hashes.begin() + 1, msg.hashes.end());
+            col<sync_more>() = sync_wanted.size() == syncHeadersMax;
+            syncProgress();
+            break;
+        }
+        case sync_msg::blocks: {
+            if(&from != col<sync_peer>()) {
+                return;
+            }
+            // a reply to a request made before we last moved on to this
+            // peer again isn't counted as in flight any more.
+            if(col<sync_in_flight>() > 0) {
+                col<sync_in_flight>()--;
+            }
+            col<sync_last_progress>() = now();
+            requestBlocks();
+            double cost = 0;
+            for(auto& blk : msg.blks) {
+                cost += blockCost(*blk);
+            }
+            auto blks = msg.blks;
+            auto peer = col<sync_peer>();
+            cpu().submit(cost, [this, blks, peer] {
+                if(col<sync_peer>() != peer) {
+                    return;
+                }
+                for(auto& blk : blks) {
+                    if(blocks.contains(blk->hash())) {
+                        continue;
+                    }
+                    if(blk->prev_block() != blocks.back().sha) {
+                        nextSyncPeer();
+                        return;
                     }
-                    log(str);    
+                    blocks.append(blk);
+                    col<sync_blocks>()++;
                 }
-                
-            } else {
-                // we didnt, request from someone who did.
-                curr_winner = long_run;
-                packet p ;
-                p.give = std::make_shared<sim::sha256_t>(long_run);
-                send_packet(p);
+                syncProgress();
+            });
+            break;
+        }
+        }
+    }
+    
+    //
+    // after headers or a batch of blocks: fetch more, ask for the next
+    // headers, or finish.
+    void syncProgress() {
+        requestBlocks();
+        if(col<sync_in_flight>() > 0 || !sync_wanted.empty()) {
+            return;
+        }
+        if(col<sync_more>()) {
+            requestHeaders();
+        } else if(blocks.size() < col<sync_target>()) {
+            nextSyncPeer();
+        } else {
+            col<sync_backoff>() = syncBackoffSteps;
+            finishSync();
+        }
+    }
+    
+    //
+    // the links sync can ask: full nodes, not the crowd.
+    std::vector<const sim::link<packet>*> syncPeers() const {
+        auto peers = links();
+        peers.erase(std::remove(peers.begin(), peers.end(), crowd_link), peers.end());
+        return peers;
+    }
+    
+    void nextSyncPeer() {
+        auto peers = syncPeers();
+        if(col<sync_tried>() >= peers.size()) {
+            // nobody we can reach has what we're missing, most likely
+            // because we're on another fork.  wait before trying again.
+            col<sync_target>() = blocks.size();
+            col<sync_retry_at>() = now() + col<sync_backoff>();
+            col<sync_backoff>() = std::min(col<sync_backoff>() * 2, int64_t(syncBackoffSteps) * 16);
+            finishSync();
+            return;
+        }
+        auto it = std::find(peers.begin(), peers.end(), col<sync_peer>());
+        col<sync_peer>() = it == peers.end() || ++it == peers.end() ? peers.front() : *it;
+        col<sync_tried>()++;
+        sync_wanted.clear();
+        col<sync_in_flight>() = 0;
+        col<sync_last_progress>() = now();
+        requestHeaders();
+    }
+    
+    void finishSync() {
+        if(observer && col<sync_blocks>() > 0) {
+            log(std::to_string(id) + ": synced to height " + std::to_string(blocks.size()));
+        }
+        col<sync_peer>() = nullptr;
+        sync_wanted.clear();
+        col<sync_in_flight>() = 0;
+        col<sync_more>() = false;
+    }
+    
+    sim::behavior watchSync() {
+        for(;;) {
+            co_await when([this] { return col<sync_peer>() != nullptr; });
+            co_await sleep(syncTimeoutSteps);
+            if(col<sync_peer>() && now() - col<sync_last_progress>() >= syncTimeoutSteps) {
+                nextSyncPeer();
+            }
+        }
+    }
+    
+    sim::behavior decide() {
+        for(;;) {
+            co_await when([this] { return votes.voters() >= Z; });
+            decideBlock();
+        }
+    }
+    
+    //
+    // count the votes in a bundle from nodes not counted yet, and remember
+    // that the peer it came from has them.  from is null for our own.
+    void addOpinions(const opinions& ops, const sim::link<packet>* from) {
+        refreshPeers();
+        size_t peer = sim::tally::none;
+        if(from) {
+            auto it = std::find(peers.begin(), peers.end(), from);
+            if(it != peers.end()) {
+                peer = size_t(it - peers.begin());
+            }
+        }
+        if(votes.merge(ops, peer) > 0) {
+            opinions_dirty = true;
+        }
+    }
+    
+    //
+    // follow links() after a link was added or removed; a new peer is
+    // sent everything we have.
+    void refreshPeers() {
+        if(peers_version == links_version()) {
+            return;
+        }
+        peers_version = links_version();
+        auto current = links();
+        std::vector<size_t> moved(peers.size(), sim::tally::none);
+        for(size_t i = 0; i < peers.size(); i++) {
+            auto it = std::find(current.begin(), current.end(), peers[i]);
+            if(it != current.end()) {
+                moved[i] = size_t(it - current.begin());
+            }
+        }
+        votes.remap(moved, current.size());
+        peers = std::move(current);
+    }
+    
+    sim::behavior forwardOpinions() {
+        for(;;) {
+            co_await when([this] { return opinions_dirty; });
+            sendOpinions();
+        }
+    }
+    
+    //
+    // to each peer, one bundle with the entries it doesn't have all of
+    // our votes for.  nothing goes back to the peer that told us.
+    void sendOpinions() {
+        if(!opinions_dirty) {
+            return;
+        }
+        opinions_dirty = false;
+        refreshPeers();
+        for(size_t i = 0; i < peers.size(); i++) {
+            auto bundle = sim::make_tagged<opinions, sim::memory::link>(votes.bundle_for(i));
+            if(bundle->entries.empty()) {
+                continue;
             }
-            cur_seq = -1;
-            opinions.clear();
-            current_block.reset();
+            bundle->height = blocks.size();
+            opinion_stats.packets++;
+            opinion_stats.bytes += bundle->bytes();
+            packet p;
+            p.ops = bundle;
+            send_packet_to(*peers[i], p);
         }
-    };
+    }
+    
+    void decideBlock() {
+        sim::profiler::scope prof("decide");
+        // what arrived this step still goes out before the tally is reset.
+        sendOpinions();
+        
+        // the hash with the most votes this round, the lowest on a tie.
+        const sim::sha256_t long_run = votes.leader(cur_seq).first;
+        opinion_stats.rounds++;
+        //sim::log().info("consensus looks like {}", sim::sha_shortcode(long_run));
+        if(current_block && long_run == current_block->hash()) {
+            // we got this one right
+            blocks.append(current_block);
+            if(observer) {
+                std::string str = std::to_string(id) + "-chain: ";
+                for(auto& it : blocks.headers()) {
+                    str += sim::sha_shortcode(it.sha) + " ";
+                }
+                log(str);    
+            }
+            
+        } else {
+            // we didnt, request from someone who did.
+            curr_winner = long_run;
+            packet p ;
+            p.give = sim::make_tagged<sim::sha256_t, sim::memory::link>(long_run);
+            send_packet(p);
+        }
+        cur_seq = -1;
+        votes.clear();
+        current_block.reset();
+    }
+
     
     bool hasTx(const sim::tx& t) {
-        std::unique_lock<std::recursive_mutex> lk(mut);
         bool res = false;
         auto search_hash = t.hash();
-        if(txs.size() > 0) {
-            res = std::find_if(txs.begin(), txs.end(), [search_hash](const std::shared_ptr<sim::tx>& t) {
-                return search_hash == t->hash();
-            }) != txs.end();
-        }
-        if(blocks.size() > 0) {
-            res |= std::find_if(blocks.begin(), blocks.end(), [search_hash](const std::shared_ptr<sim::block>& b) {
-                if(b->txs.empty()) {
-                    return false;
-                }
-                return std::find_if(b->txs.begin(), b->txs.end(), [search_hash](const std::shared_ptr<sim::tx>& t) {
-                    return search_hash == t->hash();
-                }) != b->txs.end();
-            }) != blocks.end();
+        res = txs.contains(search_hash);
+        if(!res) {
+            // only the resident blocks are searched; a tx older than the
+            // window is long gone from every peer's mempool too.
+            res = blocks.has_tx(search_hash);
         }
         return res;
     }
+    //
+    // looking a tx up costs a hash; without the budget for it this step
+    // the tx waits in tx_backlog and is retried on the next (see retryTxs).
     bool addTx(const sim::tx& t) {
-        std::unique_lock<std::recursive_mutex> lk(mut);
+        if(!tx_backlog.empty() || !cpu().try_spend(cpu().model().hash_bytes(sizeof(sim::sha256_t)))) {
+            tx_backlog.push_back(t);
+            return false;
+        }
         if(!hasTx(t)) {
-            auto next_t = std::make_shared<sim::tx>(t);
-            txs.push_back(next_t);
+            auto next_t = sim::make_tagged<sim::tx, sim::memory::tx>(t);
+            txs.insert(next_t);
             packet p;
             p.txn = next_t;
             send_packet(p);
@@ -211,59 +664,57 @@ struct node : public sim::node<packet>, public sim::component {
         return false;
     }
     sim::sha256_t tx_merkle() {
-        std::unique_lock<std::recursive_mutex> lk(mut);
-        std::vector<sim::sha256_t> hashes;
-        for(auto& it : txs) {
-            hashes.emplace_back(it->hash());
-        }
-        return sim::merkle256(hashes);
+        return txs.peek(txs.size()).merkle;
     }
     
     void createBlock() {
-        std::unique_lock<std::recursive_mutex> lk(mut);
-        if(txs.size() > 0) {
-            auto seqno = current_step_ / blocksteps;
+        sim::profiler::scope prof("create_block");
+        if(!txs.empty()) {
+            auto seqno = now() / blocksteps;
             cur_seq = (int)seqno;
-            std::sort(txs.begin(), txs.end(), [](std::shared_ptr<sim::tx>& lhs, std::shared_ptr<sim::tx>& rhs) {
-                return *lhs < *rhs;
-            });
-
 
             // move to staging in case we are the winner.
-            current_block = std::make_shared<sim::block>();
-            std::move(txs.begin(), txs.end(), std::back_inserter(current_block->txs));
-            txs.erase(txs.begin(), txs.end());
+            auto tmpl = txs.take(blockMaxTxs);
+            current_block = sim::make_tagged<sim::block, sim::memory::chain>();
+            current_block->set_txs(std::move(tmpl.txs), tmpl.merkle);
             
             if(!blocks.empty()) {
-                current_block->prev_block = blocks.back()->hash();
+                current_block->set_prev_block(blocks.back().sha);
             }
             
-            current_block->recompute_hash();
-            
-            if(observer) {
-                log(std::to_string(id) + ": created block candidate " + sim::sha_shortcode(current_block->hash()));
-            }
-            {
-                // send out our opinion (that we are the winner, naturally)
-                auto op = std::make_shared<opinion>();
-                op->block_sha = current_block->hash();
-                op->nodeid = id;
-                op->seq = (int)seqno;
-                packet p ;
-                p.op = op;
-                opinions.emplace(id, op);
-                send_packet(p);
-            }
+            // hashing the candidate is the expensive part; announce it once paid for.
+            auto blk = current_block;
+            cpu().submit(cpu().model().merkle(blk->txs().size()) + cpu().model().hash_bytes(64), [this, blk, seqno] {
+                if(current_block != blk) {
+                    // decided without us while the hashing was queued.
+                    return;
+                }
+                
+                if(observer) {
+                    log(std::to_string(id) + ": created block candidate " + sim::sha_shortcode(blk->hash()));
+                }
+                if(!votes.voted(size_t(id))) {
+                    // our opinion (that we are the winner, naturally) goes
+                    // out with the next bundle.
+                    opinions self;
+                    self.entries.push_back({ (int)seqno, blk->hash(), {} });
+                    self.entries.back().nodes.set(size_t(id));
+                    addOpinions(self, nullptr);
+                }
+            });
         }
     }
     void print_chain() {
         std::string str = std::to_string(id) + "-chain: ";
-        for(auto& it : blocks) {
-            auto sha = it->hash();
-            str += sim::sha_shortcode(sha) + " ";
+        for(auto& it : blocks.headers()) {
+            str += sim::sha_shortcode(it.sha) + " ";
         }
         sim::log().info(str);
     }
+    void print_cpu() {
+        sim::log().info("{}-cpu: work {:.0f} utilization {:.1f}% deferred {} backlog {}",
+                        id, cpu().work(), cpu().utilization() * 100, cpu().deferred(), cpu().backlog());
+    }
     void log(std::string str) {
         if(ui) {
             ui->log(str);
@@ -272,36 +723,55 @@ struct node : public sim::node<packet>, public sim::component {
         }
     }
 
-    node(const node& other)
-    : sim::node<packet>(other)
-    , curr_winner(other.curr_winner)
-    , ui(other.ui)
-    , current_block(other.current_block)
-    , txs(other.txs)
-    , blocks(other.blocks)
-    , opinions(other.opinions)
-    , blocksteps(other.blocksteps)
-    , txsteps(other.txsteps)
-    , id(other.id)
-    , observer(other.observer)
-    , last_blockstep(other.last_blockstep)
-    , last_txstep(other.last_txstep)
-    , cur_seq(other.cur_seq) {};
+    node(const node& other) = delete;
+    
+protected:
+    void digest_state() override {
+        sim::digest::add(blocks.back().sha);
+        sim::digest::add(txs.size());
+    }
+    
+public:
     
     sim::sha256_t curr_winner;
     sim::ui* ui;
-    std::recursive_mutex mut;
     std::shared_ptr<sim::block> current_block;
-    std::deque<std::shared_ptr<sim::tx>> txs;
-    std::vector<std::shared_ptr<sim::block>> blocks;
-    std::map<int, std::shared_ptr<opinion>> opinions;
     const int blocksteps;
     const int txsteps;
+    const int64_t joins_at;
+    node_table& table;
+    const size_t row;
+    sim::mempool<sim::tx> txs {mempoolCapacity};
+    std::deque<sim::tx> tx_backlog; // waiting for cpu budget
+    sim::block_store blocks {residentBlocks};
+    std::vector<const sim::link<packet>*> peers; // links() as of peers_version, in the tally's peer order
+    uint64_t peers_version {~uint64_t(0)};
+    sim::tally votes;
+    bool opinions_dirty {false};
+    struct {
+        uint64_t rounds {0};
+        uint64_t packets {0};
+        uint64_t bytes {0};
+    } opinion_stats;
     const int id;
     const bool observer {false};
-    int64_t last_blockstep{0};
-    int64_t last_txstep{0};
     int cur_seq{-1};
+    
+    std::deque<sim::sha256_t> sync_wanted; // hashes from the last headers reply, not yet requested
+    const sim::link<packet>* crowd_link {nullptr}; // into the crowd, if any
+
+    //
+    // this node's row of the table.
+    template <typename C>
+    typename C::value_type& col() {
+        return table.get<C>()[row];
+    }
+    template <typename C>
+    const typename C::value_type& col() const {
+        return table.get<C>()[row];
+    }
+    sim::cpu& cpu() { return col<cpu_state>(); }
+    const sim::cpu& cpu() const { return col<cpu_state>(); }
 };
 
 int main(int argc, const char * argv[]) {
@@ -311,12 +781,42 @@ int main(int argc, const char * argv[]) {
     if(argc > 1) {
         seed = std::strtol(argv[1],0,10);
     }
-    sim::engine engine(seed);
+    size_t threads = std::thread::hardware_concurrency();
+    if(argc > 2 && std::strtol(argv[2],0,10) > 0) {
+        threads = std::strtol(argv[2],0,10);
+    }
+    sim::engine engine(seed, threads);
+    if(argc > 3) {
+        engine.enable_digest(true);
+    }
+    // OBELISK_STEPS=n runs n steps as fast as they go, without the ui, and
+    // exits; for measuring and for scripts.  OBELISK_CROWD overrides
+    // crowdMembers.
+    int64_t headless_steps = 0;
+    if(const char* s = std::getenv("OBELISK_STEPS")) {
+        headless_steps = std::strtoll(s, 0, 10);
+    }
+    uint32_t crowd_members = crowdMembers;
+    if(const char* s = std::getenv("OBELISK_CROWD")) {
+        crowd_members = uint32_t(std::strtoul(s, 0, 10));
+    }
     std::atomic<bool> run {true};
-    std::vector<node> nodes;
+    sim::co_scheduler behaviors(engine);
+    node_table table;
+    table.reserve(N);
+    std::deque<node> nodes;
+    sim::topology topology;
+    std::vector<uint32_t> parts;
+    std::shared_ptr<std::deque<sim::link<packet>>> links;
+    std::unique_ptr<sim::crowd<packet>> crowd;
     {
-        sim::ui ui {};
-        ui.log("Using seed " + std::to_string(seed));
+        std::unique_ptr<sim::ui> ui;
+        if(headless_steps > 0) {
+            sim::log().info("Using seed {}", seed);
+        } else {
+            ui.reset(new sim::ui());
+            ui->log("Using seed " + std::to_string(seed));
+        }
         
         int observers = 0;
 
@@ -326,53 +826,115 @@ int main(int argc, const char * argv[]) {
                 observer = true;
                 observers++;
             }
-            nodes.emplace_back(engine, &ui, blockTimeSteps, engine.rand_int<>(stepsPerTxRange.first, stepsPerTxRange.second), observer);
+            const int64_t joins_at = i >= N - lateNodes ? lateJoinSteps : 0;
+            nodes.emplace_back(engine, behaviors, table, ui.get(), blockTimeSteps, engine.rand_int<>(stepsPerTxRange.first, stepsPerTxRange.second), observer, joins_at);
         }
 
-        for(int i = 0 ; i < numberPeers ; i++) {
-            for(int j = 0; j < N; j++) {
-                if(i == 0) {
-                    if(j > 0) {
-                        int candidate = engine.rand_int<>(0, j-1);
-                        nodes[j].connect(nodes[candidate], engine.rand_int<>(latencyRange.first, latencyRange.second));
-                    }
-                } else {
-                    int candidate = 0;
-                    while(j == (candidate = engine.rand_int<>(0, N-1)) || nodes[j].has_peer(nodes[candidate]));
-                    nodes[j].connect(nodes[candidate], engine.rand_int<>(latencyRange.first, latencyRange.second));
-                }
-            }
+        // random 2*numberPeers-regular graph, the same average degree as
+        // numberPeers outgoing connections per node.
+        topology = sim::topology::random_regular(N, numberPeers * 2, seed, latencyRange, engine);
+
+        // one part per thread, so a node's behaviors and its links are
+        // stepped on the same thread.
+        parts = topology.partition(uint32_t(engine.threads()));
+        for(int i = 0; i < N; i++) {
+            nodes[i].place(parts[i]);
         }
+        links = sim::connect<packet>(engine, topology, [&nodes](uint32_t i) -> node& {
+            return nodes[i];
+        }, &parts);
 
-        for(auto& it : nodes) {
-            engine.register_component(it); 
+        if(crowd_members > 0) {
+            // relays only forward, so all a crowd needs is how long crossing
+            // their graph takes, taken from the graph itself.
+            auto relays = sim::topology::random_regular(crowd_members, numberPeers * 2, seed, latencyRange, engine);
+            crowd.reset(new sim::crowd<packet>(engine, crowd_members, sim::delay_model::from_topology(relays, 8, seed), seed));
+            engine.register_component(*crowd);
+            for(int i = 0; i < N; i++) {
+                auto lk = std::make_shared<sim::link<packet>>(engine.rand_int<>(latencyRange.first, latencyRange.second));
+                engine.register_component(*lk);
+                sim::node<packet>::join(nodes[i], *crowd, lk);
+                nodes[i].crowd_link = lk.get();
+            }
         }
 
-        std::thread t([&]() {
-            auto next_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
-            int i = 0;
-            while(!!run) {
-                ui.set_step(i);
+        if(headless_steps > 0) {
+            const auto start = std::chrono::steady_clock::now();
+            for(int64_t i = 0; i < headless_steps; i++) {
                 engine.step();
-                i++;
-                if(std::chrono::steady_clock::now() < next_time) {
-                    std::this_thread::sleep_until(next_time);
-                }
-                while(next_time < std::chrono::steady_clock::now()) {
-                    next_time += std::chrono::milliseconds(100);
-                }
             }
-        });
+            sim::log().info("ran {} steps in {:.2f} s", headless_steps,
+                            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        } else {
+            std::thread t([&]() {
+                auto next_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+                int i = 0;
+                while(!!run) {
+                    ui->set_step(i);
+                    engine.step();
+                    i++;
+                    if(std::chrono::steady_clock::now() < next_time) {
+                        std::this_thread::sleep_until(next_time);
+                    }
+                    while(next_time < std::chrono::steady_clock::now()) {
+                        next_time += std::chrono::milliseconds(100);
+                    }
+                }
+            });
 
-        ui.run();
+            ui->run();
         
-        run = false;
-        t.join();
+            run = false;
+            t.join();
+        }
     }
     
     for(auto& it : nodes) {
         it.print_chain();
     }
+    for(auto& it : nodes) {
+        it.print_cpu();
+    }
+    {
+        uint64_t synced = 0, messages = 0;
+        for(auto v : table.get<sync_blocks>()) {
+            synced += v;
+        }
+        for(auto v : table.get<sync_messages>()) {
+            messages += v;
+        }
+        sim::log().info("sync: {} blocks fetched with {} messages", synced, messages);
+    }
+    {
+        uint64_t rounds = 0, packets = 0, bytes = 0;
+        for(auto& it : nodes) {
+            rounds = std::max(rounds, it.opinion_stats.rounds);
+            packets += it.opinion_stats.packets;
+            bytes += it.opinion_stats.bytes;
+        }
+        rounds = std::max<uint64_t>(1, rounds);
+        sim::log().info("opinions: {} packets, {} bytes per round ({} rounds)", packets / rounds, bytes / rounds, rounds);
+    }
+    {
+        auto tr = sim::measure_traffic(topology, parts, *links);
+        const uint64_t total = std::max<uint64_t>(1, tr.local + tr.cross);
+        sim::log().info("partitions: {}, {} of {} links cut, {} of {} packets ({:.1f}%) crossed partitions",
+                        engine.threads(), topology.cut(parts), topology.edges.size(),
+                        tr.cross, tr.local + tr.cross, 100.0 * tr.cross / total);
+    }
+    if(crowd) {
+        sim::log().info("crowd: {} members, {:.1f} steps to cross on average, {} packets relayed",
+                        crowd->members(), crowd->delays().mean(), crowd->relayed());
+    }
+    if(argc > 3) {
+        std::ofstream out(argv[3]);
+        engine.digest_trace().write(out);
+    }
+    if(argc > 4) {
+        std::ifstream ref(argv[4]);
+        auto d = sim::digest::compare(engine.digest_trace(), sim::digest::trace::read(ref));
+        sim::log().info("digest vs {}: {}", argv[4], engine.describe(d));
+    }
 
     return 0;
 }
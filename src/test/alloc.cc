@@ -0,0 +1,198 @@
+#include "check.hh"
+#include "sim/alloc.hh"
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// slab and arena allocators.
+//
+
+namespace {
+
+    void slab_blocks() {
+        std::vector<void*> blocks;
+        for(size_t size = 1; size <= sim::slab::max_block; size *= 3) {
+            auto p = sim::slab::allocate(size);
+            std::memset(p, 0xab, size);
+            blocks.push_back(p);
+        }
+        for(size_t i = 0; i < blocks.size(); i++) {
+            for(size_t j = i + 1; j < blocks.size(); j++) {
+                CHECK(blocks[i] != blocks[j]);
+            }
+        }
+        size_t size = 1;
+        for(auto p : blocks) {
+            sim::slab::deallocate(p, size);
+            size *= 3;
+        }
+        // a freed block is reused by the next allocation of its class.
+        auto a = sim::slab::allocate(40);
+        sim::slab::deallocate(a, 40);
+        CHECK(sim::slab::allocate(64) == a);
+        sim::slab::deallocate(a, 64);
+
+        // larger requests go to operator new.
+        auto big = sim::slab::allocate(sim::slab::max_block + 1);
+        std::memset(big, 0, sim::slab::max_block + 1);
+        sim::slab::deallocate(big, sim::slab::max_block + 1);
+    }
+
+    void slab_containers() {
+        std::deque<int, sim::slab_allocator<int>> q;
+        for(int i = 0; i < 10000; i++) {
+            q.push_back(i);
+        }
+        int sum = 0;
+        while(!q.empty()) {
+            sum += q.front();
+            q.pop_front();
+        }
+        CHECK(sum == 10000 * 9999 / 2);
+        auto p = sim::make_pooled<std::pair<int, double>>(3, 0.5);
+        CHECK(p->first == 3 && p->second == 0.5);
+    }
+
+    //
+    // a producer allocates on one thread and a consumer frees on another,
+    // as a sender and a link do.  once warm, the blocks the consumer frees
+    // must come back to the producer rather than new chunks being carved.
+    void slab_cross_thread() {
+        using batch_t = std::vector<void*>;
+        std::mutex mut;
+        std::condition_variable cv;
+        std::deque<batch_t> channel;
+        bool done = false;
+        const size_t rounds = 4000;
+        const size_t per_batch = 200;
+        size_t warm = 0;
+
+        std::thread consumer([&] {
+            for(;;) {
+                batch_t b;
+                {
+                    std::unique_lock<std::mutex> lk(mut);
+                    cv.wait(lk, [&] { return done || !channel.empty(); });
+                    if(channel.empty()) {
+                        return;
+                    }
+                    b = std::move(channel.front());
+                    channel.pop_front();
+                }
+                cv.notify_all();
+                for(auto p : b) {
+                    sim::slab::deallocate(p, 48);
+                }
+            }
+        });
+        std::thread producer([&] {
+            for(size_t r = 0; r < rounds; r++) {
+                if(r == rounds / 10) {
+                    warm = sim::slab::chunks();
+                }
+                batch_t b;
+                for(size_t i = 0; i < per_batch; i++) {
+                    b.push_back(sim::slab::allocate(48));
+                }
+                std::unique_lock<std::mutex> lk(mut);
+                cv.wait(lk, [&] { return channel.size() < 4; });
+                channel.push_back(std::move(b));
+                cv.notify_all();
+            }
+            std::lock_guard<std::mutex> lk(mut);
+            done = true;
+            cv.notify_all();
+        });
+        producer.join();
+        consumer.join();
+        // 4000 rounds of 200 blocks is 51 MB of 64-byte blocks, about 790
+        // chunks if nothing came back.
+        CHECK(sim::slab::chunks() <= warm + 2);
+    }
+
+    //
+    // a thread_local made before the thread's slab is destroyed after it;
+    // what it frees then goes to the depot, and the next thread to run dry
+    // gets it back from there.
+    struct late_holder {
+        ~late_holder() {
+            sim::slab::deallocate(block, 1000);
+        }
+        void* block {nullptr};
+    };
+
+    void slab_after_thread_exit() {
+        void* freed = nullptr;
+        std::thread([&] {
+            thread_local late_holder h;
+            h.block = sim::slab::allocate(1000);
+            freed = h.block;
+        }).join();
+        void* got = nullptr;
+        std::thread([&] {
+            got = sim::slab::allocate(1000);
+            sim::slab::deallocate(got, 1000);
+        }).join();
+        CHECK(freed != nullptr);
+        CHECK(got == freed);
+    }
+
+    void arena_scopes() {
+        sim::arena a(1024);
+        auto first = a.allocate(10);
+        {
+            sim::arena::scope s(a);
+            auto p = static_cast<uint8_t*>(a.allocate(100, 64));
+            CHECK(reinterpret_cast<uintptr_t>(p) % 64 == 0);
+            {
+                sim::arena::scope inner(a);
+                // bigger than a chunk: gets a chunk of its own.
+                auto big = a.allocate(4096);
+                std::memset(big, 0, 4096);
+            }
+            CHECK(a.allocate(100, 64) != p);
+        }
+        // rewound to just after first, so the same memory comes back.
+        auto again = a.allocate(100, 64);
+        {
+            sim::arena::scope s(a);
+            a.allocate(500);
+        }
+        CHECK(a.allocate(1) != first);
+        a.reset();
+        CHECK(a.allocate(10) == first);
+        a.reset();
+        a.allocate(10);
+        CHECK(a.allocate(100, 64) == again);
+    }
+
+    void arena_vectors() {
+        auto& a = sim::arena::local();
+        const auto before = a.mark();
+        {
+            sim::arena::scope s(a);
+            sim::arena_vector<uint64_t> v;
+            for(uint64_t i = 0; i < 50000; i++) {
+                v.push_back(i);
+            }
+            CHECK(v[49999] == 49999);
+        }
+        const auto after = a.mark();
+        CHECK(after.chunk == before.chunk && after.offset == before.offset);
+    }
+}
+
+int main() {
+    slab_blocks();
+    slab_containers();
+    slab_cross_thread();
+    slab_after_thread_exit();
+    arena_scopes();
+    arena_vectors();
+    return test::result();
+}
@@ -0,0 +1,169 @@
+#include "check.hh"
+#include "sim/block_store.hh"
+
+#include <memory>
+#include <vector>
+
+//
+// block_store: what chain sync serves from.  lookups by hash and height,
+// bodies read back from the file once pruned, and a lagging store caught up
+// from another one's blocks.
+//
+
+namespace {
+
+    std::shared_ptr<sim::block> make_block(const sim::sha256_t& prev, int64_t n) {
+        auto b = std::make_shared<sim::block>();
+        for(int64_t i = 0; i < 3; i++) {
+            b->add_tx(std::make_shared<sim::tx>(n * 3 + i));
+        }
+        b->set_prev_block(prev);
+        return b;
+    }
+
+    std::vector<std::shared_ptr<sim::block>> make_chain(size_t n) {
+        std::vector<std::shared_ptr<sim::block>> chain;
+        sim::sha256_t prev {};
+        for(size_t i = 0; i < n; i++) {
+            chain.push_back(make_block(prev, int64_t(i)));
+            prev = chain.back()->hash();
+        }
+        return chain;
+    }
+
+    void lookups() {
+        auto chain = make_chain(100);
+        sim::block_store store(8);
+        for(auto& b : chain) {
+            store.append(b);
+        }
+        CHECK(store.size() == 100);
+        CHECK(store.resident() == 8);
+        CHECK(store.back().sha == chain.back()->hash());
+        for(size_t i = 0; i < chain.size(); i++) {
+            CHECK(store.at(i).sha == chain[i]->hash());
+            CHECK(store.height_of(chain[i]->hash()) == int64_t(i));
+            CHECK(store.contains(chain[i]->hash()));
+        }
+        CHECK(store.height_of(sim::sha256_t {}) == -1);
+        CHECK(store.get(sim::sha256_t {}) == nullptr);
+        CHECK(store.get(size_t(100)) == nullptr);
+
+        // only resident bodies are searched for txs.
+        CHECK(store.has_tx(chain.back()->txs()[0]->hash()));
+        CHECK(!store.has_tx(chain.front()->txs()[0]->hash()));
+    }
+
+    //
+    // a pruned body comes back from the file with the same hash, parent
+    // and txs.
+    void read_back() {
+        auto chain = make_chain(40);
+        sim::block_store store(4);
+        for(auto& b : chain) {
+            store.append(b);
+        }
+        const auto reads = store.reads();
+        for(size_t i = 0; i < 36; i++) {
+            auto b = store.get(i);
+            CHECK(b != nullptr);
+            if(!b) {
+                continue;
+            }
+            CHECK(b->hash() == chain[i]->hash());
+            CHECK(b->prev_block() == chain[i]->prev_block());
+            CHECK(b->txs().size() == 3);
+            CHECK(b->txs().size() == 3 && b->txs()[2]->hash() == chain[i]->txs()[2]->hash());
+        }
+        CHECK(store.reads() == reads + 36);
+        // resident ones don't touch the file.
+        CHECK(store.get(chain.back()->hash()) == chain.back());
+        CHECK(store.reads() == reads + 36);
+    }
+
+    //
+    // stores share the process's file, each in extents of its own that
+    // double in size; interleaved appends don't mix their records up.
+    void shared_file() {
+        std::vector<std::unique_ptr<sim::block_store>> stores;
+        std::vector<std::vector<std::shared_ptr<sim::block>>> chains;
+        for(int i = 0; i < 3; i++) {
+            stores.emplace_back(new sim::block_store(2));
+            chains.push_back(make_chain(2000));
+        }
+        for(size_t h = 0; h < 2000; h++) {
+            for(size_t i = 0; i < stores.size(); i++) {
+                stores[i]->append(chains[i][h]);
+            }
+        }
+        for(size_t i = 0; i < stores.size(); i++) {
+            auto& s = *stores[i];
+            // 2000 records of 292 bytes, 584 kB: 64 + 128 + 256 + 512 kB.
+            CHECK(s.file_bytes() == 2000 * 292);
+            CHECK(s.extents() == 4);
+            CHECK(s.reserved_bytes() == 15 * sim::block_store::min_extent);
+            for(size_t h = 0; h < 2000; h += 97) {
+                auto b = s.get(h);
+                CHECK(b && b->hash() == chains[i][h]->hash());
+            }
+        }
+        // a store made after some went away gets fresh extents past theirs.
+        stores.erase(stores.begin());
+        sim::block_store late(2);
+        auto chain = make_chain(50);
+        for(auto& b : chain) {
+            late.append(b);
+        }
+        auto b = late.get(size_t(0));
+        CHECK(b && b->hash() == chain[0]->hash());
+        CHECK(late.extents() == 1);
+
+        // a record bigger than an extent gets one of its own size.
+        sim::block_store big(1);
+        auto blk = std::make_shared<sim::block>();
+        for(int64_t i = 0; i < 2000; i++) {
+            blk->add_tx(std::make_shared<sim::tx>(i));
+        }
+        big.append(blk);
+        big.append(make_block(blk->hash(), 1));
+        auto back = big.get(size_t(0));
+        CHECK(back && back->hash() == blk->hash() && back->txs().size() == 2000);
+    }
+
+    //
+    // the sync data path: the lagging store's tip is found in the longer
+    // one, and the bodies after it are fetched from there and appended.
+    void catch_up() {
+        auto chain = make_chain(60);
+        sim::block_store ahead(8);
+        sim::block_store behind(8);
+        for(size_t i = 0; i < chain.size(); i++) {
+            ahead.append(chain[i]);
+            if(i < 10) {
+                behind.append(chain[i]);
+            }
+        }
+        const int64_t common = ahead.height_of(behind.back().sha);
+        CHECK(common == 9);
+        for(size_t h = size_t(common) + 1; h < ahead.size(); h++) {
+            auto b = ahead.get(ahead.at(h).sha);
+            CHECK(b && b->prev_block() == behind.back().sha);
+            if(!b) {
+                break;
+            }
+            behind.append(b);
+        }
+        CHECK(behind.size() == ahead.size());
+        for(size_t i = 0; i < ahead.size() && i < behind.size(); i++) {
+            CHECK(behind.at(i).sha == ahead.at(i).sha);
+        }
+    }
+}
+
+int main() {
+    lookups();
+    read_back();
+    shared_file();
+    catch_up();
+    return test::result();
+}
@@ -0,0 +1,34 @@
+#ifndef SIM_TEST_CHECK_HH
+#define SIM_TEST_CHECK_HH
+
+#include <cstdio>
+#include <cstdlib>
+
+//
+// minimal test support: CHECK(cond) reports a failed condition and carries
+// on, main() returns test::result() so ctest sees the failure.
+//
+namespace test {
+    inline int& failures() {
+        static int n = 0;
+        return n;
+    }
+
+    inline int result() {
+        if(failures() > 0) {
+            fprintf(stderr, "%d check(s) failed\n", failures());
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+}
+
+#define CHECK(cond) \
+    do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test::failures()++; \
+        } \
+    } while(0)
+
+#endif /* SIM_TEST_CHECK_HH */
@@ -0,0 +1,94 @@
+#include "check.hh"
+#include "sim/cpu.hh"
+
+#include <vector>
+
+//
+// per-node virtual cpu: work runs while the step's budget lasts, is queued
+// and paid down over later steps once it doesn't, and is counted either way.
+//
+
+namespace {
+
+    void submit_and_defer() {
+        sim::cpu c(10);
+        std::vector<int> ran;
+        c.step(1);
+        CHECK(c.submit(4, [&] { ran.push_back(1); }));
+        CHECK(ran == std::vector<int> { 1 });
+        CHECK(c.try_spend(5));
+        CHECK(!c.try_spend(2));
+
+        // 1 unit left: it goes towards the head job, the rest waits.
+        CHECK(!c.submit(7, [&] { ran.push_back(2); }));
+        // behind queued work even though it would fit on its own.
+        CHECK(!c.submit(1, [&] { ran.push_back(3); }));
+        CHECK(!c.try_spend(0.5));
+        CHECK(c.backlog() == 2);
+        CHECK(c.deferred() == 2);
+        CHECK(ran.size() == 1);
+
+        // the next step pays 6 and 1, in order, and has 3 left.
+        c.step(2);
+        CHECK((ran == std::vector<int> { 1, 2, 3 }));
+        CHECK(c.backlog() == 0);
+        c.step(2);
+        CHECK(c.work() == 4 + 5 + 7 + 1);
+        CHECK(c.utilization() == 17.0 / 20);
+        CHECK(c.try_spend(3));
+        CHECK(!c.try_spend(0.1));
+    }
+
+    //
+    // a job larger than the budget is paid down over as many steps as it
+    // takes and runs in the step that finishes paying for it.
+    void pay_down() {
+        sim::cpu c(10);
+        c.step(1);
+        CHECK(c.try_spend(7));
+        bool ran = false;
+        CHECK(!c.submit(25, [&] { ran = true; }));
+        c.step(2);
+        CHECK(!ran && c.backlog() == 1);
+        c.step(3);
+        CHECK(!ran);
+        c.step(4);
+        CHECK(ran && c.backlog() == 0);
+        CHECK(c.work() == 32);
+        // steps without work still count towards utilization.
+        c.step(8);
+        CHECK(c.utilization() == 32.0 / 80);
+    }
+
+    void unlimited() {
+        sim::cpu c;
+        c.step(1);
+        int ran = 0;
+        for(int i = 0; i < 10; i++) {
+            CHECK(c.submit(1000, [&] { ran++; }));
+            CHECK(c.try_spend(1000));
+        }
+        CHECK(ran == 10);
+        CHECK(c.work() == 20000);
+        CHECK(c.deferred() == 0 && c.backlog() == 0);
+        CHECK(c.utilization() == 0);
+    }
+
+    void costs() {
+        sim::cost_model m;
+        CHECK(m.hash_bytes(64) == m.hash + 64 * m.per_byte);
+        CHECK(m.merkle(0) == 0 && m.merkle(1) == 0);
+        // 5 leaves pad to 8: 7 inner nodes.
+        CHECK(m.merkle(5) == 7 * m.hash_bytes(64));
+        CHECK(m.merkle(8) == 7 * m.hash_bytes(64));
+        CHECK(m.merkle(9) == 15 * m.hash_bytes(64));
+    }
+}
+
+int main() {
+    submit_and_defer();
+    pay_down();
+    unlimited();
+    costs();
+    return test::result();
+}
@@ -0,0 +1,293 @@
+#include "check.hh"
+#include "sim/crowd.hh"
+
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+
+//
+// delay and vote models, the delay model against a full run, and a crowd
+// relaying between plain nodes: each packet once, late copies dropped,
+// links followed as they change.
+//
+
+namespace {
+
+    void delay_record() {
+        sim::delay_model d;
+        CHECK(d.empty());
+        CHECK(d.max() == 1);
+        d.record(3, 2);
+        d.record(5);
+        d.record(0); // counts as 1
+        CHECK(d.samples() == 4);
+        CHECK(d.max() == 5);
+        CHECK(std::abs(d.mean() - 3.0) < 1e-9);
+        CHECK(d.quantile(0) == 1);
+        CHECK(d.quantile(0.5) == 3);
+        CHECK(d.quantile(1) == 5);
+
+        std::mt19937_64 gen(1);
+        std::vector<uint64_t> drawn(6, 0);
+        const size_t draws = 40000;
+        for(size_t i = 0; i < draws; i++) {
+            auto v = d.sample(gen);
+            CHECK(v == 1 || v == 3 || v == 5);
+            if(v >= 0 && v < 6) {
+                drawn[size_t(v)]++;
+            }
+        }
+        CHECK(std::abs(double(drawn[1]) / draws - 0.25) < 0.02);
+        CHECK(std::abs(double(drawn[3]) / draws - 0.5) < 0.02);
+        CHECK(std::abs(double(drawn[5]) / draws - 0.25) < 0.02);
+    }
+
+    //
+    // on a ring of 10 with unit latencies every source sees 1, 1, 2, 2,
+    // 3, 3, 4, 4, 5; per_hop adds a step to each hop.
+    void delay_from_topology() {
+        auto ring = sim::topology::watts_strogatz(10, 2, 0.0, 1);
+        CHECK(ring.edges.size() == 10);
+        auto d = sim::delay_model::from_topology(ring, 4, 3);
+        CHECK(d.samples() == 4 * 9);
+        CHECK(d.max() == 5);
+        CHECK(std::abs(d.mean() - 25.0 / 9) < 1e-9);
+        CHECK(d.quantile(0) == 1);
+        auto slow = sim::delay_model::from_topology(ring, 4, 3, 1);
+        CHECK(slow.max() == 10);
+        CHECK(std::abs(slow.mean() - 50.0 / 9) < 1e-9);
+        CHECK(sim::delay_model::from_topology(sim::topology(), 4, 3).empty());
+    }
+
+    //
+    // votes drawn from known parameters fit back to them.
+    void vote_fit() {
+        sim::vote_model truth;
+        truth.participation = 0.6;
+        truth.follow = 0.7;
+        std::mt19937_64 gen(5);
+        sim::vote_model fit;
+        const uint64_t members = 10000;
+        std::vector<std::vector<uint64_t>> rounds {
+            { 50, 30, 20 }, { 10, 80, 10 }, { 5, 5, 5, 6 }, { 40, 60 }
+        };
+        for(int r = 0; r < 50; r++) {
+            auto& seen = rounds[size_t(r) % rounds.size()];
+            auto votes = truth.votes(seen, members, gen);
+            uint64_t total = 0;
+            for(auto v : votes) {
+                total += v;
+            }
+            CHECK(total <= members);
+            fit.observe(seen, votes, members);
+        }
+        CHECK(std::abs(fit.participation - 0.6) < 0.01);
+        CHECK(std::abs(fit.follow - 0.7) < 0.02);
+
+        // nothing seen: no votes, and nothing to fit.
+        std::vector<uint64_t> none { 0, 0 };
+        auto votes = truth.votes(none, members, gen);
+        CHECK(votes[0] == 0 && votes[1] == 0);
+        const double p = fit.participation;
+        fit.observe(none, votes, members);
+        CHECK(fit.participation == p);
+    }
+
+    struct msg {
+        uint64_t id;
+    };
+
+    uint64_t digest_value(const msg& m) {
+        return m.id;
+    }
+
+    struct sink : sim::node<msg> {
+        using sim::node<msg>::node;
+
+        void packet_callback(const msg& m) override {
+            heard.push_back(m.id);
+        }
+
+        size_t count(uint64_t id) const {
+            return size_t(std::count(heard.begin(), heard.end(), id));
+        }
+
+        std::vector<uint64_t> heard;
+    };
+
+    //
+    // a relay of a fully simulated population: forwards a packet to every
+    // peer the step it first arrives.
+    struct relay : sim::node<msg> {
+        using sim::node<msg>::node;
+
+        void packet_callback(const msg& m) override {
+            if(at < 0) {
+                at = engine_.current_step();
+                send_packet(m);
+            }
+        }
+
+        int64_t at {-1};
+    };
+
+    //
+    // the delays from_topology() samples are the ones flooding the same
+    // relays in a full run takes, hop for hop, with nothing per hop.
+    void delays_match_full_run() {
+        auto t = sim::topology::random_regular(300, 6, 3, { 1, 4 });
+        sim::engine e(1, 1);
+        std::deque<relay> relays;
+        for(uint32_t i = 0; i < t.nodes; i++) {
+            relays.emplace_back(e);
+        }
+        auto links = sim::connect<msg>(e, t, [&relays](uint32_t i) -> relay& {
+            return relays[i];
+        });
+        sim::delay_model full;
+        for(uint32_t src = 0; src < t.nodes; src += 10) {
+            for(auto& it : relays) {
+                it.at = -1;
+            }
+            const int64_t start = e.current_step();
+            relays[src].at = start;
+            relays[src].send_packet(msg { src });
+            for(int i = 0; i < 60; i++) {
+                e.step();
+            }
+            for(uint32_t v = 0; v < t.nodes; v++) {
+                CHECK(relays[v].at >= 0);
+                if(v != src) {
+                    full.record(relays[v].at - start);
+                }
+            }
+        }
+        auto model = sim::delay_model::from_topology(t, 30, 3);
+        CHECK(std::abs(model.mean() - full.mean()) < 0.05 * full.mean());
+        CHECK(model.quantile(0.5) == full.quantile(0.5));
+        CHECK(std::abs(model.quantile(0.9) - full.quantile(0.9)) <= 1);
+        CHECK(std::abs(model.max() - full.max()) <= 1);
+        // a step per hop would be far off.
+        CHECK(sim::delay_model::from_topology(t, 30, 3, 1).mean() > 1.3 * full.mean());
+    }
+
+    struct setup {
+        setup(int64_t horizon = 0)
+        : e(1, 1)
+        , c(e, 1000, delays(), 7, horizon) {
+            e.register_component(c);
+            c.on_arrival([this](const msg&, int64_t) {
+                arrivals++;
+            });
+        }
+
+        static sim::delay_model delays() {
+            sim::delay_model d;
+            d.record(2);
+            return d;
+        }
+
+        void join(sink& s) {
+            auto lk = std::make_shared<sim::link<msg>>(1);
+            e.register_component(*lk);
+            sim::node<msg>::join(s, c, lk);
+            // registered links must outlive a disconnect.
+            links.push_back(lk);
+        }
+
+        void run(int steps) {
+            for(int i = 0; i < steps; i++) {
+                e.step();
+            }
+        }
+
+        sim::engine e;
+        sim::crowd<msg> c;
+        std::vector<std::shared_ptr<sim::link<msg>>> links;
+        size_t arrivals {0};
+    };
+
+    //
+    // a copy sent back in long after the flight is over is not relayed
+    // again and is not a new arrival.
+    void late_copy_dropped() {
+        setup s;
+        sink a(s.e), b(s.e);
+        s.join(a);
+        s.join(b);
+        a.send_packet(msg { 1 });
+        s.run(40);
+        CHECK(b.count(1) == 1);
+        CHECK(a.count(1) == 0);
+        CHECK(s.arrivals == 1);
+        CHECK(s.c.in_flight() == 0);
+        const auto relayed = s.c.relayed();
+        b.send_packet(msg { 1 });
+        s.run(40);
+        CHECK(a.count(1) == 0);
+        CHECK(b.count(1) == 1);
+        CHECK(s.arrivals == 1);
+        CHECK(s.c.relayed() == relayed);
+        CHECK(s.c.remembered() == 1);
+    }
+
+    //
+    // with a horizon, a packet is forgotten after it and may cross again.
+    void horizon_forgets() {
+        setup s(20);
+        sink a(s.e), b(s.e);
+        s.join(a);
+        s.join(b);
+        a.send_packet(msg { 1 });
+        s.run(40);
+        CHECK(s.c.remembered() == 0);
+        b.send_packet(msg { 1 });
+        s.run(40);
+        CHECK(a.count(1) == 1);
+        CHECK(s.arrivals == 2);
+    }
+
+    //
+    // swapping one link for another between steps keeps the link count
+    // but not the links; the crowd follows, and a flight under way when a
+    // link joins doesn't reach it.
+    void links_followed() {
+        setup s;
+        sink a(s.e), b(s.e), x(s.e), y(s.e);
+        s.join(a);
+        s.join(b);
+        a.send_packet(msg { 1 });
+        s.run(20);
+        CHECK(b.count(1) == 1);
+
+        b.disconnect(s.c);
+        s.join(x);
+        CHECK(s.c.connections() == 2);
+        a.send_packet(msg { 2 });
+        s.run(3);
+        s.join(y);
+        s.run(20);
+        CHECK(x.count(2) == 1);
+        CHECK(b.count(2) == 0);
+        CHECK(y.count(2) == 0);
+
+        y.send_packet(msg { 3 });
+        s.run(20);
+        CHECK(a.count(3) == 1);
+        CHECK(x.count(3) == 1);
+        CHECK(b.count(3) == 0);
+    }
+}
+
+int main() {
+    delay_record();
+    delay_from_topology();
+    vote_fit();
+    delays_match_full_run();
+    late_copy_dropped();
+    horizon_forgets();
+    links_followed();
+    return test::result();
+}
@@ -0,0 +1,163 @@
+#include "check.hh"
+#include "sim/dag_store.hh"
+
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+//
+// dag_store: cumulative weights within and beyond the horizon, the tip set
+// and approvers, rejected attaches, and the weighted walk.
+//
+
+namespace {
+
+    using store = sim::dag_store<>;
+
+    std::shared_ptr<sim::tx> make_tx(uint64_t id, const sim::sha256_t& trunk = {}, const sim::sha256_t& branch = {}) {
+        auto t = std::make_shared<sim::tx>();
+        t->set_trunk(trunk);
+        t->set_branch(branch);
+        t->edit_payload([id](std::vector<uint8_t>& p) {
+            p.resize(sizeof(id));
+            std::memcpy(p.data(), &id, sizeof(id));
+        });
+        return t;
+    }
+
+    bool is_tip(const store& d, store::index_t idx) {
+        for(auto t : d.tips()) {
+            if(t == idx) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //
+    // g <- a, g <- b, a and b <- c.
+    void diamond() {
+        store d;
+        auto g = make_tx(0);
+        auto a = make_tx(1, g->hash(), g->hash());
+        auto b = make_tx(2, g->hash());
+        auto c = make_tx(3, a->hash(), b->hash());
+        CHECK(d.attach(g) == store::attach_result::attached);
+        CHECK(d.tips().size() == 1 && d.tips()[0] == 0);
+        CHECK(d.attach(a) == store::attach_result::attached);
+        CHECK(d.tips().size() == 1 && d.tips()[0] == 1);
+        CHECK(d.attach(b) == store::attach_result::attached);
+        CHECK(d.tips().size() == 2 && is_tip(d, 1) && is_tip(d, 2));
+        CHECK(d.attach(c) == store::attach_result::attached);
+        CHECK(d.tips().size() == 1 && d.tips()[0] == 3);
+
+        CHECK(d.size() == 4);
+        CHECK(d.at(0).weight == 4);
+        CHECK(d.at(1).weight == 2);
+        CHECK(d.at(2).weight == 2);
+        CHECK(d.at(3).weight == 1);
+        CHECK(d.at(3).height == 2);
+        // a approves g twice but is listed once.
+        CHECK((d.at(0).approvers == std::vector<store::index_t> { 1, 2 }));
+        CHECK((d.at(1).approvers == std::vector<store::index_t> { 3 }));
+        CHECK(d.at(0).trunk == store::none && d.at(2).branch == store::none);
+        CHECK(d.at(3).trunk == 1 && d.at(3).branch == 2);
+        CHECK(d.find(c->hash()) == 3);
+        CHECK(d.get(b->hash()) == b);
+        CHECK(d.contains(a->hash()));
+    }
+
+    void rejected() {
+        store d;
+        auto g = make_tx(0);
+        CHECK(d.attach(g) == store::attach_result::attached);
+        CHECK(d.attach(make_tx(0)) == store::attach_result::duplicate);
+        auto orphan = make_tx(1, g->hash(), make_tx(99)->hash());
+        CHECK(d.attach(orphan) == store::attach_result::missing_parent);
+        CHECK(d.size() == 1);
+        CHECK(!d.contains(orphan->hash()));
+        CHECK(d.find(orphan->hash()) == store::none);
+        CHECK(d.get(orphan->hash()) == nullptr);
+        CHECK(d.at(0).weight == 1 && d.at(0).approvers.empty());
+        CHECK(d.tips().size() == 1 && d.tips()[0] == 0);
+    }
+
+    //
+    // on a chain of 10, exact weights count every tx above; with a
+    // horizon of 3 a tx gains weight from the 3 generations above it only.
+    void horizon() {
+        store exact(0);
+        store bounded(3);
+        sim::sha256_t prev {};
+        for(uint64_t i = 0; i < 10; i++) {
+            auto t = make_tx(i, prev);
+            prev = t->hash();
+            exact.attach(t);
+            bounded.attach(t);
+        }
+        for(store::index_t i = 0; i < 10; i++) {
+            CHECK(exact.at(i).weight == 10 - i);
+            CHECK(bounded.at(i).weight == std::min<uint64_t>(4, 10 - i));
+        }
+    }
+
+    //
+    // g has a heavy approver a (with a chain of 3 on top) and a light
+    // one b.  a strong bias always walks to a's chain, none splits evenly.
+    void walks() {
+        store d;
+        auto g = make_tx(0);
+        auto a = make_tx(1, g->hash());
+        auto b = make_tx(2, g->hash());
+        auto a2 = make_tx(3, a->hash());
+        auto a3 = make_tx(4, a2->hash());
+        auto a4 = make_tx(5, a3->hash());
+        for(auto& t : { g, a, b, a2, a3, a4 }) {
+            d.attach(t);
+        }
+        CHECK(d.at(1).weight == 4 && d.at(2).weight == 1);
+        std::mt19937_64 gen(3);
+        std::uniform_real_distribution<double> u(0, 1);
+        auto rand01 = [&] { return u(gen); };
+
+        const int n = 4000;
+        int heavy = 0;
+        for(int i = 0; i < n; i++) {
+            heavy += d.walk(0, 10.0, rand01) == 5;
+        }
+        CHECK(heavy == n);
+        heavy = 0;
+        for(int i = 0; i < n; i++) {
+            auto end = d.walk(0, 0.0, rand01);
+            CHECK(end == 5 || end == 2);
+            heavy += end == 5;
+        }
+        CHECK(std::abs(double(heavy) / n - 0.5) < 0.05);
+        // a walk from a tip stays there.
+        CHECK(d.walk(2, 1.0, rand01) == 2);
+
+        // select_tip ends on a tip whatever the depth; backing off far
+        // enough with a strong bias always lands on the heavy side.
+        for(uint32_t depth : { 0, 1, 10 }) {
+            for(int i = 0; i < 100; i++) {
+                auto t = d.select_tip(10.0, depth, rand01);
+                CHECK(is_tip(d, t));
+                if(depth == 10) {
+                    CHECK(t == 5);
+                }
+            }
+        }
+        auto both = d.select_tips(0.0, 10, rand01);
+        CHECK(is_tip(d, both.first) && is_tip(d, both.second));
+        CHECK(store().select_tip(0.0, 1, rand01) == store::none);
+    }
+}
+
+int main() {
+    diamond();
+    rejected();
+    horizon();
+    walks();
+    return test::result();
+}
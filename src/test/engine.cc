@@ -0,0 +1,213 @@
+#include "check.hh"
+#include "sim/coro.hh"
+#include "sim/sim.hh"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//
+// engine randomness: what a component or behavior draws depends on the seed
+// and on its id, not on the thread count or on who else drew.  behaviors
+// digest into their own slots and see packets in the step they arrive.
+//
+
+namespace {
+
+    struct drawer : sim::component {
+        drawer(sim::engine& e) : e_(e) {
+            e_.register_component(*this);
+        }
+
+        void step() override {
+            for(int i = 0; i < 8; i++) {
+                draws.push_back(e_.rand_int<uint64_t>(0, ~uint64_t(0)));
+            }
+        }
+
+        std::vector<uint64_t> draws;
+    private:
+        sim::engine& e_;
+    };
+
+    struct packet {};
+
+    struct actor : sim::co_node<packet> {
+        actor(sim::engine& e, sim::co_scheduler& sched)
+        : sim::co_node<packet>(e, sched) {
+            spawn(draw());
+        }
+
+        sim::behavior draw() {
+            for(;;) {
+                draws.push_back(engine_.rand_int<uint64_t>(0, ~uint64_t(0)));
+                co_await sleep(1);
+            }
+        }
+
+        std::vector<uint64_t> draws;
+    };
+
+    struct run_t {
+        std::vector<std::vector<uint64_t>> draws;
+        sim::digest::trace trace;
+    };
+
+    run_t run(size_t threads, size_t components, size_t actors) {
+        sim::engine e(42, threads);
+        sim::co_scheduler sched(e);
+        std::vector<std::unique_ptr<drawer>> d;
+        std::vector<std::unique_ptr<actor>> a;
+        for(size_t i = 0; i < components; i++) {
+            d.emplace_back(new drawer(e));
+        }
+        for(size_t i = 0; i < actors; i++) {
+            a.emplace_back(new actor(e, sched));
+        }
+        e.enable_digest();
+        for(int s = 0; s < 20; s++) {
+            e.step();
+        }
+        run_t r;
+        for(auto& it : d) {
+            r.draws.push_back(it->draws);
+        }
+        for(auto& it : a) {
+            r.draws.push_back(it->draws);
+        }
+        r.trace = e.digest_trace();
+        return r;
+    }
+
+    void same_for_any_thread_count() {
+        auto one = run(1, 64, 64);
+        CHECK(one.draws.size() == 128);
+        CHECK(one.draws.front().size() == 20 * 8);
+        CHECK(!one.draws.back().empty());
+        for(size_t threads : { 2, 4, 7 }) {
+            auto many = run(threads, 64, 64);
+            CHECK(many.draws == one.draws);
+            CHECK(!sim::digest::compare(one.trace, many.trace));
+        }
+    }
+
+    //
+    // adding a component doesn't change what the ones before it draw, and
+    // streams don't repeat each other.
+    void streams_independent() {
+        auto small = run(4, 8, 0);
+        auto large = run(4, 32, 0);
+        for(size_t i = 0; i < small.draws.size(); i++) {
+            CHECK(small.draws[i] == large.draws[i]);
+        }
+        CHECK(large.draws[0] != large.draws[1]);
+    }
+
+    //
+    // a behavior's draws land in its node's slot, not the engine's.
+    void behaviors_digested() {
+        sim::engine e(42, 4);
+        sim::co_scheduler sched(e);
+        drawer d(e);
+        actor a(e, sched);
+        e.enable_digest(true);
+        e.step();
+        e.step();
+        auto& slots = e.digest_trace().slots;
+        CHECK(slots.size() == 2);
+        CHECK(slots[1].size() == 3);
+        CHECK(slots[1][d.id()] != sim::digest::seed);
+        CHECK(slots[1][1] != sim::digest::seed);
+        CHECK(slots[1][2] == sim::digest::seed);
+    }
+
+    struct echo : sim::co_node<packet> {
+        echo(sim::engine& e, sim::co_scheduler& sched, bool serve)
+        : sim::co_node<packet>(e, sched) {
+            spawn(run(serve));
+        }
+
+        sim::behavior run(bool serve) {
+            if(serve) {
+                send_packet(packet {});
+            }
+            for(;;) {
+                co_await next_packet();
+                heard.push_back(now());
+                send_packet(packet {});
+            }
+        }
+
+        std::vector<int64_t> heard;
+    };
+
+    //
+    // a hop over a link of latency n takes n steps, there and back again.
+    void hop_takes_latency() {
+        for(int latency : { 1, 3 }) {
+            sim::engine e(1, 2);
+            sim::co_scheduler sched(e);
+            echo a(e, sched, true);
+            echo b(e, sched, false);
+            a.connect(b, latency);
+            for(int s = 0; s < 20; s++) {
+                e.step();
+            }
+            // a serves in step 1.
+            CHECK(!b.heard.empty() && b.heard[0] == 1 + latency);
+            CHECK(!a.heard.empty() && a.heard[0] == 1 + 2 * latency);
+            for(size_t i = 1; i < a.heard.size(); i++) {
+                CHECK(a.heard[i] - a.heard[i - 1] == 2 * latency);
+            }
+        }
+    }
+
+    struct counter : sim::node<packet> {
+        using sim::node<packet>::node;
+        void on_packets(const sim::link<packet>&, sim::span<const packet> pkts) override {
+            got += pkts.size();
+        }
+        size_t got {0};
+    };
+
+    struct doubler : counter {
+        using counter::counter;
+        void on_packets(const sim::link<packet>&, sim::span<const packet> pkts) override {
+            got += 2 * pkts.size();
+        }
+    };
+
+    //
+    // join calls on_packets of the static type when that is the dynamic
+    // one, and still reaches an override further down when it isn't.
+    void join_delivery() {
+        sim::engine e(1, 1);
+        counter a(e);
+        counter b(e);
+        doubler c(e);
+        auto ab = std::make_shared<sim::link<packet>>(1);
+        auto ac = std::make_shared<sim::link<packet>>(1);
+        e.register_component(*ab);
+        e.register_component(*ac);
+        sim::node<packet>::join(a, b, ab);
+        counter& as_counter = c;
+        sim::node<packet>::join(a, as_counter, ac);
+        CHECK(a.connections() == 2 && b.connections() == 1 && c.connections() == 1);
+        for(int i = 0; i < 5; i++) {
+            a.send_packet(packet {});
+        }
+        e.step();
+        e.step();
+        CHECK(b.got == 5);
+        CHECK(c.got == 10);
+    }
+}
+
+int main() {
+    same_for_any_thread_count();
+    streams_independent();
+    behaviors_digested();
+    hop_takes_latency();
+    join_delivery();
+    return test::result();
+}
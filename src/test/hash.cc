@@ -0,0 +1,120 @@
+#include "check.hh"
+#include "sim/dag.hh"
+#include "sim/sha.hh"
+
+#include <cstdint>
+#include <vector>
+
+//
+// incremental merkle_tree against merkle256, and cached tx hashes.
+//
+
+namespace {
+
+    sim::sha256_t leaf(uint32_t i) {
+        return sim::sha256(reinterpret_cast<uint8_t*>(&i), sizeof(i));
+    }
+
+    //
+    // appending one leaf at a time, asking for the root in between, ends
+    // up at merkle256's root for every size, across power-of-two edges.
+    void push_back_matches() {
+        sim::merkle_tree tree;
+        std::vector<sim::sha256_t> leaves;
+        CHECK(tree.root() == sim::merkle256(leaves));
+        for(uint32_t i = 0; i < 70; i++) {
+            leaves.push_back(leaf(i));
+            tree.push_back(leaves.back());
+            CHECK(tree.size() == leaves.size());
+            CHECK(tree.root() == sim::merkle256(leaves));
+        }
+    }
+
+    //
+    // several appends between roots, as when a block takes a batch of txs.
+    void batched_push_back_matches() {
+        sim::merkle_tree tree;
+        std::vector<sim::sha256_t> leaves;
+        for(uint32_t batch : { 3, 1, 4, 8, 17, 32 }) {
+            for(uint32_t i = 0; i < batch; i++) {
+                leaves.push_back(leaf(uint32_t(leaves.size())));
+                tree.push_back(leaves.back());
+            }
+            CHECK(tree.root() == sim::merkle256(leaves));
+        }
+    }
+
+    //
+    // set() on any leaf, including the last of an odd level.
+    void set_matches() {
+        for(uint32_t n : { 1, 2, 5, 8, 13 }) {
+            std::vector<sim::sha256_t> leaves;
+            for(uint32_t i = 0; i < n; i++) {
+                leaves.push_back(leaf(i));
+            }
+            sim::merkle_tree tree;
+            tree.assign(leaves);
+            CHECK(tree.root() == sim::merkle256(leaves));
+            for(uint32_t i = 0; i < n; i++) {
+                leaves[i] = leaf(1000 + i);
+                tree.set(i, leaves[i]);
+                CHECK(tree.root() == sim::merkle256(leaves));
+            }
+            leaves[0] = leaf(2000);
+            leaves[n - 1] = leaf(2001);
+            tree.set(0, leaves[0]);
+            tree.set(n - 1, leaves[n - 1]);
+            CHECK(tree.root() == sim::merkle256(leaves));
+        }
+    }
+
+    //
+    // a copy keeps pending changes and diverges independently.
+    void copy_independent() {
+        std::vector<sim::sha256_t> leaves { leaf(0), leaf(1), leaf(2) };
+        sim::merkle_tree tree;
+        tree.assign(leaves);
+        sim::merkle_tree copy(tree);
+        CHECK(copy.root() == sim::merkle256(leaves));
+        copy.push_back(leaf(3));
+        CHECK(tree.root() == sim::merkle256(leaves));
+        leaves.push_back(leaf(3));
+        CHECK(copy.root() == sim::merkle256(leaves));
+    }
+
+    //
+    // tx hash is recomputed after every mutator, and not before.
+    void tx_hash_invalidated() {
+        sim::tx t;
+        const auto empty = t.hash();
+        t.set_trunk(leaf(1));
+        const auto trunk = t.hash();
+        CHECK(trunk != empty);
+        t.set_branch(leaf(2));
+        const auto branch = t.hash();
+        CHECK(branch != trunk);
+        sim::sha256_t inside {};
+        t.edit_payload([&](std::vector<uint8_t>& p) {
+            p.push_back(7);
+            inside = t.hash();
+        });
+        CHECK(inside == branch);
+        CHECK(t.hash() != branch);
+        CHECK(t.payload().size() == 1);
+
+        sim::tx u;
+        u.set_trunk(leaf(1));
+        u.set_branch(leaf(2));
+        u.edit_payload([](std::vector<uint8_t>& p) { p.push_back(7); });
+        CHECK(u.hash() == t.hash());
+    }
+}
+
+int main() {
+    push_back_matches();
+    batched_push_back_matches();
+    set_matches();
+    copy_independent();
+    tx_hash_invalidated();
+    return test::result();
+}
@@ -0,0 +1,52 @@
+#include "check.hh"
+#include "sim/memory.hh"
+
+#include <thread>
+#include <vector>
+
+//
+// memory accounting: off until enabled, then counted per tag across threads.
+//
+
+namespace {
+
+    using chain_vector = std::vector<uint64_t, sim::tagged_allocator<uint64_t, sim::memory::chain>>;
+
+    void off_until_enabled() {
+        CHECK(!sim::memory::enabled());
+        {
+            chain_vector v(1000);
+        }
+        auto before = sim::memory::total(sim::memory::chain);
+        CHECK(before.allocs == 0);
+        CHECK(before.allocated == 0);
+    }
+
+    void counted_once_enabled() {
+        sim::memory::meter m;
+        CHECK(sim::memory::enabled());
+        auto base = sim::memory::total(sim::memory::chain);
+        {
+            chain_vector v(1000);
+            auto in = sim::memory::total(sim::memory::chain);
+            CHECK(in.live - base.live == int64_t(1000 * sizeof(uint64_t)));
+            CHECK(in.allocs - base.allocs == 1);
+            m.sample();
+            CHECK(m[sim::memory::chain].last_step == 1000 * sizeof(uint64_t));
+        }
+        CHECK(sim::memory::total(sim::memory::chain).live == base.live);
+
+        // freed on another thread than the one that allocated.
+        auto v = new chain_vector(500);
+        std::thread([v] { delete v; }).join();
+        auto after = sim::memory::total(sim::memory::chain);
+        CHECK(after.live == base.live);
+        CHECK(after.allocated - base.allocated == 1500 * sizeof(uint64_t));
+    }
+}
+
+int main() {
+    off_until_enabled();
+    counted_once_enabled();
+    return test::result();
+}
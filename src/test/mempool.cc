@@ -0,0 +1,111 @@
+#include "check.hh"
+#include "sim/mempool.hh"
+
+#include <memory>
+#include <vector>
+
+//
+// mempool ordering, templates and eviction.
+//
+
+namespace {
+
+    //
+    // a tx whose hash is chosen by the test: byte 0 is n, the rest zero,
+    // so hash order is n order.
+    struct test_tx {
+        explicit test_tx(uint8_t n) {
+            sha[0] = n;
+        }
+        sim::sha256_t hash() const { return sha; }
+        sim::sha256_t sha {};
+    };
+
+    using pool = sim::mempool<test_tx>;
+
+    std::shared_ptr<test_tx> tx(uint8_t n) {
+        return std::make_shared<test_tx>(n);
+    }
+
+    std::vector<uint8_t> order(const pool& p) {
+        std::vector<uint8_t> res;
+        p.for_each([&res](const pool::tx_ptr& t) {
+            res.push_back(t->sha[0]);
+        });
+        return res;
+    }
+
+    void ordering_and_templates() {
+        pool p;
+        for(uint8_t n : { 5, 1, 9, 3, 7 }) {
+            CHECK(p.insert(tx(n)));
+        }
+        CHECK(!p.insert(tx(3))); // already pooled
+        CHECK(p.size() == 5);
+        CHECK(order(p) == std::vector<uint8_t>({ 1, 3, 5, 7, 9 }));
+        CHECK(p.contains(tx(7)->hash()) && !p.contains(tx(8)->hash()));
+
+        auto b = p.peek(3);
+        CHECK(b.txs.size() == 3 && b.txs[0]->sha[0] == 1 && b.txs[2]->sha[0] == 5);
+        CHECK(b.merkle == sim::merkle256({ tx(1)->hash(), tx(3)->hash(), tx(5)->hash() }));
+        CHECK(p.size() == 5);
+
+        auto taken = p.take(2);
+        CHECK(taken.merkle == sim::merkle256({ tx(1)->hash(), tx(3)->hash() }));
+        CHECK(order(p) == std::vector<uint8_t>({ 5, 7, 9 }));
+        CHECK(p.take(10).txs.size() == 3 && p.empty());
+        CHECK(p.peek(4).merkle == sim::sha256_t {});
+
+        CHECK(p.insert(tx(4)));
+        CHECK(p.erase(tx(4)->hash()) && !p.erase(tx(4)->hash()));
+        CHECK(p.empty());
+    }
+
+    void evict_last() {
+        pool p(3, pool::eviction::evict_last);
+        for(uint8_t n : { 2, 6, 4 }) {
+            p.insert(tx(n));
+        }
+        // a lower hash pushes out the highest.
+        CHECK(p.insert(tx(1)));
+        CHECK(order(p) == std::vector<uint8_t>({ 1, 2, 4 }));
+        // a higher one is itself the last and is turned away.
+        CHECK(!p.insert(tx(8)));
+        CHECK(order(p) == std::vector<uint8_t>({ 1, 2, 4 }));
+        CHECK(p.evicted() == 2 && p.size() == p.capacity());
+    }
+
+    void evict_oldest() {
+        pool p(3, pool::eviction::evict_oldest);
+        for(uint8_t n : { 2, 6, 4 }) {
+            p.insert(tx(n));
+        }
+        CHECK(p.insert(tx(9)));
+        CHECK(order(p) == std::vector<uint8_t>({ 4, 6, 9 }));
+        // taking from the pool keeps the age order of what's left.
+        p.erase(tx(6)->hash());
+        p.insert(tx(1));
+        CHECK(p.insert(tx(3)));
+        CHECK(order(p) == std::vector<uint8_t>({ 1, 3, 9 }));
+        CHECK(p.evicted() == 2);
+    }
+
+    void reject_new() {
+        pool p(2, pool::eviction::reject_new);
+        CHECK(p.insert(tx(5)) && p.insert(tx(7)));
+        CHECK(!p.insert(tx(1)));
+        CHECK(order(p) == std::vector<uint8_t>({ 5, 7 }));
+        p.take(1);
+        CHECK(p.insert(tx(1)));
+        CHECK(order(p) == std::vector<uint8_t>({ 1, 7 }));
+        CHECK(p.evicted() == 1);
+    }
+}
+
+int main() {
+    ordering_and_templates();
+    evict_last();
+    evict_oldest();
+    reject_new();
+    return test::result();
+}
@@ -0,0 +1,137 @@
+#include "check.hh"
+#include "sim/sim.hh"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+//
+// multicast links: one log shared by every attached node, read through
+// per-node cursors and reclaimed once all of them are past it.
+//
+
+namespace {
+
+    struct msg {
+        int value;
+    };
+
+    struct peer : sim::node<msg> {
+        using sim::node<msg>::node;
+
+        void packet_callback(const msg& m) override {
+            heard.emplace_back(m.value, engine_.current_step());
+        }
+
+        std::vector<int> values() const {
+            std::vector<int> v;
+            for(auto& it : heard) {
+                v.push_back(it.first);
+            }
+            return v;
+        }
+
+        std::vector<std::pair<int, int64_t>> heard; // value, step
+    };
+
+    struct bus {
+        bus(int64_t latency)
+        : e(1, 1)
+        , lk(std::make_shared<sim::link<msg>>(latency, sim::link<msg>::multicast)) {
+            e.register_component(*lk);
+        }
+
+        void run(int steps) {
+            for(int i = 0; i < steps; i++) {
+                e.step();
+            }
+        }
+
+        sim::engine e;
+        std::shared_ptr<sim::link<msg>> lk;
+    };
+
+    //
+    // a sender doesn't hear itself; everyone else hears each packet once,
+    // in send order, latency steps after it was sent.
+    void fanout_and_latency() {
+        for(int64_t latency : { 1, 4 }) {
+            bus b(latency);
+            peer p0(b.e), p1(b.e), p2(b.e);
+            for(auto p : { &p0, &p1, &p2 }) {
+                p->attach(b.lk);
+            }
+            b.run(3);
+            const int64_t sent_at = b.e.current_step();
+            p0.send_packet(msg { 1 });
+            p1.send_packet(msg { 2 });
+            p0.send_packet(msg { 3 });
+            b.run(10);
+            CHECK((p0.values() == std::vector<int> { 2 }));
+            CHECK((p1.values() == std::vector<int> { 1, 3 }));
+            CHECK((p2.values() == std::vector<int> { 1, 2, 3 }));
+            for(auto p : { &p0, &p1, &p2 }) {
+                for(auto& it : p->heard) {
+                    CHECK(it.second == sent_at + latency);
+                }
+            }
+            CHECK(b.lk->sent() == 3);
+        }
+    }
+
+    //
+    // a node that attaches hears what is sent from then on, not what is
+    // already in the log.
+    void late_joiner() {
+        bus b(3);
+        peer p0(b.e), p1(b.e), late(b.e);
+        p0.attach(b.lk);
+        p1.attach(b.lk);
+        p0.send_packet(msg { 1 });
+        b.run(1);
+        late.attach(b.lk);
+        p0.send_packet(msg { 2 });
+        b.run(10);
+        CHECK((p1.values() == std::vector<int> { 1, 2 }));
+        CHECK((late.values() == std::vector<int> { 2 }));
+        late.send_packet(msg { 3 });
+        b.run(10);
+        CHECK((p0.values() == std::vector<int> { 3 }));
+        CHECK((p1.values() == std::vector<int> { 1, 2, 3 }));
+    }
+
+    //
+    // entries stay in the log until every cursor is past them, then go.
+    void reclaimed() {
+        bus b(2);
+        peer p0(b.e), p1(b.e), p2(b.e);
+        for(auto p : { &p0, &p1, &p2 }) {
+            p->attach(b.lk);
+        }
+        for(int i = 0; i < 5; i++) {
+            p0.send_packet(msg { i });
+        }
+        // one entry per packet, not one per receiver.
+        CHECK(b.lk->queued() == 5);
+        b.e.step();
+        CHECK(b.lk->queued() == 5);
+        b.run(2);
+        CHECK(b.lk->queued() == 0);
+        CHECK(p2.values().size() == 5);
+
+        // nobody but the sender to hear it: nothing is logged.
+        bus lone(1);
+        peer only(lone.e);
+        only.attach(lone.lk);
+        only.send_packet(msg { 1 });
+        CHECK(lone.lk->queued() == 0);
+        CHECK(lone.lk->sent() == 1);
+    }
+}
+
+int main() {
+    fanout_and_latency();
+    late_joiner();
+    reclaimed();
+    return test::result();
+}
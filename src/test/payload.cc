@@ -0,0 +1,162 @@
+#include "check.hh"
+#include "../dag_temporal_sigs/payload.hh"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+//
+// dts payload codec: round trips and malformed input.
+//
+
+namespace {
+
+    using dts::op_t;
+    using dts::type_t;
+    namespace payload = dts::payload;
+
+    std::vector<payload::op_view> decode(const std::vector<uint8_t>& p, bool& ok) {
+        std::vector<payload::op_view> ops;
+        ok = payload::visit(p, [&ops](const payload::op_view& v) {
+            ops.push_back(v);
+        });
+        return ops;
+    }
+
+    void round_trip() {
+        sim::sha256_t token;
+        for(size_t i = 0; i < token.size(); i++) {
+            token[i] = uint8_t(i * 7);
+        }
+        const std::string long_str(70000, 'x');  // past the old 16-bit length
+        const std::string huge_str(1 << 21, 'y');
+        std::vector<uint8_t> p;
+        payload::append(p, op_t::Spend, int32_t(-5));
+        payload::append(p, op_t::Spend, int64_t(1) << 40);
+        payload::append(p, op_t::Data, 0.25f);
+        payload::append(p, op_t::Data, -1.5);
+        payload::append(p, op_t::CreateToken, token);
+        payload::append(p, op_t::Announce, "treasury@1a2b3c");
+        payload::append(p, op_t::Code, std::string());
+        payload::append(p, op_t::Code, long_str);
+        payload::append(p,
+            payload::field(op_t::Announce, huge_str),
+            payload::field(op_t::RevealToken, token),
+            payload::field(op_t::Data, std::string(127, 'a')),
+            payload::field(op_t::Data, std::string(128, 'b')));
+
+        bool ok = false;
+        auto ops = decode(p, ok);
+        CHECK(ok);
+        CHECK(ops.size() == 12);
+        if(ops.size() != 12) {
+            return;
+        }
+        CHECK(ops[0].op == op_t::Spend && ops[0].type == type_t::i32 && ops[0].as_i32() == -5);
+        CHECK(ops[1].type == type_t::i64 && ops[1].as_i64() == int64_t(1) << 40);
+        CHECK(ops[2].type == type_t::f32 && ops[2].as_f32() == 0.25f);
+        CHECK(ops[3].type == type_t::f64 && ops[3].as_f64() == -1.5);
+        CHECK(ops[4].op == op_t::CreateToken && ops[4].type == type_t::token && ops[4].as_token() == token);
+        CHECK(ops[5].op == op_t::Announce && ops[5].as_str() == "treasury@1a2b3c");
+        CHECK(ops[6].type == type_t::str && ops[6].as_str().empty());
+        CHECK(ops[7].as_str() == long_str);
+        CHECK(ops[8].as_str() == huge_str);
+        CHECK(ops[9].op == op_t::RevealToken && ops[9].as_token() == token);
+        CHECK(ops[10].as_str() == std::string(127, 'a'));
+        CHECK(ops[11].as_str() == std::string(128, 'b'));
+
+        // encoded_size is what append actually wrote.
+        size_t expected = 0;
+        expected += payload::encoded_size(int32_t(-5)) + payload::encoded_size(int64_t(0));
+        expected += payload::encoded_size(0.25f) + payload::encoded_size(-1.5);
+        expected += payload::encoded_size(token) + payload::encoded_size("treasury@1a2b3c");
+        expected += payload::encoded_size(std::string()) + payload::encoded_size(long_str);
+        expected += payload::encoded_size(huge_str) + payload::encoded_size(token);
+        expected += payload::encoded_size(std::string(127, 'a')) + payload::encoded_size(std::string(128, 'b'));
+        CHECK(p.size() == expected);
+        CHECK(payload::value_size(std::string(127, 'a')) == 1 + 127);
+        CHECK(payload::value_size(std::string(128, 'b')) == 2 + 128);
+        CHECK(payload::value_size(long_str) == 3 + long_str.size());
+    }
+
+    //
+    // lengths either side of the old u16 limit and of each varint byte
+    // boundary come back whole, with the length taking 1 to 4 bytes.
+    void length_boundaries() {
+        const std::vector<std::pair<size_t, size_t>> cases {
+            { 127, 1 }, { 128, 2 }, { 16383, 2 }, { 16384, 3 },
+            { 65535, 3 }, { 65536, 3 }, { 2097151, 3 }, { 2097152, 4 }
+        };
+        for(auto [len, prefix] : cases) {
+            const std::string s(len, char('a' + len % 26));
+            std::vector<uint8_t> p;
+            payload::append(p, op_t::Data, s);
+            CHECK(p.size() == payload::header_size + prefix + len);
+            bool ok = false;
+            auto ops = decode(p, ok);
+            CHECK(ok && ops.size() == 1);
+            CHECK(ops.size() == 1 && ops[0].as_str() == s);
+        }
+        // a literal is a string like any other, not a bare op byte.
+        std::vector<uint8_t> p;
+        payload::append(p, op_t::Announce, "treasury");
+        CHECK(p.size() == payload::header_size + 1 + 8);
+        CHECK(p[1] == uint8_t(type_t::str) && p[2] == 8);
+    }
+
+    //
+    // every truncation of a valid payload either ends on an op boundary
+    // (and reads as the ops before it) or is rejected.
+    void truncated() {
+        std::vector<uint8_t> p;
+        payload::append(p,
+            payload::field(op_t::Spend, int64_t(9)),
+            payload::field(op_t::Announce, std::string(300, 'z')),
+            payload::field(op_t::Data, 1.0f));
+        const std::vector<size_t> boundaries { 0, 10, 10 + 2 + 2 + 300, p.size() };
+        for(size_t n = 0; n <= p.size(); n++) {
+            std::vector<uint8_t> cut(p.begin(), p.begin() + n);
+            bool ok = false;
+            decode(cut, ok);
+            const bool boundary = std::find(boundaries.begin(), boundaries.end(), n) != boundaries.end();
+            CHECK(ok == boundary);
+        }
+    }
+
+    void malformed() {
+        bool ok = true;
+        // op out of range.
+        decode({ uint8_t(op_t::Data) + 1, uint8_t(type_t::i32), 0, 0, 0, 0 }, ok);
+        CHECK(!ok);
+        // type out of range.
+        decode({ uint8_t(op_t::Data), uint8_t(type_t::token) + 1, 0, 0, 0, 0 }, ok);
+        CHECK(!ok);
+        // string length past the end.
+        decode({ uint8_t(op_t::Code), uint8_t(type_t::str), 0x05, 'a', 'b' }, ok);
+        CHECK(!ok);
+        // length varint that never ends, and one that overflows 64 bits.
+        std::vector<uint8_t> endless { uint8_t(op_t::Code), uint8_t(type_t::str) };
+        endless.insert(endless.end(), 12, 0xff);
+        decode(endless, ok);
+        CHECK(!ok);
+        std::vector<uint8_t> overflow { uint8_t(op_t::Code), uint8_t(type_t::str) };
+        overflow.insert(overflow.end(), 9, 0xff);
+        overflow.push_back(0x02);
+        decode(overflow, ok);
+        CHECK(!ok);
+        // a huge but well-formed length is just past the end.
+        std::vector<uint8_t> huge { uint8_t(op_t::Code), uint8_t(type_t::str) };
+        huge.insert(huge.end(), 9, 0xff);
+        huge.push_back(0x01);
+        decode(huge, ok);
+        CHECK(!ok);
+    }
+}
+
+int main() {
+    round_trip();
+    length_boundaries();
+    truncated();
+    malformed();
+    return test::result();
+}
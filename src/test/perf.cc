@@ -0,0 +1,112 @@
+#include "check.hh"
+#include "sim/perf.hh"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <vector>
+
+//
+// profiler frames, whether or not the machine has counters to read.
+//
+
+namespace {
+
+    template <typename T>
+    struct box {};
+
+    namespace inner {
+        struct thing {};
+    }
+
+    void names() {
+        using sim::profiler;
+        CHECK(profiler::type_name(typeid(int).name()) == "int");
+        CHECK(profiler::type_name(typeid(box<int>).name()) == "anon::box<int>");
+        CHECK(profiler::type_name(typeid(box<std::vector<int>>).name()) == "anon::box<std::vector<...>>");
+        CHECK(profiler::type_name(typeid(box<inner::thing>).name()) == "anon::box<anon::inner::thing>");
+        CHECK(profiler::frame_name("a<b, c<d> >; e") == "a<b,c<...>>,e");
+        CHECK(profiler::folded_frame("step;send packets") == "step;send_packets");
+    }
+
+    //
+    // nested scopes give a frame per path; inherit carries the path to
+    // another thread.
+    void frames() {
+        sim::profiler prof;
+        CHECK(prof.available(sim::profiler::wall_ns));
+        sim::profiler::bind(&prof);
+        for(int i = 0; i < 3; i++) {
+            sim::profiler::scope outer("step");
+            {
+                sim::profiler::scope inner("deliver");
+            }
+            CHECK(sim::profiler::path() == "step");
+            auto path = sim::profiler::path();
+            std::thread([&prof, path] {
+                sim::profiler::bind(&prof);
+                sim::profiler::inherit in(path);
+                {
+                    sim::profiler::scope worker("worker thread");
+                }
+                sim::profiler::bind(nullptr);
+            }).join();
+        }
+        sim::profiler::bind(nullptr);
+        {
+            // unbound: not recorded.
+            sim::profiler::scope off("off");
+        }
+
+        auto all = prof.frames();
+        CHECK(all.size() == 3);
+        CHECK(all["step"].calls == 3);
+        CHECK(all["step;deliver"].calls == 3);
+        CHECK(all["step;worker thread"].calls == 3);
+        CHECK(all.count("off") == 0);
+        // a counter that is there is read; inclusive counts cover children.
+        for(int c = 0; c < sim::profiler::counter_count; c++) {
+            if(prof.available(sim::profiler::counter(c)) && c != sim::profiler::wall_ns) {
+                CHECK(all["step"].v[c] > 0);
+            }
+            CHECK(all["step"].v[c] >= all["step;deliver"].v[c]);
+        }
+    }
+
+    //
+    // every folded line is "frame;frame count", one space, no spaces in
+    // the frames.
+    void folded() {
+        sim::profiler prof;
+        sim::profiler::bind(&prof);
+        {
+            sim::profiler::scope a("step;" + sim::profiler::type_name(typeid(box<std::vector<int>>).name()));
+            sim::profiler::scope b("send packets");
+        }
+        sim::profiler::bind(nullptr);
+        std::ostringstream os;
+        prof.report(os);
+        const std::string out = os.str();
+        const auto at = out.find("folded (");
+        CHECK(at != std::string::npos);
+        std::istringstream lines(out.substr(out.find('\n', at) + 1));
+        std::string line;
+        size_t count = 0;
+        while(std::getline(lines, line)) {
+            CHECK(std::count(line.begin(), line.end(), ' ') == 1);
+            count++;
+        }
+        CHECK(count == 2);
+        CHECK(out.find("step;anon::box<std::vector<...>>;send_packets ") != std::string::npos);
+    }
+}
+
+int main() {
+    names();
+    frames();
+    folded();
+    return test::result();
+}
@@ -0,0 +1,103 @@
+#include "check.hh"
+#include "sim/scheduler.hh"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+//
+// work-stealing batch scheduler.
+//
+
+namespace {
+
+    //
+    // every index runs exactly once, whatever the size, grain and thread
+    // count, and state carries over cleanly from one batch to the next.
+    void every_item_once() {
+        for(size_t threads : { 1, 2, 4, 7 }) {
+            sim::scheduler sched(threads);
+            CHECK(sched.threads() == threads);
+            for(size_t n : { 0, 1, 5, 64, 1000, 100000 }) {
+                for(size_t grain : { 0, 1, 3, 64 }) {
+                    std::vector<std::atomic<uint32_t>> hits(n);
+                    auto fn = [&hits](size_t i) {
+                        hits[i].fetch_add(1, std::memory_order_relaxed);
+                    };
+                    sched.parallel_for(n, fn, grain);
+                    size_t wrong = 0;
+                    for(auto& h : hits) {
+                        wrong += h.load() != 1;
+                    }
+                    CHECK(wrong == 0);
+                }
+            }
+        }
+    }
+
+    //
+    // run() returns only after every task is done, and uses the other
+    // threads: with more tasks than threads that each wait a little, more
+    // than one thread ends up taking part.
+    void run_waits_for_all() {
+        sim::scheduler sched(4);
+        std::atomic<size_t> done {0};
+        std::mutex mut;
+        std::set<std::thread::id> ran_on;
+        struct ctx_t {
+            std::atomic<size_t>* done;
+            std::mutex* mut;
+            std::set<std::thread::id>* ran_on;
+        } ctx { &done, &mut, &ran_on };
+        std::vector<sim::scheduler::task> tasks;
+        for(size_t i = 0; i < 64; i++) {
+            tasks.push_back({ [](void* p, size_t begin, size_t end) {
+                auto c = static_cast<ctx_t*>(p);
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                {
+                    std::lock_guard<std::mutex> lk(*c->mut);
+                    c->ran_on->insert(std::this_thread::get_id());
+                }
+                c->done->fetch_add(end - begin);
+            }, &ctx, i * 10, i * 10 + 10 });
+        }
+        for(int round = 0; round < 3; round++) {
+            done = 0;
+            sched.run(tasks);
+            CHECK(done.load() == 640);
+        }
+        CHECK(ran_on.size() > 1);
+    }
+
+    //
+    // with an uneven split (one thread starts with most of the work and
+    // the others steal from it) every item is still covered once.
+    void splits_cover_all() {
+        const size_t threads = 3;
+        sim::scheduler sched(threads);
+        const size_t n = 3000;
+        std::vector<size_t> splits { 0, 100, 2900, n };
+        std::vector<std::atomic<uint32_t>> hits(n);
+        auto fn = [&hits](size_t i) {
+            hits[i].fetch_add(1, std::memory_order_relaxed);
+        };
+        for(int round = 0; round < 5; round++) {
+            sched.parallel_for(n, fn, 0, &splits);
+        }
+        size_t wrong = 0;
+        for(auto& h : hits) {
+            wrong += h.load() != 5;
+        }
+        CHECK(wrong == 0);
+    }
+}
+
+int main() {
+    every_item_once();
+    run_waits_for_all();
+    splits_cover_all();
+    return test::result();
+}
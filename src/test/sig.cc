@@ -0,0 +1,129 @@
+#include "check.hh"
+#include "sim/scheduler.hh"
+#include "sim/sig.hh"
+
+#include <cstring>
+#include <vector>
+
+//
+// signatures and the shared verifier cache: a forged or misattributed
+// signature never verifies, from the cache or otherwise, and a signature
+// checked once is found again however often it is asked for.
+//
+
+namespace {
+
+    sim::sha256_t seed_of(uint8_t n) {
+        sim::sha256_t s {};
+        s[0] = n;
+        s[31] = 0x5a;
+        return s;
+    }
+
+    sim::sha256_t digest_of(uint32_t n) {
+        uint8_t buf[sizeof(n)];
+        std::memcpy(buf, &n, sizeof(n));
+        return sim::sha256(buf, sizeof(buf));
+    }
+
+    void signatures() {
+        sim::keypair a(seed_of(1));
+        sim::keypair b(seed_of(2));
+        const auto d = digest_of(7);
+        const auto sig = a.sign(d);
+        CHECK(sim::verify(a.public_key(), d, sig));
+        // deterministic: same key and digest, same signature.
+        CHECK(sig == a.sign(d));
+        CHECK(sim::keypair(seed_of(1)).public_key() == a.public_key());
+
+        auto forged = sig;
+        forged[10] ^= 1;
+        CHECK(!sim::verify(a.public_key(), d, forged));
+        CHECK(!sim::verify(b.public_key(), d, sig));
+        CHECK(!sim::verify(a.public_key(), digest_of(8), sig));
+        sim::pubkey_t garbage {};
+        garbage[0] = 0xff;
+        CHECK(!sim::verify(garbage, d, sig));
+    }
+
+    void cache() {
+        sim::keypair a(seed_of(3));
+        sim::verifier v;
+        const auto d = digest_of(1);
+        sim::verifier::request good { a.public_key(), d, a.sign(d) };
+        auto bad = good;
+        bad.sig[0] ^= 0x80;
+
+        CHECK(v.check(good));
+        CHECK(v.counters().verified == 1 && v.counters().hits == 0);
+        for(int i = 0; i < 10; i++) {
+            CHECK(v.check(good));
+        }
+        // the nine other receipts of a gossiped tx are cache hits.
+        CHECK(v.counters().verified == 1 && v.counters().hits == 10);
+
+        // a forged copy has a cache key of its own, and its failure is
+        // remembered as a failure.
+        CHECK(!v.check(bad));
+        CHECK(!v.check(bad));
+        auto c = v.counters();
+        CHECK(c.verified == 2 && c.failed == 1 && c.hits == 11 && c.requests == 13);
+        CHECK(v.check(good));
+    }
+
+    //
+    // a batch is deduplicated before it is verified, and a result stays
+    // right whether it came from this batch, an earlier one or the check.
+    void batches() {
+        sim::scheduler sched(4);
+        sim::keypair a(seed_of(4));
+        sim::verifier v;
+        std::vector<sim::verifier::request> batch;
+        for(uint32_t i = 0; i < 20; i++) {
+            const auto d = digest_of(i);
+            batch.push_back({ a.public_key(), d, a.sign(d) });
+        }
+        batch[5].sig[3] ^= 1;
+        const size_t unique = batch.size();
+        batch.push_back(batch[0]);
+        batch.push_back(batch[5]);
+
+        std::vector<uint8_t> ok;
+        v.check(batch, ok, sched);
+        CHECK(ok.size() == batch.size());
+        for(size_t i = 0; i < batch.size(); i++) {
+            CHECK(ok[i] == (i != 5 && i != unique + 1));
+        }
+        auto c = v.counters();
+        CHECK(c.verified == unique && c.failed == 1 && c.hits == 2);
+
+        v.check(batch, ok, sched);
+        CHECK(v.counters().verified == unique && v.counters().hits == 2 + batch.size());
+        CHECK(!ok[5] && ok[0]);
+    }
+
+    //
+    // past its capacity the cache forgets the oldest results, which are
+    // then verified again.
+    void capacity() {
+        sim::keypair a(seed_of(5));
+        sim::verifier v(16); // one per shard
+        std::vector<sim::verifier::request> reqs;
+        for(uint32_t i = 0; i < 200; i++) {
+            const auto d = digest_of(i);
+            reqs.push_back({ a.public_key(), d, a.sign(d) });
+            CHECK(v.check(reqs.back()));
+        }
+        const auto before = v.counters().verified;
+        CHECK(v.check(reqs.front()));
+        CHECK(v.counters().verified == before + 1);
+    }
+}
+
+int main() {
+    signatures();
+    cache();
+    batches();
+    capacity();
+    return test::result();
+}
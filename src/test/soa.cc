@@ -0,0 +1,63 @@
+#include "check.hh"
+#include "sim/soa.hh"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//
+// structure-of-arrays tables.
+//
+
+namespace {
+
+    struct last_step : sim::column<int64_t> {};
+    struct flag : sim::column<uint8_t> {};
+    struct queue : sim::column<std::vector<std::unique_ptr<int>>> {};
+
+    void columns() {
+        sim::soa<last_step, flag, queue> t;
+        for(int64_t i = 0; i < 100; i++) {
+            const auto row = t.push_back();
+            CHECK(row == size_t(i));
+            // value-initialised
+            CHECK(t.get<last_step>()[row] == 0 && t.get<flag>()[row] == 0);
+            t.get<last_step>()[row] = i * 3;
+            t.get<flag>()[row] = i % 2;
+            t.get<queue>()[row].emplace_back(new int(int(i)));
+        }
+        CHECK(t.size() == 100);
+        CHECK(t.get<last_step>().size() == 100 && t.get<queue>().size() == 100);
+        int64_t sum = 0;
+        for(auto v : t.get<last_step>()) {
+            sum += v;
+        }
+        CHECK(sum == 3 * 99 * 100 / 2);
+        size_t set = 0;
+        for(auto v : t.get<flag>()) {
+            set += v;
+        }
+        CHECK(set == 50);
+        // rows survive the columns growing and moving.
+        CHECK(*t.get<queue>()[42].front() == 42);
+
+        const auto& ct = t;
+        CHECK(ct.get<last_step>()[10] == 30);
+    }
+
+    void aligned() {
+        sim::soa<last_step, flag> t(3);
+        CHECK(t.size() == 3);
+        CHECK(reinterpret_cast<uintptr_t>(t.get<last_step>().data()) % 64 == 0);
+        CHECK(reinterpret_cast<uintptr_t>(t.get<flag>().data()) % 64 == 0);
+        t.reserve(1000);
+        t.resize(10);
+        CHECK(t.get<flag>().size() == 10 && t.get<flag>()[9] == 0);
+    }
+}
+
+int main() {
+    columns();
+    aligned();
+    return test::result();
+}
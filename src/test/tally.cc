@@ -0,0 +1,286 @@
+#include "check.hh"
+#include "sim/bitmap.hh"
+#include "sim/tally.hh"
+#include "sim/topology.hh"
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+
+//
+// bitmaps, opinion bundles, and rounds decided from bundles against the
+// same rounds decided by flooding one opinion per packet.
+//
+
+namespace {
+
+    sim::sha256_t hash_of(uint8_t n) {
+        sim::sha256_t h {};
+        h[0] = n;
+        return h;
+    }
+
+    sim::bitmap of(std::initializer_list<size_t> ids) {
+        sim::bitmap b;
+        for(auto i : ids) {
+            b.set(i);
+        }
+        return b;
+    }
+
+    void bitmaps() {
+        sim::bitmap a;
+        CHECK(a.empty() && a.count() == 0 && a.bytes() == 0);
+        a.set(3);
+        a.set(64);
+        a.set(200);
+        CHECK(a.test(3) && a.test(64) && a.test(200) && !a.test(4) && !a.test(1000));
+        CHECK(a.count() == 3 && a.bytes() == 4 * sizeof(uint64_t));
+
+        auto b = of({ 3, 5 });
+        CHECK(b.merge(a) == 2);
+        CHECK(b.count() == 4);
+        CHECK(b.merge(a) == 0);
+
+        auto rest = b.without(a);
+        CHECK(rest.count() == 1 && rest.test(5));
+        // a shorter mask leaves the words past it alone.
+        CHECK(a.without(of({ 3 })).count() == 2);
+        CHECK(of({ 1 }).without(a).test(1));
+        CHECK(a.without(a).empty());
+        a.clear();
+        CHECK(a.empty() && !a.test(3));
+    }
+
+    //
+    // what a bundle carries merges back into the same counts, and each
+    // peer is only sent what it doesn't have.
+    void bundles() {
+        sim::tally t(2);
+        CHECK(t.add(1, hash_of(1), of({ 1, 2 })) == 2);
+        CHECK(t.add(1, hash_of(2), of({ 3 }), 0) == 1);
+        // first opinion per voter wins, whatever the round or hash.
+        CHECK(t.add(1, hash_of(2), of({ 1, 4 }), 1) == 1);
+        CHECK(t.voters() == 4 && t.voted(1) && t.voted(4) && !t.voted(5));
+
+        auto to0 = t.bundle_for(0);
+        auto to1 = t.bundle_for(1);
+        // peer 0 told us of voter 3 and lacks the rest; peer 1 told us of
+        // 1 and 4, and lacks 2 and 3.
+        CHECK(to0.entries.size() == 2 && to1.entries.size() == 2);
+        CHECK(t.bundle_for(0).entries.empty() && t.bundle_for(1).entries.empty());
+        CHECK(to0.bytes() == sizeof(size_t) + 2 * (sizeof(int) + sizeof(sim::sha256_t) + sizeof(uint64_t)));
+
+        sim::tally r(1);
+        CHECK(r.fresh(to0) == 4);
+        CHECK(r.merge(to0, 0) == 4);
+        CHECK(r.fresh(to0) == 0);
+        CHECK(r.voters() == t.voters());
+        CHECK(r.leader(1) == t.leader(1));
+        CHECK(r.leader(1).first == hash_of(1) && r.leader(1).second == 2);
+        // r got everything from peer 0, so has nothing for it.
+        CHECK(r.bundle_for(0).entries.empty());
+
+        // a tie goes to the lower hash; a round without votes has none.
+        sim::tally tie;
+        tie.add(7, hash_of(9), of({ 1 }));
+        tie.add(7, hash_of(8), of({ 2 }));
+        CHECK(tie.leader(7).first == hash_of(8));
+        CHECK(tie.leader(8).second == 0);
+
+        t.clear();
+        CHECK(t.voters() == 0 && !t.voted(1) && t.peers() == 2);
+    }
+
+    //
+    // peers that move keep what they are known to have; a new one is sent
+    // everything, one that is gone is forgotten.
+    void remap() {
+        sim::tally t(2);
+        t.add(1, hash_of(1), of({ 1 }), 0);
+        t.add(1, hash_of(2), of({ 2 }), 1);
+        t.remap({ sim::tally::none, 0 }, 2);
+        CHECK(t.peers() == 2);
+        auto moved = t.bundle_for(0);
+        CHECK(moved.entries.size() == 1 && moved.entries[0].block_sha == hash_of(1));
+        CHECK(t.bundle_for(1).entries.size() == 2);
+        CHECK(t.bundle_for(5).entries.empty());
+    }
+
+    //
+    // a network where each node votes for one of a few hashes at a time of
+    // its own.  flooding forwards each opinion to every peer when it first
+    // arrives; bundling forwards at the end of the step what the tally has
+    // that a peer lacks.  either way an opinion first reaches a node at the
+    // same step, so every node decides each round on the same hash.
+    struct network {
+        static constexpr uint32_t n = 60;
+        static constexpr size_t quorum = n * 9 / 10;
+        const sim::topology topo;
+
+        explicit network(uint64_t seed)
+        : topo(sim::topology::random_regular(n, 6, seed, { 1, 4 })) {}
+
+        size_t peer_index(uint32_t node, uint32_t peer) const {
+            for(uint32_t j = topo.offsets[node]; j < topo.offsets[node + 1]; j++) {
+                if(topo.neighbors[j] == peer) {
+                    return j - topo.offsets[node];
+                }
+            }
+            return sim::tally::none;
+        }
+
+        struct vote {
+            int64_t at;
+            uint8_t hash;
+        };
+
+        template <typename Packet>
+        struct wire {
+            std::multimap<int64_t, std::tuple<uint32_t, uint32_t, Packet>> in_flight; // arrival -> to, from, packet
+            uint64_t sent {0};
+
+            void send(const sim::topology& topo, uint32_t from, int64_t now, const Packet& p, uint32_t skip = ~0u) {
+                for(uint32_t j = topo.offsets[from]; j < topo.offsets[from + 1]; j++) {
+                    if(topo.neighbors[j] != skip) {
+                        in_flight.emplace(now + topo.latencies[j], std::make_tuple(topo.neighbors[j], from, p));
+                        sent++;
+                    }
+                }
+            }
+
+            //
+            // what arrives at now, taken off the wire before any of it is
+            // answered.
+            std::vector<std::tuple<uint32_t, uint32_t, Packet>> take(int64_t now) {
+                std::vector<std::tuple<uint32_t, uint32_t, Packet>> due;
+                auto range = in_flight.equal_range(now);
+                for(auto it = range.first; it != range.second; ++it) {
+                    due.push_back(std::move(it->second));
+                }
+                in_flight.erase(range.first, range.second);
+                return due;
+            }
+        };
+
+        //
+        // the hash each node decides, one opinion per packet.
+        std::vector<sim::sha256_t> flood(const std::vector<vote>& votes, uint64_t& packets) const {
+            struct opinion {
+                uint32_t voter;
+                uint8_t hash;
+            };
+            wire<opinion> w;
+            std::vector<std::map<uint32_t, uint8_t>> seen(n);
+            std::vector<sim::sha256_t> decided(n);
+            std::vector<bool> done(n, false);
+            for(int64_t now = 0; now < 200; now++) {
+                for(uint32_t v = 0; v < n; v++) {
+                    if(votes[v].at == now && seen[v].emplace(v, votes[v].hash).second) {
+                        w.send(topo, v, now, { v, votes[v].hash });
+                    }
+                }
+                for(auto& [to, from, op] : w.take(now)) {
+                    if(seen[to].emplace(op.voter, op.hash).second) {
+                        w.send(topo, to, now, op, from);
+                    }
+                }
+                for(uint32_t v = 0; v < n; v++) {
+                    if(!done[v] && seen[v].size() >= quorum) {
+                        std::map<sim::sha256_t, size_t> counts;
+                        for(auto& it : seen[v]) {
+                            counts[hash_of(it.second)]++;
+                        }
+                        std::pair<sim::sha256_t, size_t> best {};
+                        for(auto& it : counts) {
+                            if(it.second > best.second) {
+                                best = it;
+                            }
+                        }
+                        decided[v] = best.first;
+                        done[v] = true;
+                    }
+                }
+            }
+            packets = w.sent;
+            return decided;
+        }
+
+        //
+        // the same, as tally bundles sent at most once a step.
+        std::vector<sim::sha256_t> bundle(const std::vector<vote>& votes, uint64_t& packets) const {
+            wire<sim::tally::bundle> w;
+            std::vector<sim::tally> tallies;
+            for(uint32_t v = 0; v < n; v++) {
+                tallies.emplace_back(topo.offsets[v + 1] - topo.offsets[v]);
+            }
+            std::vector<sim::sha256_t> decided(n);
+            std::vector<bool> done(n, false);
+            uint64_t sent = 0;
+            for(int64_t now = 0; now < 200; now++) {
+                std::vector<bool> dirty(n, false);
+                for(uint32_t v = 0; v < n; v++) {
+                    if(votes[v].at == now) {
+                        dirty[v] = tallies[v].add(1, hash_of(votes[v].hash), of({ v })) > 0 || dirty[v];
+                    }
+                }
+                for(auto& [to, from, b] : w.take(now)) {
+                    dirty[to] = tallies[to].merge(b, peer_index(to, from)) > 0 || dirty[to];
+                }
+                for(uint32_t v = 0; v < n; v++) {
+                    if(!dirty[v]) {
+                        continue;
+                    }
+                    for(uint32_t j = topo.offsets[v]; j < topo.offsets[v + 1]; j++) {
+                        auto b = tallies[v].bundle_for(j - topo.offsets[v]);
+                        if(!b.entries.empty()) {
+                            w.in_flight.emplace(now + topo.latencies[j], std::make_tuple(topo.neighbors[j], v, std::move(b)));
+                            sent++;
+                        }
+                    }
+                }
+                for(uint32_t v = 0; v < n; v++) {
+                    if(!done[v] && tallies[v].voters() >= quorum) {
+                        decided[v] = tallies[v].leader(1).first;
+                        done[v] = true;
+                    }
+                }
+            }
+            packets = sent;
+            return decided;
+        }
+    };
+
+    void same_decisions() {
+        uint64_t flooded = 0, bundled = 0;
+        for(uint64_t seed = 1; seed <= 20; seed++) {
+            network net(seed);
+            std::mt19937_64 gen(seed);
+            std::vector<network::vote> votes;
+            for(uint32_t v = 0; v < network::n; v++) {
+                votes.push_back({ int64_t(gen() % 12), uint8_t(1 + gen() % 3) });
+            }
+            uint64_t fp = 0, bp = 0;
+            auto by_flood = net.flood(votes, fp);
+            auto by_bundle = net.bundle(votes, bp);
+            CHECK(by_flood == by_bundle);
+            // every node decided.
+            for(auto& it : by_bundle) {
+                CHECK(it != sim::sha256_t {});
+            }
+            flooded += fp;
+            bundled += bp;
+        }
+        CHECK(bundled < flooded);
+    }
+}
+
+int main() {
+    bitmaps();
+    bundles();
+    remap();
+    same_decisions();
+    return test::result();
+}
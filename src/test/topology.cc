@@ -0,0 +1,146 @@
+#include "check.hh"
+#include "sim/topology.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+//
+// topology generators and partitioning.
+//
+
+namespace {
+
+    bool same(const sim::topology& a, const sim::topology& b) {
+        if(a.nodes != b.nodes || a.edges.size() != b.edges.size() || a.neighbors != b.neighbors || a.latencies != b.latencies) {
+            return false;
+        }
+        for(size_t i = 0; i < a.edges.size(); i++) {
+            if(a.edges[i].a != b.edges[i].a || a.edges[i].b != b.edges[i].b || a.edges[i].latency != b.edges[i].latency) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool well_formed(const sim::topology& t) {
+        std::set<std::pair<uint32_t, uint32_t>> seen;
+        for(auto& e : t.edges) {
+            if(e.a >= e.b || e.b >= t.nodes || !seen.insert({ e.a, e.b }).second) {
+                return false;
+            }
+        }
+        return t.offsets.size() == size_t(t.nodes) + 1 && t.neighbors.size() == 2 * t.edges.size();
+    }
+
+    //
+    // the graph depends on the seed only, not on who runs the chunks.
+    void deterministic() {
+        sim::scheduler sched(4);
+        sim::engine engine(1, 3);
+        const uint32_t n = 20000; // several chunks
+        auto rr = sim::topology::random_regular(n, 6, 7, { 1, 5 });
+        CHECK(same(rr, sim::topology::random_regular(n, 6, 7, { 1, 5 }, sched)));
+        CHECK(same(rr, sim::topology::random_regular(n, 6, 7, { 1, 5 }, engine)));
+        auto er = sim::topology::erdos_renyi(n, 0.0005, 7);
+        CHECK(same(er, sim::topology::erdos_renyi(n, 0.0005, 7, { 1, 1 }, sched)));
+        auto ws = sim::topology::watts_strogatz(n, 4, 0.1, 7);
+        CHECK(same(ws, sim::topology::watts_strogatz(n, 4, 0.1, 7, { 1, 1 }, engine)));
+        auto geo = sim::topology::geographic(n, 5, 7, { 1, 9 });
+        CHECK(same(geo, sim::topology::geographic(n, 5, 7, { 1, 9 }, sched)));
+        auto ba = sim::topology::barabasi_albert(n, 2, 7);
+        CHECK(same(ba, sim::topology::barabasi_albert(n, 2, 7, { 1, 1 }, sched)));
+        for(auto t : { &rr, &er, &ws, &geo, &ba }) {
+            CHECK(well_formed(*t));
+        }
+        CHECK(!same(rr, sim::topology::random_regular(n, 6, 8, { 1, 5 })));
+    }
+
+    bool exactly_regular(const sim::topology& t, uint32_t d) {
+        for(uint32_t i = 0; i < t.nodes; i++) {
+            if(t.degree(i) != d) {
+                return false;
+            }
+        }
+        return well_formed(t);
+    }
+
+    //
+    // duplicate edges are swapped away, so every degree is exact, odd ones
+    // included; small dense graphs are where duplicates are common.
+    void regular() {
+        auto t = sim::topology::random_regular(5000, 8, 3, { 2, 4 });
+        CHECK(exactly_regular(t, 8));
+        for(auto l : t.latencies) {
+            CHECK(l >= 2 && l <= 4);
+        }
+        for(uint64_t seed = 0; seed < 20; seed++) {
+            CHECK(exactly_regular(sim::topology::random_regular(50, 6, seed), 6));
+            CHECK(exactly_regular(sim::topology::random_regular(12, 8, seed), 8));
+            CHECK(exactly_regular(sim::topology::random_regular(1000, 3, seed), 3));
+            CHECK(exactly_regular(sim::topology::random_regular(50, 5, seed), 5));
+            CHECK(exactly_regular(sim::topology::random_regular(10, 7, seed), 7));
+        }
+        CHECK(exactly_regular(sim::topology::random_regular(2, 1, 1), 1));
+
+        auto throws = [](uint32_t n, uint32_t d) {
+            try {
+                sim::topology::random_regular(n, d, 1);
+            } catch(const std::invalid_argument&) {
+                return true;
+            }
+            return false;
+        };
+        CHECK(throws(51, 5));
+        CHECK(throws(8, 8));
+        CHECK(!throws(9, 8));
+    }
+
+    //
+    // each node's k nearest are its neighbours, on grids of both parities;
+    // an even grid used to visit its outermost ring's wrapped cells twice
+    // and fill the candidate list with duplicates.
+    void geographic_nearest() {
+        for(uint32_t n : { 32u, 50u, 200u, 1000u }) {
+            const uint32_t k = 6;
+            auto t = sim::topology::geographic(n, k, 11);
+            CHECK(well_formed(t));
+            for(uint32_t i = 0; i < n; i++) {
+                CHECK(t.degree(i) >= k);
+            }
+        }
+    }
+
+    void partitioning() {
+        auto t = sim::topology::geographic(4000, 6, 5);
+        const uint32_t parts = 4;
+        auto part = t.partition(parts);
+        std::vector<uint32_t> size(parts, 0);
+        for(auto p : part) {
+            CHECK(p < parts);
+            size[p]++;
+        }
+        const uint32_t room = uint32_t(std::ceil(4000.0 / parts * 1.05));
+        for(auto s : size) {
+            CHECK(s <= room);
+        }
+        // far fewer cut edges than the 3/4 a random split would cut.
+        std::vector<uint32_t> naive(t.nodes);
+        for(uint32_t i = 0; i < t.nodes; i++) {
+            naive[i] = i % parts;
+        }
+        CHECK(t.cut(part) * 4 < t.cut(naive));
+        CHECK(t.partition(1) == std::vector<uint32_t>(t.nodes, 0));
+        CHECK(part == t.partition(parts));
+    }
+}
+
+int main() {
+    deterministic();
+    regular();
+    geographic_nearest();
+    partitioning();
+    return test::result();
+}